@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include "allocator.h"
+
+namespace {
+
+
+inline uint32_t alignSize(uint32_t size) {
+  return (size + ALLOCATOR_ALIGNMENT - 1) & ~(ALLOCATOR_ALIGNMENT - 1);
+}
+
+
+} // namespace ''
+
+Allocator::Allocator()
+  : statistics{ 0, 0, 0, 0 } {
+}
+
+void Allocator::getStatistics(AllocatorStatistics *stats) const {
+  assert(stats != nullptr);
+  *stats = statistics;
+}
+
+void Allocator::resetHighWaterMark() {
+  statistics.highWaterMark = statistics.bytesInUse;
+}
+
+void Allocator::countAllocation(void *ptr, uint32_t size) {
+  if (ptr == nullptr) {
+    statistics.failedAllocations++;
+    return;
+  }
+
+  statistics.numAllocations++;
+  statistics.bytesInUse += size;
+  if (statistics.bytesInUse > statistics.highWaterMark)
+    statistics.highWaterMark = statistics.bytesInUse;
+}
+
+void Allocator::countRelease(uint32_t size) {
+  assert(statistics.bytesInUse >= size);
+  statistics.bytesInUse -= size;
+}
+
+void *HeapAllocator::allocate(uint32_t size) {
+  void *ptr = malloc(size);
+  countAllocation(ptr, size);
+
+  return ptr;
+}
+
+void HeapAllocator::release(void *ptr, uint32_t size) {
+  if (ptr == nullptr)
+    return;
+
+  free(ptr);
+  countRelease(size);
+}
+
+ArenaAllocator::ArenaAllocator(void *pMemory, uint32_t pMemorySize)
+  : memory((uint8_t*) pMemory),
+    memorySize(pMemorySize),
+    offset(0),
+    lastOffset(0) {
+
+  assert(memory != nullptr);
+  assert(((uintptr_t) memory & (ALLOCATOR_ALIGNMENT - 1)) == 0);
+}
+
+void *ArenaAllocator::allocate(uint32_t size) {
+  const uint32_t alignedSize = alignSize(size);
+
+  void *ptr = nullptr;
+  if (alignedSize >= size && alignedSize <= memorySize - offset) {
+    ptr = memory + offset;
+    lastOffset = offset;
+    offset += alignedSize;
+  }
+
+  countAllocation(ptr, alignedSize);
+  return ptr;
+}
+
+void ArenaAllocator::release(void *ptr, uint32_t size) {
+  if (ptr == nullptr)
+    return;
+
+  assert((uint8_t*) ptr >= memory && (uint8_t*) ptr < memory + offset);
+
+  // Only the last block can be reclaimed before reset.
+  if ((uint8_t*) ptr == memory + lastOffset) {
+    countRelease(offset - lastOffset);
+    offset = lastOffset;
+  }
+
+  (void) size;
+}
+
+void ArenaAllocator::reset() {
+  offset = 0;
+  lastOffset = 0;
+  statistics.bytesInUse = 0;
+}
+
+PoolAllocator::PoolAllocator(void *memory,
+  const uint32_t blocksPerClass[ALLOCATOR_POOL_CLASSES],
+  Allocator *pFallback)
+  : fallback(pFallback) {
+
+  assert(((uintptr_t) memory & (ALLOCATOR_ALIGNMENT - 1)) == 0);
+
+  uint8_t *block = (uint8_t*) memory;
+  for (uint32_t sizeClass = 0; sizeClass < ALLOCATOR_POOL_CLASSES;
+    ++sizeClass) {
+
+    const uint32_t blockSize = getBlockSize(sizeClass);
+    classBegin[sizeClass] = block;
+    freeBlocks[sizeClass] = nullptr;
+
+    // Chain the blocks so they are handed out in address order.
+    FreeBlock **tail = &freeBlocks[sizeClass];
+    for (uint32_t i = 0; i < blocksPerClass[sizeClass]; ++i) {
+      FreeBlock *freeBlock = (FreeBlock*) block;
+      *tail = freeBlock;
+      tail = &freeBlock->next;
+
+      block += blockSize;
+    }
+
+    *tail = nullptr;
+    classEnd[sizeClass] = block;
+  }
+}
+
+uint32_t PoolAllocator::getPoolSize(
+  const uint32_t blocksPerClass[ALLOCATOR_POOL_CLASSES]) {
+
+  uint32_t size = 0;
+  for (uint32_t sizeClass = 0; sizeClass < ALLOCATOR_POOL_CLASSES;
+    ++sizeClass) {
+
+    size += blocksPerClass[sizeClass] * getBlockSize(sizeClass);
+  }
+
+  return size;
+}
+
+void *PoolAllocator::allocate(uint32_t size) {
+  void *ptr = nullptr;
+
+  // Smallest class that fits with a free block left.
+  for (uint32_t sizeClass = 0; sizeClass < ALLOCATOR_POOL_CLASSES;
+    ++sizeClass) {
+
+    FreeBlock *freeBlock = freeBlocks[sizeClass];
+    if (size > getBlockSize(sizeClass) || freeBlock == nullptr)
+      continue;
+
+    freeBlocks[sizeClass] = freeBlock->next;
+    ptr = freeBlock;
+    break;
+  }
+
+  // Blocks of the fallback are only counted there.
+  if (ptr == nullptr && fallback != nullptr)
+    return fallback->allocate(size);
+
+  countAllocation(ptr, size);
+  return ptr;
+}
+
+void PoolAllocator::release(void *ptr, uint32_t size) {
+  if (ptr == nullptr)
+    return;
+
+  for (uint32_t sizeClass = 0; sizeClass < ALLOCATOR_POOL_CLASSES;
+    ++sizeClass) {
+
+    if ((uint8_t*) ptr >= classBegin[sizeClass] &&
+      (uint8_t*) ptr < classEnd[sizeClass]) {
+
+      countRelease(size);
+
+      FreeBlock *freeBlock = (FreeBlock*) ptr;
+      freeBlock->next = freeBlocks[sizeClass];
+      freeBlocks[sizeClass] = freeBlock;
+      return;
+    }
+  }
+
+  // Not one of ours.
+  assert(fallback != nullptr);
+  fallback->release(ptr, size);
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+#ifndef _ALLOCATOR_H_
+#define _ALLOCATOR_H_
+
+// Kept free of yaul, shared with tools/allocreplay.
+#include <stdint.h>
+
+// Alignment of every block returned by ArenaAllocator and PoolAllocator.
+#define ALLOCATOR_ALIGNMENT 4
+
+// Number of size classes of PoolAllocator and the block size of the
+// first one, each class doubles the block size of the previous one
+// (512, 2048, 8192 and 32768 bytes).
+#define ALLOCATOR_POOL_CLASSES 4
+#define ALLOCATOR_POOL_MIN_BLOCK 512
+#define ALLOCATOR_POOL_CLASS_SHIFT 2
+
+/**
+ * Usage counters kept by every allocator.
+ */
+struct AllocatorStatistics {
+  // Bytes currently handed out, as requested by the callers. Arenas
+  // count aligned blocks until they are reclaimed, the high water mark
+  // is then the arena size needed.
+  uint32_t bytesInUse;
+
+  // Largest value reached by bytesInUse.
+  uint32_t highWaterMark;
+
+  uint32_t numAllocations;
+  uint32_t failedAllocations;
+};
+
+/**
+ * Source of the memory of File contents. Callers give the size back on
+ * release, so allocators don't need per block headers.
+ */
+class Allocator {
+public:
+  virtual ~Allocator() {}
+
+  /**
+   * @return Block of at least size bytes, or nullptr if out of memory.
+   */
+  virtual void *allocate(uint32_t size) = 0;
+
+  /**
+   * Give back a block returned by allocate, with the same size.
+   */
+  virtual void release(void *ptr, uint32_t size) = 0;
+
+  void getStatistics(AllocatorStatistics *stats) const;
+
+  // Start tracking the high water mark again from the current usage.
+  void resetHighWaterMark();
+
+protected:
+  Allocator();
+
+  void countAllocation(void *ptr, uint32_t size);
+  void countRelease(uint32_t size);
+
+  AllocatorStatistics statistics;
+};
+
+/**
+ * Allocator using the libc heap (malloc/free), the default of Filesystem.
+ */
+class HeapAllocator : public Allocator {
+public:
+  void *allocate(uint32_t size) override;
+  void release(void *ptr, uint32_t size) override;
+};
+
+/**
+ * Bump allocator over a caller provided region. Blocks are only given
+ * back all at once by reset (for example once per level), releasing a
+ * block only reclaims it when it is the last one allocated.
+ */
+class ArenaAllocator : public Allocator {
+public:
+  ArenaAllocator(void *memory, uint32_t memorySize);
+
+  void *allocate(uint32_t size) override;
+  void release(void *ptr, uint32_t size) override;
+
+  // Drop every block. Files using the arena must be closed before.
+  void reset();
+
+private:
+  uint8_t *memory;
+  uint32_t memorySize;
+  uint32_t offset;
+
+  // Offset before the last allocation, to undo it on release.
+  uint32_t lastOffset;
+};
+
+/**
+ * Fixed size blocks over a caller provided region, ALLOCATOR_POOL_CLASSES
+ * classes with their own free list. Small files then never fragment the
+ * heap. Requests bigger than the largest class, or hitting an exhausted
+ * class, are served by a fallback allocator if given, and only counted
+ * in the statistics of the fallback.
+ */
+class PoolAllocator : public Allocator {
+public:
+  /**
+   * @param memory Region holding every block, aligned to
+   *               ALLOCATOR_ALIGNMENT. Use getPoolSize for its size.
+   * @param blocksPerClass Number of blocks of each class.
+   * @param fallback Optional allocator for requests the pool can't serve.
+   */
+  PoolAllocator(void *memory,
+    const uint32_t blocksPerClass[ALLOCATOR_POOL_CLASSES],
+    Allocator *fallback = nullptr);
+
+  void *allocate(uint32_t size) override;
+  void release(void *ptr, uint32_t size) override;
+
+  // Bytes of memory required by the given number of blocks per class.
+  static uint32_t getPoolSize(
+    const uint32_t blocksPerClass[ALLOCATOR_POOL_CLASSES]);
+
+  static inline uint32_t getBlockSize(uint32_t sizeClass) {
+    return ALLOCATOR_POOL_MIN_BLOCK <<
+      (sizeClass * ALLOCATOR_POOL_CLASS_SHIFT);
+  }
+
+private:
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+
+  // Blocks of each class are contiguous, from begin up to end.
+  uint8_t *classBegin[ALLOCATOR_POOL_CLASSES];
+  uint8_t *classEnd[ALLOCATOR_POOL_CLASSES];
+  FreeBlock *freeBlocks[ALLOCATOR_POOL_CLASSES];
+
+  Allocator *fallback;
+};
+
+
+#endif // _ALLOCATOR_H_
@@ -6,6 +6,10 @@
  */
 
 #include "cdblock.h"
+#include "crc32.h"
+#include "fileindex.h"
+#include "search.h"
+#include "sort.h"
 #include <cd-block.h>
 #include <ctype.h>
 
@@ -19,61 +23,212 @@ namespace CdBlock {
 
 namespace {
 
-template <typename T>
-void binarySearch(T *entries, uint32_t entriesLength, 
-  T searchElement, T **foundEntry) {
+// Marks an empty sector cache slot.
+#define INVALID_CACHE_LBA 0xFFFFFFFF
 
-  const uint32_t pivotIndex = entriesLength / 2;
-  T *pivot = &entries[pivotIndex];
+ReadStatistics readStatistics;
 
-  if (*pivot == searchElement) {
-    *foundEntry = pivot;
+// Sector following the last one read, where the pickup stands.
+uint32_t nextDriveFad;
 
-  } else if (entriesLength > 1) {
-    if (*pivot > searchElement) {
-      binarySearch(entries, pivotIndex, searchElement, foundEntry);
+struct AccessTrace {
+  FileAccessRecord *records;
+  uint32_t numRecords;
+  AccessTraceClock clock;
 
-    } else {
-      binarySearch(&entries[pivotIndex],
-        entriesLength - pivotIndex, searchElement, foundEntry);
-    }
+  // Files recorded since the trace started, may exceed numRecords.
+  uint32_t numAccesses;
+  bool running;
+} accessTrace;
+
+/**
+ * Single entry point to the drive, keeps the read statistics.
+ */
+int readDriveData(uint32_t fad, uint32_t length, void *buffer) {
+  const uint32_t numSectors = (length + 2047) / 2048;
+
+  readStatistics.commandsIssued += 1;
+  readStatistics.sectorsRead += numSectors;
+
+  if (fad != nextDriveFad) {
+    readStatistics.seeks += 1;
+    readStatistics.seekDistance += (fad > nextDriveFad) ? 
+      fad - nextDriveFad : nextDriveFad - fad;
   }
+
+  nextDriveFad = fad + numSectors;
+
+  return cd_block_read_data(fad, length, (uint8_t*) buffer);
 }
 
-template <typename T>
-void quickSort(T *entries, int32_t left, int32_t right) {
+struct SectorCacheSlot {
+  uint32_t lba;
 
-  // Already sorted.
-  if (right <= left)
-    return;
+  // Value of sectorCache.useCounter when last accessed.
+  uint32_t lastUse;
+};
 
-  int32_t pivotIndex = left + (right - left) / 2;
-  int32_t l = left - 1;
-  int32_t r = right + 1;
-  
-  const T pivot = entries[pivotIndex];
-  for (;;) {
-    do {
-      l++;
-    } while (entries[l] < pivot);
-    
-    do {
-      r--;
-    } while (entries[r] > pivot);
-
-    if (l >= r) {
-      pivotIndex = r;
-      break;
+struct SectorCache {
+  uint32_t numSlots;
+  uint32_t useCounter;
+
+  SectorCacheSlot *slots;
+  Sector *sectors;
+} sectorCache;
+
+Sector *findCachedSector(uint32_t lba) {
+  for (uint32_t i = 0; i < sectorCache.numSlots; ++i) {
+    if (sectorCache.slots[i].lba == lba) {
+      sectorCache.slots[i].lastUse = ++sectorCache.useCounter;
+      return &sectorCache.sectors[i];
     }
-  
-    // Swap
-    const T tmp = entries[r];
-    entries[r] = entries[l];
-    entries[l] = tmp;
   }
 
-  quickSort(entries, left, pivotIndex);
-  quickSort(entries, pivotIndex + 1, right);
+  return nullptr;
+}
+
+void insertCachedSector(uint32_t lba, const void *data) {
+  uint32_t victim = 0;
+  for (uint32_t i = 1; i < sectorCache.numSlots; ++i) {
+    if (sectorCache.slots[i].lastUse < sectorCache.slots[victim].lastUse)
+      victim = i;
+  }
+
+  sectorCache.slots[victim].lba = lba;
+  sectorCache.slots[victim].lastUse = ++sectorCache.useCounter;
+  memcpy(&sectorCache.sectors[victim], data, 2048);
+}
+
+/**
+ * Read sectors from the drive in bursts, bypassing the sector cache.
+ */
+int readUncachedSectors(uint32_t lba, uint32_t numSectors, uint8_t *buffer) {
+  while (numSectors > 0) {
+    const uint32_t burstSectors = 
+      (numSectors > CDBLOCK_MAX_BURST_SECTORS) ? 
+      CDBLOCK_MAX_BURST_SECTORS
+      :
+      numSectors;
+
+    const int ret = readDriveData(LBA2FAD(lba), burstSectors * 2048, 
+      buffer);
+
+    if (ret != 0)
+      return ret;
+
+    buffer += burstSectors * 2048;
+    numSectors -= burstSectors;
+    lba += burstSectors;
+  }
+
+  return 0;
+}
+
+struct PrefetchWindow {
+  // Sectors the window can hold, 0 when prefetching is disabled.
+  uint32_t capacity;
+  Sector *sectors;
+
+  // Sectors currently held, starting at lba.
+  uint32_t lba;
+  uint32_t numSectors;
+
+  // Held sectors handed out so far, counted from the first one.
+  uint32_t usedSectors;
+
+  // Sector following the last request, reads starting there are
+  // sequential.
+  uint32_t streamLBA;
+
+  // Reads ahead stop before this sector, the end of the file being read
+  // by continueFileContents or readFileSectors (INVALID_CACHE_LBA when
+  // unknown).
+  uint32_t endLBA;
+} prefetchWindow;
+
+void dropPrefetchWindow() {
+  readStatistics.prefetchWasted +=
+    prefetchWindow.numSectors - prefetchWindow.usedSectors;
+
+  prefetchWindow.numSectors = 0;
+  prefetchWindow.usedSectors = 0;
+}
+
+/**
+ * Read sectors through the prefetch window. A request continuing the
+ * previous one is extended to the whole window, so the following sectors
+ * come with the same drive command and the next sequential requests are
+ * served from memory. Other requests go straight to the drive and leave
+ * the window alone, an interleaved stream finds its sectors still there.
+ */
+int readPrefetchedSectors(uint32_t lba, uint32_t numSectors,
+  uint8_t *buffer) {
+
+  if (prefetchWindow.capacity == 0)
+    return readUncachedSectors(lba, numSectors, buffer);
+
+  bool sequential = (lba == prefetchWindow.streamLBA);
+
+  // Leading sectors already in the window.
+  if (lba >= prefetchWindow.lba &&
+    lba - prefetchWindow.lba < prefetchWindow.numSectors) {
+
+    const uint32_t offset = lba - prefetchWindow.lba;
+    uint32_t heldSectors = prefetchWindow.numSectors - offset;
+    if (heldSectors > numSectors)
+      heldSectors = numSectors;
+
+    memcpy(buffer, prefetchWindow.sectors[offset].data, heldSectors * 2048);
+    readStatistics.bytesCopied += heldSectors * 2048;
+    readStatistics.prefetchHits += heldSectors;
+
+    if (offset + heldSectors > prefetchWindow.usedSectors)
+      prefetchWindow.usedSectors = offset + heldSectors;
+
+    buffer += heldSectors * 2048;
+    numSectors -= heldSectors;
+    lba += heldSectors;
+    sequential = true;
+  }
+
+  prefetchWindow.streamLBA = lba + numSectors;
+  if (numSectors == 0)
+    return 0;
+
+  // Long requests gain nothing from the window, nor does the trailing
+  // sector of a file loaded with them.
+  if (numSectors >= prefetchWindow.capacity) {
+    prefetchWindow.streamLBA = INVALID_CACHE_LBA;
+    return readUncachedSectors(lba, numSectors, buffer);
+  }
+
+  uint32_t windowSectors = prefetchWindow.capacity;
+  if (prefetchWindow.endLBA <= lba)
+    windowSectors = 0;
+  else if (prefetchWindow.endLBA - lba < windowSectors)
+    windowSectors = prefetchWindow.endLBA - lba;
+
+  if (!sequential || windowSectors <= numSectors)
+    return readUncachedSectors(lba, numSectors, buffer);
+
+  dropPrefetchWindow();
+
+  const int ret = readUncachedSectors(lba, windowSectors,
+    (uint8_t*) prefetchWindow.sectors);
+
+  // Reading ahead may fail past the end of the disc.
+  if (ret != 0)
+    return readUncachedSectors(lba, numSectors, buffer);
+
+  prefetchWindow.lba = lba;
+  prefetchWindow.numSectors = windowSectors;
+  prefetchWindow.usedSectors = numSectors;
+  readStatistics.prefetchedSectors += windowSectors - numSectors;
+
+  memcpy(buffer, prefetchWindow.sectors, numSectors * 2048);
+  readStatistics.bytesCopied += numSectors * 2048;
+
+  return 0;
 }
 
 /**
@@ -136,8 +291,8 @@ void navigateDirectory(DirectoryRecord *record,
 
       for (uint32_t level = 0; level < extraLevels; ++level) {
         Sector sector;
-        const int stat = cd_block_read_data(LBA2FAD(dir->extentLocation()) +
-          level, 2048, sector.data);
+        const int stat = readSectors(dir->extentLocation() + level, 1, 
+          sector.data);
         
         assert(stat == 0);
   
@@ -151,16 +306,315 @@ void navigateDirectory(DirectoryRecord *record,
   }
 }
 
+/**
+ * File found while walking the directories. The secondary hash of its
+ * path is kept until the entries are sorted, in case the filename hash
+ * turns out to collide.
+ */
+struct TableBuilderEntry {
+  FilesystemEntry entry;
+  uint32_t secondaryHash;
+
+  // We compare entries by the hash.
+  inline bool operator == (const TableBuilderEntry& other) const {
+      return entry == other.entry;
+  }
+
+  inline bool operator < (const TableBuilderEntry& other) const {
+      return entry < other.entry;
+  }
+
+  inline bool operator > (const TableBuilderEntry& other) const {
+      return entry > other.entry;
+  }
+};
+
+/**
+ * Destination of the entries found while walking the directories.
+ */
+struct TableBuilder {
+  FilesystemHeaderTable *headerTable;
+
+  // Unpacked entries, grown while the disc is walked and packed into 
+  // headerTable once sorted.
+  TableBuilderEntry *entries;
+  uint32_t numEntries;
+  uint32_t capacity;
+
+  // Set if growing the entries failed.
+  bool outOfMemory;
+
+  // Most memory held at once so far, see peakBuildBytes.
+  uint32_t peakBytes;
+};
+
+/**
+ * Allocate the first entries of the builder.
+ *
+ * @return 0 If successful.
+ */
+int beginTableBuilder(TableBuilder *builder, 
+  FilesystemHeaderTable *headerTable) {
+
+  *builder = { headerTable, nullptr, 0, CDBLOCK_INITIAL_TABLE_ENTRIES, 
+    false, CDBLOCK_INITIAL_TABLE_ENTRIES * sizeof(TableBuilderEntry) };
+
+  builder->entries = (TableBuilderEntry*) malloc(
+    CDBLOCK_INITIAL_TABLE_ENTRIES * sizeof(TableBuilderEntry));
+
+  return (builder->entries != nullptr) ? 0 : -1;
+}
+
+/**
+ * Append an entry to the builder, growing it when full.
+ */
+void appendTableEntry(TableBuilder *builder, uint32_t hash, 
+  uint32_t secondaryHash, uint32_t lba, uint32_t size) {
+
+  if (builder->outOfMemory)
+    return;
+
+  if (builder->numEntries == builder->capacity) {
+    const uint32_t newCapacity = builder->capacity * 2;
+
+    // Both arrays are held while realloc moves the entries.
+    const uint32_t growBytes = (builder->capacity + newCapacity) * 
+      sizeof(TableBuilderEntry);
+
+    if (growBytes > builder->peakBytes)
+      builder->peakBytes = growBytes;
+
+    TableBuilderEntry *newEntries = (TableBuilderEntry*) realloc(
+      builder->entries, newCapacity * sizeof(TableBuilderEntry));
+
+    if (newEntries == nullptr) {
+      builder->outOfMemory = true;
+      return;
+    }
+
+    builder->entries = newEntries;
+    builder->capacity = newCapacity;
+  }
+
+  TableBuilderEntry *builderEntry = &builder->entries[builder->numEntries];
+  builderEntry->entry.filenameHash = hash;
+  builderEntry->entry.lba = lba;
+  builderEntry->entry.size = size;
+  builderEntry->secondaryHash = secondaryHash;
+
+  builder->numEntries += 1;
+}
+
+/**
+ * Look for files sharing the same hash in the sorted entries. If any, 
+ * those files are copied to headerTable->collisions, and only one entry
+ * per hash is left in the entries.
+ *
+ * @return 0 If every file can be told apart.
+ */
+int resolveCollisions(TableBuilder *builder) {
+  FilesystemHeaderTable *headerTable = builder->headerTable;
+  TableBuilderEntry *entries = builder->entries;
+
+  headerTable->numCollisions = 0;
+  headerTable->collisions = nullptr;
+
+  uint32_t numColliding = 0;
+  for (uint32_t i = 1; i < builder->numEntries; ++i) {
+    if (entries[i] == entries[i - 1])
+      numColliding += (i == 1 || !(entries[i - 1] == entries[i - 2])) ? 2 : 1;
+  }
+
+  if (numColliding == 0)
+    return 0;
+
+  headerTable->collisions = (FilesystemCollision*) malloc(numColliding * 
+    sizeof(FilesystemCollision));
+
+  if (headerTable->collisions == nullptr)
+    return -1;
+
+  FilesystemCollision *collisions = headerTable->collisions;
+  for (uint32_t i = 0; i < builder->numEntries; ++i) {
+    if ((i > 0 && entries[i] == entries[i - 1]) || 
+      (i + 1 < builder->numEntries && entries[i] == entries[i + 1])) {
+
+      collisions[headerTable->numCollisions].secondaryHash = 
+        entries[i].secondaryHash;
+
+      collisions[headerTable->numCollisions].entry = entries[i].entry;
+      headerTable->numCollisions += 1;
+    }
+  }
+
+  assert(headerTable->numCollisions == numColliding);
+
+  // Paths colliding on both hashes can't be told apart.
+  for (uint32_t i = 0; i < numColliding; ++i) {
+    for (uint32_t j = i + 1; j < numColliding; ++j) {
+      if (collisions[i].entry == collisions[j].entry &&
+        collisions[i].secondaryHash == collisions[j].secondaryHash) {
+
+        char tmpBuffer[128];
+        sprintf(tmpBuffer, "Unresolvable hash collision: %lu\n", 
+          collisions[i].entry.filenameHash);
+
+        dbgio_buffer(tmpBuffer);
+        dbgio_flush();
+        return -1;
+      }
+    }
+  }
+
+  // Keep a single entry per hash.
+  uint32_t numEntries = 1;
+  for (uint32_t i = 1; i < builder->numEntries; ++i) {
+    if (!(entries[i] == entries[numEntries - 1]))
+      entries[numEntries++] = entries[i];
+  }
+
+  builder->numEntries = numEntries;
+  return 0;
+}
+
+/**
+ * Pack the location of a file.
+ *
+ * @return false If it does not fit in a FilesystemExtent.
+ */
+bool packExtent(uint32_t lba, uint32_t size, FilesystemExtent *extent) {
+  if ((lba >> CDBLOCK_EXTENT_LBA_BITS) != 0 || 
+    (size >> (CDBLOCK_EXTENT_SECTOR_BITS + 11)) != 0) {
+
+    return false;
+  }
+
+  const uint32_t sectors = size >> 11;
+  extent->lbaLow = lba & 0xFFFF;
+  extent->sectorsLow = sectors & 0xFFFF;
+  extent->high = ((lba >> 16) << 13) | ((sectors >> 16) << 11) | 
+    (size & 2047);
+
+  return true;
+}
+
+/**
+ * Store sorted entries into the hashes and extents of headerTable, 
+ * allocating them unless headerTable->hashes already points to user 
+ * memory.
+ *
+ * @return 0 If successful, -1 if out of memory or a file does not fit 
+ *         in a FilesystemExtent.
+ */
+int packHeaderTable(FilesystemHeaderTable *headerTable, 
+  const FilesystemEntry *entries, uint32_t numEntries) {
+
+  FilesystemExtent extent;
+  for (uint32_t i = 0; i < numEntries; ++i) {
+    if (!packExtent(entries[i].lba, entries[i].size, &extent)) {
+      char tmpBuffer[128];
+      sprintf(tmpBuffer, "File %lu out of the packed table range\n", 
+        entries[i].filenameHash);
+
+      dbgio_buffer(tmpBuffer);
+      dbgio_flush();
+      return -1;
+    }
+  }
+
+  if (headerTable->hashes == nullptr) {
+    headerTable->hashes = (uint32_t*) malloc(numEntries * 
+      (sizeof(uint32_t) + sizeof(FilesystemExtent)));
+
+    if (headerTable->hashes == nullptr)
+      return -1;
+  }
+
+  headerTable->extents = (FilesystemExtent*) 
+    (headerTable->hashes + numEntries);
+
+  for (uint32_t i = 0; i < numEntries; ++i) {
+    headerTable->hashes[i] = entries[i].filenameHash;
+    packExtent(entries[i].lba, entries[i].size, &headerTable->extents[i]);
+  }
+
+  headerTable->numEntries = numEntries;
+  return 0;
+}
+
+/**
+ * Free whatever the builder allocated and leave the table empty.
+ */
+void releaseTableBuilder(TableBuilder *builder) {
+  FilesystemHeaderTable *headerTable = builder->headerTable;
+
+  free(builder->entries);
+  builder->entries = nullptr;
+  builder->numEntries = 0;
+
+  free(headerTable->collisions);
+  headerTable->collisions = nullptr;
+
+  headerTable->numEntries = 0;
+  headerTable->numCollisions = 0;
+}
+
+/**
+ * Release the builder if building failed, otherwise sort the entries and
+ * pack them into the table.
+ *
+ * @return 0 If the table was built.
+ */
+int finishTableBuilder(TableBuilder *builder) {
+  if (builder->outOfMemory) {
+    releaseTableBuilder(builder);
+    return -1;
+  }
+
+  introSort(builder->entries, builder->numEntries);
+
+  if (resolveCollisions(builder) != 0) {
+    releaseTableBuilder(builder);
+    return -1;
+  }
+
+  // Drop the secondary hashes, in place.
+  FilesystemEntry *entries = (FilesystemEntry*) builder->entries;
+  for (uint32_t i = 0; i < builder->numEntries; ++i)
+    memmove(&entries[i], &builder->entries[i].entry, sizeof(FilesystemEntry));
+
+  if (packHeaderTable(builder->headerTable, entries, 
+    builder->numEntries) != 0) {
+
+    releaseTableBuilder(builder);
+    return -1;
+  }
+
+  // Entries, collisions and the packed table are all held at this point.
+  FilesystemHeaderTable *headerTable = builder->headerTable;
+  const uint32_t packBytes = builder->capacity * sizeof(TableBuilderEntry) +
+    headerTable->numCollisions * sizeof(FilesystemCollision) +
+    headerTable->numEntries * (sizeof(uint32_t) + sizeof(FilesystemExtent));
+
+  headerTable->peakBuildBytes = (packBytes > builder->peakBytes) ? 
+    packBytes : builder->peakBytes;
+
+  free(builder->entries);
+  builder->entries = nullptr;
+
+  return 0;
+}
+
 /**
  * Fill a filesystem entry and then jump to the next entry. In case of a
  * child, the parent hash will be passed to generate the child hash.
  */
 void fillHeaderTableEntry(DirectoryRecord *record, uint32_t parentHash, 
-  uint32_t parentPrime, FilesystemEntry **entry, 
-  FilesystemHeaderTable *headerTable, bool continueReading = false) {
+  uint32_t parentPrime, uint32_t parentSecondaryHash, TableBuilder *builder,
+  bool continueReading = false, bool visitChildren = true) {
 
   assert(record != nullptr);
-  assert(headerTable != nullptr);
+  assert(builder != nullptr);
 
   // Skip empty entries.
   if (record->length == 0)
@@ -189,6 +643,11 @@ void fillHeaderTableEntry(DirectoryRecord *record, uint32_t parentHash,
     uint32_t hash = generateHash(dir->identifierPtr(), identifierSize,
       parentHash, parentPrime, HASH_PRIME, &lastPrime);
 
+    // Secondary hashes are only kept for colliding files, but computing
+    // them now spares walking the disc again to find those.
+    uint32_t secondaryHash = generateSecondaryHash(dir->identifierPtr(), 
+      identifierSize, parentSecondaryHash);
+
 #ifdef DEBUG_CDBLOCK
     char identifierName[256];
     memcpy(identifierName, dir->identifierPtr(), identifierSize);
@@ -201,10 +660,14 @@ void fillHeaderTableEntry(DirectoryRecord *record, uint32_t parentHash,
 #endif
 
     if (dir->isDirectory()) {
+      if (!visitChildren) {
+        dir = dir->nextDir();
+        continue;
+      }
+
       // Add '/'
-      hash += HASH_CHAR('/') * lastPrime;
-      hash %= HASH_CUT_NUMBER;
-      lastPrime *= HASH_PRIME;
+      hash = generateHash("/", 1, hash, lastPrime, HASH_PRIME, &lastPrime);
+      secondaryHash = generateSecondaryHash("/", 1, secondaryHash);
 
       // Visit children.
       uint32_t extraLevels = dir->extentLength() / 2048;
@@ -214,23 +677,17 @@ void fillHeaderTableEntry(DirectoryRecord *record, uint32_t parentHash,
       for (uint32_t level = 0; level < extraLevels; ++level) {
         Sector sector;
 
-        const int stat = cd_block_read_data(LBA2FAD(dir->extentLocation()) + 
-          level, 2048, sector.data);
+        const int stat = readSectors(dir->extentLocation() + level, 1,
+          sector.data);
 
         assert(stat == 0);
 
         DirectoryRecord *newRecord = (DirectoryRecord*) sector.data;
-        fillHeaderTableEntry(newRecord, hash, lastPrime, entry, 
-          headerTable, level > 0);
+        fillHeaderTableEntry(newRecord, hash, lastPrime, secondaryHash, 
+          builder, level > 0);
       }
 
     } else {
-
-      // Add file entry.
-      (*entry)->filenameHash = hash;
-      (*entry)->lba = dir->extentLocation();
-      (*entry)->size = dir->extentLength();
-      
       if (dir->extentLength() == 0) {
         char identifierName[256];
         memcpy(identifierName, dir->identifierPtr(), identifierSize);
@@ -244,95 +701,471 @@ void fillHeaderTableEntry(DirectoryRecord *record, uint32_t parentHash,
         assert(false);
       }
 
-      headerTable->numEntries += 1;
-      (*entry) += 1;
+      // Add file entry.
+      appendTableEntry(builder, hash, secondaryHash, dir->extentLocation(),
+        dir->extentLength());
     } 
 
     dir = dir->nextDir();
   }
 }
 
+/**
+ * Directory found in the path table.
+ */
+struct PathTableDirectory {
+  uint32_t lba;
+
+  // Hash of the directory path (with the trailing '/') and the prime to
+  // continue hashing its children.
+  uint32_t hash;
+  uint32_t prime;
+  uint32_t secondaryHash;
+
+  // Directories are visited in disc order.
+  inline bool operator < (const PathTableDirectory& other) const {
+      return lba < other.lba;
+  }
 
-} // namespace ''
-
+  inline bool operator > (const PathTableDirectory& other) const {
+      return lba > other.lba;
+  }
+};
 
-int initialize() {
-  static_assert(sizeof(VolumeDescriptorSet) == 2048, 
-    "VolumeDescriptorSet size mismatch.");
+/**
+ * Hash every directory in the path table. Entries of the path table are
+ * ordered by depth, so the parent of a directory is always hashed first.
+ *
+ * @return Number of directories written to directories.
+ */
+uint32_t hashPathTable(uint8_t *pathTable, uint32_t pathTableSize, 
+  PathTableDirectory *directories, uint32_t maxDirectories) {
 
-  static_assert(sizeof(PrimaryVolumeDescriptor) == 2048, 
-    "PrimaryVolumeDescriptor size mismatch.");
+  uint32_t numDirectories = 0;
+  PathTableRecord *record = (PathTableRecord*) pathTable;
+  uint8_t *pathTableEnd = pathTable + pathTableSize;
 
-  int returnCode;
-  if ((returnCode = cd_block_init(0x0002)) != 0)
-    return returnCode;
+  while ((uint8_t*) record + sizeof(PathTableRecord) <= pathTableEnd && 
+    record->identifierLength != 0 && numDirectories < maxDirectories) {
 
-  if (cd_block_cmd_is_auth(nullptr) == 0) {
-    if ((returnCode = cd_block_bypass_copy_protection()) != 0)
-      return returnCode;
-  }
+    PathTableDirectory *directory = &directories[numDirectories];
+    directory->lba = record->extentLocation;
 
-  return 0;
-}
+    // First record is the root.
+    if (numDirectories == 0) {
+      directory->hash = HASH_SEED;
+      directory->prime = HASH_PRIME;
+      directory->secondaryHash = HASH_SECONDARY_SEED;
 
-int readFilesystem(FilesystemData *fsData) {
-  assert(fsData != nullptr);
+    } else {
+      assert(record->parentDirectory >= 1);
+      assert(record->parentDirectory <= numDirectories);
 
-  // Skip the first 16 sectors dedicated to IP.BIN
-  uint8_t startFAD = LBA2FAD(16);
-  CdBlock::VolumeDescriptorSet tempSet;
+      const PathTableDirectory *parent = 
+        &directories[record->parentDirectory - 1];
 
-  // Find Primary Volume Descriptor.
-  int cdBlockRet = 0;
-  do {
-    cdBlockRet = cd_block_read_data(startFAD, 2048, (uint8_t*) &tempSet);
+      uint32_t lastPrime = 0;
+      uint32_t hash = generateHash(record->identifierPtr(), 
+        record->identifierLength, parent->hash, parent->prime, HASH_PRIME, 
+        &lastPrime);
 
-    if (cdBlockRet != 0)
-      return cdBlockRet;
-    else if (tempSet.type != CdBlock::VD_PRIMARY)
-      startFAD++;
+      const uint32_t secondaryHash = generateSecondaryHash(
+        record->identifierPtr(), record->identifierLength, 
+        parent->secondaryHash);
 
-  } while (tempSet.type != CdBlock::VD_PRIMARY);
+      // Add '/'
+      hash = generateHash("/", 1, hash, lastPrime, HASH_PRIME, &lastPrime);
 
-  CdBlock::PrimaryVolumeDescriptor *primaryDescriptor = 
-    (CdBlock::PrimaryVolumeDescriptor*) &tempSet;
+      directory->hash = hash;
+      directory->prime = lastPrime;
+      directory->secondaryHash = generateSecondaryHash("/", 1, 
+        secondaryHash);
+    }
 
-  // Jump to root sector and retrieve it.
-  const int stat = cd_block_read_data(
-    LBA2FAD(primaryDescriptor->rootDirectoryRecord.extentLocation()), 
-      2048, (uint8_t*) &fsData->rootSector);
+    numDirectories++;
+    record = record->nextRecord();
+  }
 
-  assert(stat == 0);
-  return 0;
+  return numDirectories;
 }
 
-void navigateFilesystem(FilesystemData *fsData, 
-  RecordFunction recordFunction, void *userData) {
+/**
+ * Count the records of the path table.
+ */
+uint32_t countPathTableRecords(uint8_t *pathTable, uint32_t pathTableSize) {
+  uint32_t numRecords = 0;
+  PathTableRecord *record = (PathTableRecord*) pathTable;
+  uint8_t *pathTableEnd = pathTable + pathTableSize;
 
-  assert(fsData != nullptr);
-  navigateDirectory(fsData->root(), 0, recordFunction, userData);
-}
+  while ((uint8_t*) record + sizeof(PathTableRecord) <= pathTableEnd && 
+    record->identifierLength != 0) {
 
+    numRecords++;
+    record = record->nextRecord();
+  }
 
-void printCdStructure(FilesystemData *fsData) {
-  assert(fsData != nullptr);
-  navigateDirectory(fsData->root(), 0, printDirectoryRecord, nullptr);
+  return numRecords;
 }
 
-uint32_t getHeaderTableSize(FilesystemData *fsData) {
-  assert(fsData != nullptr);
+/**
+ * Read the path table and return every directory sorted by LBA. The user
+ * should free the returned directories.
+ *
+ * @return 0 If successful.
+ */
+int readPathTableDirectories(FilesystemData *fsData, 
+  PathTableDirectory **directories, uint32_t *numDirectories) {
 
-  uint32_t numEntries = 0;
-  navigateDirectory(fsData->root(), 0, 
-    [](DirectoryRecord *dir, int, void *length) {
-      uint32_t *lengthData = (uint32_t*) length;
-      if (!dir->isDirectory())
-        (*lengthData)++;
+  *directories = nullptr;
+  *numDirectories = 0;
 
-    }, &numEntries
-  );
+  if (fsData->pathTableSize == 0)
+    return -1;
 
-  return (numEntries * sizeof(FilesystemEntry));
+  // Read the whole path table at once.
+  const uint32_t pathTableSectors = (fsData->pathTableSize + 2047) / 2048;
+  uint8_t *pathTable = (uint8_t*) malloc(pathTableSectors * 2048);
+  if (pathTable == nullptr)
+    return -1;
+
+  const int ret = readSectors(fsData->pathTableLBA, pathTableSectors, 
+    pathTable);
+
+  if (ret != 0) {
+    free(pathTable);
+    return ret;
+  }
+
+  const uint32_t numRecords = countPathTableRecords(pathTable, 
+    fsData->pathTableSize);
+
+  PathTableDirectory *found = (PathTableDirectory*) malloc(
+    numRecords * sizeof(PathTableDirectory));
+
+  if (numRecords == 0 || found == nullptr) {
+    free(found);
+    free(pathTable);
+    return -1;
+  }
+
+  *numDirectories = hashPathTable(pathTable, fsData->pathTableSize, found,
+    numRecords);
+
+  free(pathTable);
+  introSort(found, *numDirectories);
+
+  *directories = found;
+  return 0;
+}
+
+/**
+ * Called by sweepDirectories for every sector of a directory extent. 
+ * continueReading is false for the first sector, which starts with the 
+ * '.' and '..' records.
+ */
+typedef void (*DirectorySectorFunction)(DirectoryRecord *record, 
+  const PathTableDirectory *directory, bool continueReading, 
+  void *userData);
+
+/**
+ * Read every directory extent in the given (disc) order, one sector at a
+ * time.
+ *
+ * @return 0 If successful.
+ */
+int sweepDirectories(const PathTableDirectory *directories, 
+  uint32_t numDirectories, DirectorySectorFunction sectorFunction, 
+  void *userData) {
+
+  for (uint32_t i = 0; i < numDirectories; ++i) {
+    const PathTableDirectory *directory = &directories[i];
+
+    Sector sector;
+    int ret = readSectors(directory->lba, 1, sector.data);
+    if (ret != 0)
+      return ret;
+
+    // The '.' record holds the extent length of the directory.
+    DirectoryRecord *self = (DirectoryRecord*) sector.data;
+    uint32_t extentSectors = self->extentLength() / 2048;
+    if (self->extentLength() % 2048)
+      extentSectors++;
+
+    sectorFunction(self, directory, false, userData);
+
+    for (uint32_t level = 1; level < extentSectors; ++level) {
+      ret = readSectors(directory->lba + level, 1, sector.data);
+      if (ret != 0)
+        return ret;
+
+      sectorFunction((DirectoryRecord*) sector.data, directory, true, 
+        userData);
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Destination of the children found while sweeping the directories.
+ */
+struct DirectoryIndexBuilder {
+  DirectoryIndex *directoryIndex;
+  uint32_t childrenCapacity;
+  uint32_t namesCapacity;
+
+  // Set if growing the index failed or a child can't be packed.
+  bool failed;
+};
+
+/**
+ * Make room for one more child and its name, doubling the arrays when
+ * full.
+ *
+ * @return false If out of memory.
+ */
+bool reserveDirectoryChild(DirectoryIndexBuilder *builder, 
+  uint32_t nameLength) {
+
+  DirectoryIndex *directoryIndex = builder->directoryIndex;
+
+  if (directoryIndex->numChildren == builder->childrenCapacity) {
+    const uint32_t newCapacity = builder->childrenCapacity * 2;
+    DirectoryIndexChild *newChildren = (DirectoryIndexChild*) realloc(
+      directoryIndex->children, newCapacity * sizeof(DirectoryIndexChild));
+
+    if (newChildren == nullptr)
+      return false;
+
+    directoryIndex->children = newChildren;
+    builder->childrenCapacity = newCapacity;
+  }
+
+  while (directoryIndex->namesSize + nameLength + 1 > 
+    builder->namesCapacity) {
+
+    const uint32_t newCapacity = builder->namesCapacity * 2;
+    char *newNames = (char*) realloc(directoryIndex->names, newCapacity);
+    if (newNames == nullptr)
+      return false;
+
+    directoryIndex->names = newNames;
+    builder->namesCapacity = newCapacity;
+  }
+
+  return true;
+}
+
+/**
+ * Add every record of a directory sector to the directory index. Used as
+ * a DirectorySectorFunction.
+ */
+void appendDirectoryChildren(DirectoryRecord *record, 
+  const PathTableDirectory *directory, bool continueReading, 
+  void *userData) {
+
+  DirectoryIndexBuilder *builder = (DirectoryIndexBuilder*) userData;
+  DirectoryIndex *directoryIndex = builder->directoryIndex;
+
+  if (builder->failed)
+    return;
+
+  DirectoryRecord *dir = record;
+  if (!continueReading) {
+    DirectoryIndexNode *node = 
+      &directoryIndex->directories[directoryIndex->numDirectories++];
+
+    node->pathHash = directory->hash;
+    node->firstChild = directoryIndex->numChildren;
+    node->numChildren = 0;
+
+    // Skip '.' and '..'
+    dir = dir->nextDir();
+    dir = dir->nextDir();
+  }
+
+  DirectoryIndexNode *node = 
+    &directoryIndex->directories[directoryIndex->numDirectories - 1];
+
+  while (dir->length != 0) {
+
+    // -2 takes into account ';1'
+    uint32_t identifierSize = dir->identifierLength;
+    if (dir->isDirectory() == 0 && identifierSize > 2)
+      identifierSize -= 2;
+
+    if (!reserveDirectoryChild(builder, identifierSize)) {
+      builder->failed = true;
+      return;
+    }
+
+    DirectoryIndexChild *child = 
+      &directoryIndex->children[directoryIndex->numChildren];
+
+    if (!packExtent(dir->extentLocation(), dir->extentLength(), 
+      &child->extent)) {
+
+      builder->failed = true;
+      return;
+    }
+
+    char *name = directoryIndex->names + directoryIndex->namesSize;
+    memcpy(name, dir->identifierPtr(), identifierSize);
+    name[identifierSize] = 0;
+
+    child->nameOffset = directoryIndex->namesSize;
+    child->nameLength = identifierSize;
+    child->flags = dir->flags;
+
+    directoryIndex->namesSize += identifierSize + 1;
+    directoryIndex->numChildren += 1;
+    node->numChildren += 1;
+
+    dir = dir->nextDir();
+  }
+}
+
+/**
+ * Look for a file directly under the root directory.
+ *
+ * @return 0 If the file was found, entry will hold its location.
+ */
+int findRootFile(FilesystemData *fsData, const char *filename, 
+  FilesystemEntry *entry) {
+
+  const uint32_t filenameLength = strlen(filename);
+  const DirectoryRecord *root = fsData->root();
+
+  uint32_t extentSectors = root->extentLength() / 2048;
+  if (root->extentLength() % 2048)
+    extentSectors++;
+
+  Sector sector;
+  for (uint32_t level = 0; level < extentSectors; ++level) {
+    DirectoryRecord *dir = (DirectoryRecord*) sector.data;
+
+    if (level == 0) {
+      // Skip '.' and '..'
+      dir = fsData->root()->nextDir();
+      dir = dir->nextDir();
+
+    } else if (readSectors(root->extentLocation() + level, 1, 
+      sector.data) != 0) {
+
+      return -1;
+    }
+
+    while (dir->length != 0) {
+
+      // -2 takes into account ';1'
+      uint32_t identifierSize = dir->identifierLength;
+      if (dir->isDirectory() == 0 && identifierSize > 2)
+        identifierSize -= 2;
+
+      if (!dir->isDirectory() && identifierSize == filenameLength &&
+        memcmp(dir->identifierPtr(), filename, filenameLength) == 0) {
+
+        entry->filenameHash = getFilenameHash(filename, filenameLength);
+        entry->lba = dir->extentLocation();
+        entry->size = dir->extentLength();
+        return 0;
+      }
+
+      dir = dir->nextDir();
+    }
+  }
+
+  return -1;
+}
+
+
+} // namespace ''
+
+
+int initialize() {
+  static_assert(sizeof(VolumeDescriptorSet) == 2048, 
+    "VolumeDescriptorSet size mismatch.");
+
+  static_assert(sizeof(PrimaryVolumeDescriptor) == 2048, 
+    "PrimaryVolumeDescriptor size mismatch.");
+
+  int returnCode;
+  if ((returnCode = cd_block_init(0x0002)) != 0)
+    return returnCode;
+
+  if (cd_block_cmd_is_auth(nullptr) == 0) {
+    if ((returnCode = cd_block_bypass_copy_protection()) != 0)
+      return returnCode;
+  }
+
+  return 0;
+}
+
+int readFilesystem(FilesystemData *fsData) {
+  assert(fsData != nullptr);
+
+  // Skip the first 16 sectors dedicated to IP.BIN
+  uint32_t startLBA = 16;
+  CdBlock::VolumeDescriptorSet tempSet;
+
+  // Find Primary Volume Descriptor.
+  int cdBlockRet = 0;
+  do {
+    cdBlockRet = readSectors(startLBA, 1, &tempSet);
+
+    if (cdBlockRet != 0)
+      return cdBlockRet;
+    else if (tempSet.type != CdBlock::VD_PRIMARY)
+      startLBA++;
+
+  } while (tempSet.type != CdBlock::VD_PRIMARY);
+
+  CdBlock::PrimaryVolumeDescriptor *primaryDescriptor = 
+    (CdBlock::PrimaryVolumeDescriptor*) &tempSet;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  fsData->pathTableLBA = primaryDescriptor->locationPathTableLittle;
+#else
+  fsData->pathTableLBA = primaryDescriptor->locationPathTableBig;
+#endif
+  fsData->pathTableSize = primaryDescriptor->pathTableSize();
+
+  // Jump to root sector and retrieve it.
+  const int stat = readSectors(
+    primaryDescriptor->rootDirectoryRecord.extentLocation(), 1, 
+      &fsData->rootSector);
+
+  assert(stat == 0);
+  return 0;
+}
+
+void navigateFilesystem(FilesystemData *fsData, 
+  RecordFunction recordFunction, void *userData) {
+
+  assert(fsData != nullptr);
+  navigateDirectory(fsData->root(), 0, recordFunction, userData);
+}
+
+
+void printCdStructure(FilesystemData *fsData) {
+  assert(fsData != nullptr);
+  navigateDirectory(fsData->root(), 0, printDirectoryRecord, nullptr);
+}
+
+uint32_t getHeaderTableSize(FilesystemData *fsData) {
+  assert(fsData != nullptr);
+
+  uint32_t numEntries = 0;
+  navigateDirectory(fsData->root(), 0, 
+    [](DirectoryRecord *dir, int, void *length) {
+      uint32_t *lengthData = (uint32_t*) length;
+      if (!dir->isDirectory())
+        (*lengthData)++;
+
+    }, &numEntries
+  );
+
+  return numEntries * (sizeof(uint32_t) + sizeof(FilesystemExtent));
 }
 
 void fillHeaderTable(FilesystemData *fsData, 
@@ -340,57 +1173,795 @@ void fillHeaderTable(FilesystemData *fsData,
 
   assert(fsData != nullptr);
   assert(headerTable != nullptr);
-  assert(headerTable->entries != nullptr);
+  assert(headerTable->hashes != nullptr);
+
+  headerTable->numEntries = 0;
+  headerTable->numCollisions = 0;
+  headerTable->collisions = nullptr;
+  headerTable->lookupHashes = nullptr;
+  headerTable->lookupIndices = nullptr;
+  headerTable->knowsPackedFiles = false;
+  headerTable->numPackedFiles = 0;
+  headerTable->packedHashes = nullptr;
+  headerTable->peakBuildBytes = 0;
+
+  TableBuilder builder;
+  int stat = beginTableBuilder(&builder, headerTable);
+  assert(stat == 0);
+
+  fillHeaderTableEntry(fsData->root(), HASH_SEED, HASH_PRIME, 
+    HASH_SECONDARY_SEED, &builder);
+
+  stat = finishTableBuilder(&builder);
+  assert(stat == 0);
+}
+
+int buildHeaderTable(FilesystemData *fsData, 
+  FilesystemHeaderTable *headerTable) {
+
+  assert(fsData != nullptr);
+  assert(headerTable != nullptr);
+
+  headerTable->numEntries = 0;
+  headerTable->numCollisions = 0;
+  headerTable->collisions = nullptr;
+  headerTable->lookupHashes = nullptr;
+  headerTable->lookupIndices = nullptr;
+  headerTable->knowsPackedFiles = false;
+  headerTable->numPackedFiles = 0;
+  headerTable->packedHashes = nullptr;
+  headerTable->peakBuildBytes = 0;
+  headerTable->hashes = nullptr;
+  headerTable->extents = nullptr;
+
+  TableBuilder builder;
+  if (beginTableBuilder(&builder, headerTable) != 0)
+    return -1;
+
+  fillHeaderTableEntry(fsData->root(), HASH_SEED, HASH_PRIME, 
+    HASH_SECONDARY_SEED, &builder);
+  return finishTableBuilder(&builder);
+}
+
+int buildHeaderTableFromPathTable(FilesystemData *fsData, 
+  FilesystemHeaderTable *headerTable) {
+
+  assert(fsData != nullptr);
+  assert(headerTable != nullptr);
 
   headerTable->numEntries = 0;
+  headerTable->numCollisions = 0;
+  headerTable->collisions = nullptr;
+  headerTable->lookupHashes = nullptr;
+  headerTable->lookupIndices = nullptr;
+  headerTable->knowsPackedFiles = false;
+  headerTable->numPackedFiles = 0;
+  headerTable->packedHashes = nullptr;
+  headerTable->peakBuildBytes = 0;
+  headerTable->hashes = nullptr;
+  headerTable->extents = nullptr;
+
+  PathTableDirectory *directories = nullptr;
+  uint32_t numDirectories = 0;
+
+  int ret = readPathTableDirectories(fsData, &directories, &numDirectories);
+  if (ret != 0)
+    return ret;
+
+  TableBuilder builder;
+  if (beginTableBuilder(&builder, headerTable) != 0) {
+    free(directories);
+    return -1;
+  }
 
-  FilesystemEntry *iterEntry = headerTable->entries;
-  fillHeaderTableEntry(fsData->root(), 0, HASH_PRIME, 
-    &iterEntry, headerTable);
+  // Sweep every directory extent in disc order, adding only files since
+  // sub-directories come from the path table.
+  ret = sweepDirectories(directories, numDirectories, 
+    [](DirectoryRecord *record, const PathTableDirectory *directory, 
+      bool continueReading, void *builder) {
 
-  quickSort(headerTable->entries, 0, headerTable->numEntries - 1);
+      fillHeaderTableEntry(record, directory->hash, directory->prime, 
+        directory->secondaryHash, (TableBuilder*) builder, continueReading,
+        false);
+
+    }, &builder
+  );
+
+  free(directories);
+
+  if (ret != 0)
+    builder.outOfMemory = true;
+
+  const int finishRet = finishTableBuilder(&builder);
+  return (ret != 0) ? ret : finishRet;
 }
 
-void getFileEntry(FilesystemHeaderTable *headerTable, 
-  uint32_t filenameHash, FilesystemEntry **resultingEntry) {
+int loadHeaderTableIndex(FilesystemData *fsData, const char *filename,
+  FilesystemHeaderTable *headerTable) {
+
+  assert(fsData != nullptr);
+  assert(filename != nullptr);
+  assert(headerTable != nullptr);
+
+  headerTable->numEntries = 0;
+  headerTable->numCollisions = 0;
+  headerTable->collisions = nullptr;
+  headerTable->lookupHashes = nullptr;
+  headerTable->lookupIndices = nullptr;
+  headerTable->knowsPackedFiles = false;
+  headerTable->numPackedFiles = 0;
+  headerTable->packedHashes = nullptr;
+  headerTable->peakBuildBytes = 0;
+  headerTable->hashes = nullptr;
+  headerTable->extents = nullptr;
+
+  FilesystemEntry indexEntry;
+  if (findRootFile(fsData, filename, &indexEntry) != 0)
+    return -1;
+
+  if (indexEntry.size < sizeof(FileIndexHeader))
+    return -1;
+
+  uint8_t *indexData = (uint8_t*) malloc(indexEntry.size);
+  if (indexData == nullptr)
+    return -1;
+
+  if (getFileContents(&indexEntry, indexData) != 0) {
+    free(indexData);
+    return -1;
+  }
+
+  // Every field is big endian, whatever the CPU reading the index.
+  FileIndexHeader header;
+  header.magic = readFileIndexWord(indexData);
+  header.version = readFileIndexWord(indexData + 4);
+  header.hashVersion = readFileIndexWord(indexData + 8);
+  header.numEntries = readFileIndexWord(indexData + 12);
+  header.checksum = readFileIndexWord(indexData + 16);
+
+  const uint32_t entriesSize = header.numEntries * sizeof(FilesystemEntry);
+
+  bool valid = header.magic == FILE_INDEX_MAGIC && 
+    header.version == FILE_INDEX_VERSION &&
+    header.hashVersion == HASH_VERSION &&
+    header.numEntries > 0 &&
+    header.numEntries <= indexEntry.size / sizeof(FilesystemEntry) &&
+    sizeof(FileIndexHeader) + entriesSize <= indexEntry.size;
+
+  FilesystemEntry *entries = (FilesystemEntry*) 
+    (indexData + sizeof(FileIndexHeader));
+
+  if (valid) {
+    const crc32_t checksum = crc32_finalize(crc32_update(crc32_init(), 
+      (const unsigned char*) entries, entriesSize));
+
+    valid = (header.checksum == checksum);
+  }
+
+  // The checksum covers the records as stored, decode them in place.
+  for (uint32_t i = 0; valid && i < header.numEntries; ++i) {
+    const uint8_t *record = (const uint8_t*) &entries[i];
+    const uint32_t filenameHash = readFileIndexWord(record);
+    const uint32_t lba = readFileIndexWord(record + 4);
+    const uint32_t size = readFileIndexWord(record + 8);
+
+    entries[i].filenameHash = filenameHash;
+    entries[i].lba = lba;
+    entries[i].size = size;
+  }
+
+  // Lookups rely on the ordering, never trust it blindly.
+  for (uint32_t i = 1; valid && i < header.numEntries; ++i)
+    valid = entries[i - 1] < entries[i];
+
+  if (!valid) {
+    free(indexData);
+    return -1;
+  }
+
+  // Move the packed flags out of the sizes, hashes stay sorted.
+  uint32_t numPackedFiles = 0;
+  for (uint32_t i = 0; i < header.numEntries; ++i) {
+    if (entries[i].size & FILE_INDEX_PACKED)
+      numPackedFiles++;
+  }
+
+  uint32_t *packedHashes = nullptr;
+  if (numPackedFiles > 0) {
+    packedHashes = (uint32_t*) malloc(numPackedFiles * sizeof(uint32_t));
+    if (packedHashes == nullptr) {
+      free(indexData);
+      return -1;
+    }
+  }
+
+  numPackedFiles = 0;
+  for (uint32_t i = 0; i < header.numEntries; ++i) {
+    if (entries[i].size & FILE_INDEX_PACKED) {
+      entries[i].size &= ~FILE_INDEX_PACKED;
+      packedHashes[numPackedFiles++] = entries[i].filenameHash;
+    }
+  }
+
+  const int ret = packHeaderTable(headerTable, entries, header.numEntries);
+  free(indexData);
+
+  if (ret != 0) {
+    free(packedHashes);
+    return ret;
+  }
+
+  headerTable->peakBuildBytes = indexEntry.size + 
+    numPackedFiles * sizeof(uint32_t) + 
+    headerTable->numEntries * (sizeof(uint32_t) + sizeof(FilesystemExtent));
+
+  headerTable->knowsPackedFiles = true;
+  headerTable->numPackedFiles = numPackedFiles;
+  headerTable->packedHashes = packedHashes;
+
+  return 0;
+}
+
+int buildDirectoryIndex(FilesystemData *fsData, 
+  DirectoryIndex *directoryIndex) {
+
+  assert(fsData != nullptr);
+  assert(directoryIndex != nullptr);
+
+  *directoryIndex = { 0, nullptr, 0, nullptr, 0, nullptr };
+
+  PathTableDirectory *directories = nullptr;
+  uint32_t numDirectories = 0;
+
+  int ret = readPathTableDirectories(fsData, &directories, &numDirectories);
+  if (ret != 0)
+    return ret;
+
+  DirectoryIndexBuilder builder = { directoryIndex, 
+    CDBLOCK_INITIAL_DIRECTORY_CHILDREN, CDBLOCK_INITIAL_DIRECTORY_NAMES, 
+    false };
+
+  directoryIndex->directories = (DirectoryIndexNode*) malloc(
+    numDirectories * sizeof(DirectoryIndexNode));
+
+  directoryIndex->children = (DirectoryIndexChild*) malloc(
+    CDBLOCK_INITIAL_DIRECTORY_CHILDREN * sizeof(DirectoryIndexChild));
+
+  directoryIndex->names = (char*) malloc(CDBLOCK_INITIAL_DIRECTORY_NAMES);
+
+  if (directoryIndex->directories == nullptr || 
+    directoryIndex->children == nullptr || directoryIndex->names == nullptr) {
+
+    builder.failed = true;
+  }
+
+  if (!builder.failed) {
+    ret = sweepDirectories(directories, numDirectories, 
+      appendDirectoryChildren, &builder);
+  }
+
+  free(directories);
+
+  if (ret != 0 || builder.failed) {
+    freeDirectoryIndex(directoryIndex);
+    return -1;
+  }
+
+  introSort(directoryIndex->directories, directoryIndex->numDirectories);
+  return 0;
+}
+
+void freeDirectoryIndex(DirectoryIndex *directoryIndex) {
+  assert(directoryIndex != nullptr);
+
+  free(directoryIndex->directories);
+  free(directoryIndex->children);
+  free(directoryIndex->names);
+
+  *directoryIndex = { 0, nullptr, 0, nullptr, 0, nullptr };
+}
+
+int openDirectory(DirectoryIndex *directoryIndex, uint32_t pathHash,
+  DirectoryHandle *directory) {
+
+  assert(directoryIndex != nullptr);
+  assert(directory != nullptr);
+
+  DirectoryIndexNode *node = nullptr;
+  binarySearch(directoryIndex->directories, directoryIndex->numDirectories,
+    { pathHash, 0, 0 }, &node);
+
+  if (node == nullptr)
+    return -1;
+
+  directory->nextChild = node->firstChild;
+  directory->endChild = node->firstChild + node->numChildren;
+  return 0;
+}
+
+bool readDirectory(DirectoryIndex *directoryIndex, 
+  DirectoryHandle *directory, DirectoryEntry *entry) {
+
+  assert(directoryIndex != nullptr);
+  assert(directory != nullptr);
+  assert(entry != nullptr);
+
+  if (directory->nextChild >= directory->endChild)
+    return false;
+
+  const DirectoryIndexChild *child = 
+    &directoryIndex->children[directory->nextChild++];
+
+  entry->name = directoryIndex->names + child->nameOffset;
+  entry->nameLength = child->nameLength;
+  entry->isDirectory = (child->flags & FLAG_CDBLOCK_DIRECTORY) != 0;
+  entry->lba = child->extent.lba();
+  entry->size = child->extent.size();
+
+  return true;
+}
+
+int buildHeaderTableLookup(FilesystemHeaderTable *headerTable, 
+  HeaderTableLookup lookup) {
+
+  assert(headerTable != nullptr);
+
+  free(headerTable->lookupHashes);
+  headerTable->lookupHashes = nullptr;
+  headerTable->lookupIndices = nullptr;
+
+  if (lookup == HeaderTableLookup::BINARY_SEARCH)
+    return 0;
+
+  const uint32_t length = headerTable->numEntries + 1;
+  uint32_t *lookupData = (uint32_t*) malloc(2 * length * sizeof(uint32_t));
+  if (lookupData == nullptr)
+    return -1;
+
+  headerTable->lookupHashes = lookupData;
+  headerTable->lookupIndices = lookupData + length;
+  fillEytzinger(headerTable->hashes, headerTable->numEntries,
+    headerTable->lookupHashes, headerTable->lookupIndices);
+
+  return 0;
+}
+
+void printHeaderTableMemory(FilesystemHeaderTable *headerTable) {
+  assert(headerTable != nullptr);
+
+  const uint32_t packedEntrySize = sizeof(uint32_t) + 
+    sizeof(FilesystemExtent);
+
+  const uint32_t numEntries = headerTable->numEntries;
+  const uint32_t packedSize = numEntries * packedEntrySize;
+
+  uint32_t lookupSize = 0;
+  if (headerTable->lookupHashes != nullptr)
+    lookupSize = (numEntries + 1) * 2 * sizeof(uint32_t);
+
+  const uint32_t collisionsSize = headerTable->numCollisions * 
+    sizeof(FilesystemCollision);
+
+  // Growing the builder entries holds the old and the doubled arrays, 
+  // up to 3 entries per file once the disc outgrows the first ones. Only
+  // the entries are held per file, the fixed costs don't scale.
+  const uint32_t peakPerThousand = 1000 * 3 * sizeof(TableBuilderEntry);
+
+  char tmpBuffer[320];
+  sprintf(tmpBuffer, "Header table: %lu files, %lu bytes (%lu lookup, "
+    "%lu collisions), %lu at peak while building\nPer 1000 files: %lu "
+    "bytes packed, %lu unpacked, up to %lu at peak\n", numEntries, 
+    packedSize + lookupSize + collisionsSize, lookupSize, collisionsSize, 
+    headerTable->peakBuildBytes, 1000 * packedEntrySize, 
+    (uint32_t) (1000 * sizeof(FilesystemEntry)), peakPerThousand);
+
+  dbgio_buffer(tmpBuffer);
+  dbgio_flush();
+}
+
+bool isPackedFile(FilesystemHeaderTable *headerTable, 
+  uint32_t filenameHash) {
+
+  assert(headerTable != nullptr);
+
+  uint32_t *found = nullptr;
+  binarySearch(headerTable->packedHashes, headerTable->numPackedFiles, 
+    filenameHash, &found);
+
+  return found != nullptr;
+}
+
+bool isCollidingHash(FilesystemHeaderTable *headerTable, 
+  uint32_t filenameHash) {
+
+  assert(headerTable != nullptr);
+
+  // Collisions are rare, a linear scan is enough.
+  for (uint32_t i = 0; i < headerTable->numCollisions; ++i) {
+    if (headerTable->collisions[i].entry.filenameHash == filenameHash)
+      return true;
+  }
+
+  return false;
+}
+
+bool getFileEntry(FilesystemHeaderTable *headerTable, FilePath path, 
+  FilesystemEntry *resultingEntry) {
+
+  assert(headerTable != nullptr);
+  assert(resultingEntry != nullptr);
+
+  if (!isCollidingHash(headerTable, path.hash))
+    return getFileEntry(headerTable, path.hash, resultingEntry);
+
+  for (uint32_t i = 0; i < headerTable->numCollisions; ++i) {
+    FilesystemCollision *collision = &headerTable->collisions[i];
+    if (collision->entry.filenameHash == path.hash && 
+      collision->secondaryHash == path.secondaryHash) {
+
+      *resultingEntry = collision->entry;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool getFileEntry(FilesystemHeaderTable *headerTable, 
+  uint32_t filenameHash, FilesystemEntry *resultingEntry) {
 
   assert(headerTable != nullptr);
   assert(resultingEntry != nullptr);
 
-  binarySearch(headerTable->entries, headerTable->numEntries, 
-    { filenameHash, 0, 0 }, resultingEntry);
+  const uint32_t numEntries = headerTable->numEntries;
+  uint32_t index;
+
+  if (headerTable->lookupHashes != nullptr) {
+    index = eytzingerLowerBound(headerTable->lookupHashes, 
+      headerTable->lookupIndices, numEntries, filenameHash);
+  } else {
+    index = lowerBound(headerTable->hashes, numEntries, filenameHash) - 
+      headerTable->hashes;
+  }
+
+  if (index == numEntries || headerTable->hashes[index] != filenameHash)
+    return false;
+
+  const FilesystemExtent *extent = &headerTable->extents[index];
+  resultingEntry->filenameHash = filenameHash;
+  resultingEntry->lba = extent->lba();
+  resultingEntry->size = extent->size();
+
+  return true;
 }
 
 int getFileContents(FilesystemEntry *entry, void *buffer) {
+  FileReadRequest request;
+  beginFileContents(entry, buffer, &request);
+
+  return continueFileContents(&request, entry->size);
+}
+
+void beginFileContents(FilesystemEntry *entry, void *buffer,
+  FileReadRequest *request) {
+
   assert(entry != nullptr);
   assert(buffer != nullptr);
+  assert(request != nullptr);
+
+  request->lba = entry->lba;
+  request->missingBytes = entry->size;
+  request->buffer = (uint8_t*) buffer;
+
+  traceFileAccess(entry);
+}
+
+int continueFileContents(FileReadRequest *request, uint32_t maxBytes) {
+  assert(request != nullptr);
+
+  if (request->missingBytes == 0)
+    return 0;
+
+  uint32_t fullSectors = request->missingBytes / 2048;
+  uint32_t budgetSectors = maxBytes / 2048;
+  if ((maxBytes % 2048) || budgetSectors == 0)
+    budgetSectors++;
+
+  // Full sectors land straight in the caller buffer.
+  if (fullSectors > budgetSectors)
+    fullSectors = budgetSectors;
+
+  // Don't read ahead past the end of the file, nor past the budget.
+  uint32_t endSectors = (request->missingBytes + 2047) / 2048;
+  if (endSectors > budgetSectors)
+    endSectors = budgetSectors;
+
+  prefetchWindow.endLBA = request->lba + endSectors;
+
+  int ret = 0;
+  if (fullSectors > 0) {
+    ret = readSectors(request->lba, fullSectors, request->buffer);
+
+    if (ret == 0) {
+      request->lba += fullSectors;
+      request->buffer += fullSectors * 2048;
+      request->missingBytes -= fullSectors * 2048;
+      budgetSectors -= fullSectors;
+    }
+  }
+
+  // Only the trailing partial sector goes through a bounce buffer.
+  const uint32_t tailBytes = request->missingBytes;
+  if (ret == 0 && tailBytes > 0 && tailBytes < 2048 && budgetSectors > 0) {
+    Sector tmpSector;
+    ret = readSectors(request->lba, 1, tmpSector.data);
+
+    if (ret == 0) {
+      memcpy(request->buffer, tmpSector.data, tailBytes);
+      readStatistics.bytesCopied += tailBytes;
+      readStatistics.bytesBounced += tailBytes;
+
+      request->lba += 1;
+      request->buffer += tailBytes;
+      request->missingBytes = 0;
+    }
+  }
+
+  prefetchWindow.endLBA = INVALID_CACHE_LBA;
+  return ret;
+}
+
+int readFileBatch(FileBatchEntry *entries, uint32_t numEntries) {
+  assert(entries != nullptr || numEntries == 0);
+
+  introSort(entries, numEntries);
+
+  for (uint32_t i = 0; i < numEntries; ++i)
+    traceFileAccess(&entries[i].entry);
+
+  // Without a staging buffer every file is read on its own.
+  uint8_t *staging = (uint8_t*) malloc(CDBLOCK_BATCH_STAGING_SECTORS * 
+    sizeof(Sector));
+
+  uint32_t first = 0;
+  int ret = 0;
+
+  while (first < numEntries && ret == 0) {
+    const FilesystemEntry *firstEntry = &entries[first].entry;
+    const uint32_t runLBA = firstEntry->lba;
+    uint32_t runEnd = runLBA + (firstEntry->size + 2047) / 2048;
+
+    // Gather the following files fitting in the staging buffer.
+    uint32_t last = first;
+    while (staging != nullptr && last + 1 < numEntries) {
+      const FilesystemEntry *next = &entries[last + 1].entry;
+      const uint32_t nextEnd = next->lba + (next->size + 2047) / 2048;
+
+      if (next->lba > runEnd + CDBLOCK_BATCH_MAX_GAP_SECTORS || 
+        nextEnd - runLBA > CDBLOCK_BATCH_STAGING_SECTORS) {
+
+        break;
+      }
+
+      if (nextEnd > runEnd)
+        runEnd = nextEnd;
+
+      last++;
+    }
+
+    if (last == first) {
+      FileReadRequest request;
+      request.lba = firstEntry->lba;
+      request.missingBytes = firstEntry->size;
+      request.buffer = (uint8_t*) entries[first].buffer;
+
+      ret = continueFileContents(&request, firstEntry->size);
+      first++;
+      continue;
+    }
+
+    ret = readSectors(runLBA, runEnd - runLBA, staging);
+
+    for (; first <= last && ret == 0; ++first) {
+      const FilesystemEntry *entry = &entries[first].entry;
+      memcpy(entries[first].buffer, 
+        staging + (entry->lba - runLBA) * 2048, entry->size);
+
+      readStatistics.bytesCopied += entry->size;
+      readStatistics.bytesBounced += entry->size;
+    }
+  }
+
+  free(staging);
+  return ret;
+}
+
+int readSectors(uint32_t lba, uint32_t numSectors, void *buffer) {
+  assert(buffer != nullptr);
 
-  uint8_t tmpBuffer[2048];
   uint8_t *dstBuffer = (uint8_t*) buffer;
+  if (sectorCache.numSlots == 0)
+    return readPrefetchedSectors(lba, numSectors, dstBuffer);
+
+  const bool insertMisses = (numSectors <= sectorCache.numSlots / 2);
+  while (numSectors > 0) {
+    const Sector *cached = findCachedSector(lba);
+    if (cached != nullptr) {
+      memcpy(dstBuffer, cached->data, 2048);
+      readStatistics.bytesCopied += 2048;
+      readStatistics.cacheHits += 1;
 
-  uint32_t missingBytes = entry->size;
-  uint32_t readingLBA = entry->lba;
+      dstBuffer += 2048;
+      numSectors -= 1;
+      lba += 1;
+      continue;
+    }
 
-  while (missingBytes > 0) {
-    int ret = cd_block_read_data(LBA2FAD(readingLBA), 2048, tmpBuffer);
+    // Read the whole run of missing sectors at once.
+    uint32_t missingSectors = 1;
+    while (missingSectors < numSectors && 
+      findCachedSector(lba + missingSectors) == nullptr) {
+
+      missingSectors++;
+    }
+
+    const int ret = readPrefetchedSectors(lba, missingSectors, dstBuffer);
     if (ret != 0)
       return ret;
 
-    if (missingBytes > 2048) {
-      memcpy(dstBuffer, tmpBuffer, 2048);
-      dstBuffer += 2048;
-      missingBytes -= 2048;
+    readStatistics.cacheMisses += missingSectors;
+    for (uint32_t i = 0; i < missingSectors; ++i) {
+      if (insertMisses)
+        insertCachedSector(lba, dstBuffer);
 
-      // Jump to next LBA.
-      readingLBA++;
-    } else {
-      memcpy(dstBuffer, tmpBuffer, missingBytes);
-      missingBytes = 0;
+      dstBuffer += 2048;
+      numSectors -= 1;
+      lba += 1;
     }
   }
 
   return 0;
 }
 
+int readFileSectors(uint32_t lba, uint32_t numSectors, uint32_t endLBA,
+  void *buffer) {
+
+  assert(lba + numSectors <= endLBA);
+
+  const uint32_t previousEndLBA = prefetchWindow.endLBA;
+  prefetchWindow.endLBA = endLBA;
+
+  const int ret = readSectors(lba, numSectors, buffer);
+
+  prefetchWindow.endLBA = previousEndLBA;
+  return ret;
+}
+
+int initializeSectorCache(uint32_t numSectors) {
+  if (sectorCache.slots != nullptr)
+    free(sectorCache.slots);
+
+  if (sectorCache.sectors != nullptr)
+    free(sectorCache.sectors);
+
+  memset(&sectorCache, 0, sizeof(SectorCache));
+  if (numSectors == 0)
+    return 0;
+
+  sectorCache.slots = (SectorCacheSlot*) malloc(numSectors * 
+    sizeof(SectorCacheSlot));
+
+  sectorCache.sectors = (Sector*) malloc(numSectors * sizeof(Sector));
+  if (sectorCache.slots == nullptr || sectorCache.sectors == nullptr) {
+    initializeSectorCache(0);
+    return -1;
+  }
+
+  sectorCache.numSlots = numSectors;
+  invalidateSectorCache();
+
+  return 0;
+}
+
+void invalidateSectorCache() {
+  for (uint32_t i = 0; i < sectorCache.numSlots; ++i) {
+    sectorCache.slots[i].lba = INVALID_CACHE_LBA;
+    sectorCache.slots[i].lastUse = 0;
+  }
+
+  sectorCache.useCounter = 0;
+
+  dropPrefetchWindow();
+  prefetchWindow.streamLBA = INVALID_CACHE_LBA;
+}
+
+int initializePrefetchWindow(uint32_t numSectors) {
+  if (prefetchWindow.sectors != nullptr)
+    free(prefetchWindow.sectors);
+
+  memset(&prefetchWindow, 0, sizeof(PrefetchWindow));
+  prefetchWindow.streamLBA = INVALID_CACHE_LBA;
+  prefetchWindow.endLBA = INVALID_CACHE_LBA;
+  if (numSectors == 0)
+    return 0;
+
+  prefetchWindow.sectors = (Sector*) malloc(numSectors * sizeof(Sector));
+  if (prefetchWindow.sectors == nullptr)
+    return -1;
+
+  prefetchWindow.capacity = numSectors;
+  return 0;
+}
+
+void getReadStatistics(ReadStatistics *stats) {
+  assert(stats != nullptr);
+  *stats = readStatistics;
+}
+
+void resetReadStatistics() {
+  memset(&readStatistics, 0, sizeof(ReadStatistics));
+}
+
+void startAccessTrace(FileAccessRecord *records, uint32_t numRecords,
+  AccessTraceClock clock) {
+
+  assert(records != nullptr);
+  assert(numRecords > 0);
+
+  accessTrace.records = records;
+  accessTrace.numRecords = numRecords;
+  accessTrace.clock = clock;
+  accessTrace.numAccesses = 0;
+  accessTrace.running = true;
+}
+
+void stopAccessTrace() {
+  accessTrace.running = false;
+}
+
+void traceFileAccess(const FilesystemEntry *entry) {
+  assert(entry != nullptr);
+
+  if (!accessTrace.running)
+    return;
+
+  FileAccessRecord *record = &accessTrace.records[
+    accessTrace.numAccesses % accessTrace.numRecords];
+
+  record->filenameHash = entry->filenameHash;
+  record->lba = entry->lba;
+  record->size = entry->size;
+  record->time = (accessTrace.clock != nullptr) ? 
+    accessTrace.clock() : accessTrace.numAccesses;
+
+  accessTrace.numAccesses += 1;
+}
+
+void printAccessTrace() {
+  uint32_t first = 0;
+  uint32_t numRecords = accessTrace.numAccesses;
+  if (numRecords > accessTrace.numRecords) {
+    first = numRecords % accessTrace.numRecords;
+    numRecords = accessTrace.numRecords;
+  }
+
+  for (uint32_t i = 0; i < numRecords; ++i) {
+    const FileAccessRecord *record = 
+      &accessTrace.records[(first + i) % accessTrace.numRecords];
+
+    char tmpBuffer[64];
+    sprintf(tmpBuffer, "TRACE %08lx %lu %lu %lu\n", record->filenameHash, 
+      record->lba, record->size, record->time);
+
+    dbgio_buffer(tmpBuffer);
+
+    // Keep the dbgio buffer small.
+    if ((i % 16) == 15)
+      dbgio_flush();
+  }
+
+  dbgio_flush();
+}
+
 
 } // namespace CdBlock
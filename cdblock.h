@@ -8,10 +8,32 @@
 #pragma once
 
 #include <yaul.h>
+#include "filehash.h"
 
-#define HASH_PRIME 31
-#define HASH_CUT_NUMBER 1000000009
-#define HASH_CHAR(X) ((X) - 31)
+// Number of entries first allocated by buildHeaderTable, doubled every
+// time the table is full.
+#define CDBLOCK_INITIAL_TABLE_ENTRIES 64
+
+// Maximum number of sectors requested from the drive by a single
+// cd_block_read_data call when reading long extents.
+#define CDBLOCK_MAX_BURST_SECTORS 32
+
+// Size of the staging buffer used by readFileBatch to read neighbouring
+// files with a single request, and the largest gap (in sectors) between
+// two files still read together instead of skipped.
+#define CDBLOCK_BATCH_STAGING_SECTORS 8
+#define CDBLOCK_BATCH_MAX_GAP_SECTORS 2
+
+// Bits of a FilesystemExtent holding the first sector and the number of
+// whole sectors of a file. 19 bits address 1GB, more than any CD holds, 
+// and files are limited to 512MB.
+#define CDBLOCK_EXTENT_LBA_BITS 19
+#define CDBLOCK_EXTENT_SECTOR_BITS 18
+
+// Number of children and name bytes first allocated by 
+// buildDirectoryIndex, doubled every time they are full.
+#define CDBLOCK_INITIAL_DIRECTORY_CHILDREN 64
+#define CDBLOCK_INITIAL_DIRECTORY_NAMES 1024
 
 namespace CdBlock {
 
@@ -30,8 +52,13 @@ struct MultiEndianNumber {
   T l;
   T b;
 
-  // Return big endian on saturn.
+  // Return the half in CPU order, big endian on saturn (little endian 
+  // when host tools build this file).
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  const T operator()() const { return l; }
+#else
   const T operator()() const { return b; }
+#endif
 } __packed;
 
 struct Sector {
@@ -81,6 +108,32 @@ struct DirectoryRecord {
   }
 } __packed;
 
+/**
+ * Record of the path table in CPU order, the big endian (type M) one on
+ * saturn.
+ */
+struct PathTableRecord {
+  uint8_t identifierLength;
+  uint8_t extendedAttributeLength;
+  uint32_t extentLocation;
+  uint16_t parentDirectory;
+
+  char* identifierPtr() const {
+    char* ptr = (char*) &parentDirectory;
+    ptr += sizeof(parentDirectory);
+
+    return ptr;
+  }
+
+  PathTableRecord *nextRecord() {
+    uint8_t *recordPtr = (uint8_t*) this;
+    recordPtr += sizeof(PathTableRecord) + identifierLength + 
+      (identifierLength & 1);
+
+    return (PathTableRecord*) recordPtr;
+  }
+} __packed;
+
 struct RootDirectoryRecord : public DirectoryRecord {
   uint8_t identifier;
 } __packed;
@@ -149,6 +202,10 @@ struct FilesystemData {
   // Sector to operate temporary data.
   Sector tempSector;
 
+  // Location and size in bytes of the path table in CPU order.
+  uint32_t pathTableLBA;
+  uint32_t pathTableSize;
+
   inline RootDirectoryRecord* root() {
     return (RootDirectoryRecord*)& rootSector;
   };
@@ -177,15 +234,260 @@ struct FilesystemEntry {
 };
 
 /**
- * Filesystem Header Table.
+ * Location of a file packed in 48 bits: first sector (19 bits), number of
+ * whole sectors (18 bits) and bytes used in the last sector (11 bits).
+ */
+struct FilesystemExtent {
+  uint16_t lbaLow;
+  uint16_t sectorsLow;
+
+  // lba bits 16-18, sectors bits 16-17 and the tail byte count.
+  uint16_t high;
+
+  inline uint32_t lba() const {
+    return lbaLow | ((uint32_t) (high >> 13) << 16);
+  }
+
+  inline uint32_t size() const {
+    const uint32_t sectors = sectorsLow | 
+      ((uint32_t) ((high >> 11) & 3) << 16);
+
+    return (sectors << 11) | (high & 2047);
+  }
+};
+
+static_assert(sizeof(FilesystemExtent) == 6, 
+  "FilesystemExtent size mismatch.");
+
+/**
+ * File whose filenameHash is shared with other files on the disc. It is
+ * told apart by the secondary hash of its path.
+ */
+struct FilesystemCollision {
+  uint32_t secondaryHash;
+  FilesystemEntry entry;
+};
+
+/**
+ * Structure used by getFileEntry to search the header table.
+ */
+enum class HeaderTableLookup {
+  // Binary search over the sorted hashes, no extra memory.
+  BINARY_SEARCH,
+
+  // Hashes copied in Eytzinger (breadth first) order to a separate array,
+  // so the top levels of the tree share cache lines. Costs 8 bytes per 
+  // entry.
+  EYTZINGER
+};
+
+/**
+ * Filesystem Header Table, stored as two parallel arrays so searching
+ * only touches the hashes. Entries take 10 bytes instead of the 12 of a
+ * FilesystemEntry, use getFileEntry to unpack them.
  */
 struct FilesystemHeaderTable {
   uint32_t numEntries;
 
-  // Entries will point to an user allocated memory region that will
-  // store all entries. When deallocating this, user should free the
-  // 'entries' pointer.
-  FilesystemEntry *entries;
+  // Sorted filename hashes and the extent of the file at the same index.
+  // Both arrays share one allocation, made by the table builders unless 
+  // given to fillHeaderTable. When deallocating this, user should free 
+  // the 'hashes' pointer.
+  uint32_t *hashes;
+  FilesystemExtent *extents;
+
+  // Files sharing a hash, hashes then only holds one of them. Usually 
+  // empty, otherwise allocated by the table builder and the user should
+  // free the 'collisions' pointer as well.
+  uint32_t numCollisions;
+  FilesystemCollision *collisions;
+
+  // Optional lookup structure built by buildHeaderTableLookup. Both arrays
+  // are 1-based and share one allocation, the user should free the
+  // 'lookupHashes' pointer if set.
+  uint32_t *lookupHashes;
+  uint32_t *lookupIndices;
+
+  // Sorted hashes of the files stored as LZSS containers (lzss.h). Only
+  // known when knowsPackedFiles is set, by loadHeaderTableIndex, which 
+  // allocates them and the user should free 'packedHashes' as well.
+  bool knowsPackedFiles;
+  uint32_t numPackedFiles;
+  uint32_t *packedHashes;
+
+  // Most memory held at once while the table was built (unpacked 
+  // entries, collisions and the packed table), only the packed table is
+  // kept afterwards.
+  uint32_t peakBuildBytes;
+};
+
+/**
+ * Directory in the directory index.
+ */
+struct DirectoryIndexNode {
+  // Hash of the directory path with the trailing '/', HASH_SEED for the
+  // root directory.
+  uint32_t pathHash;
+
+  // Children are stored next to each other in DirectoryIndex::children.
+  uint32_t firstChild;
+  uint32_t numChildren;
+
+  // We compare directories by the hash.
+  inline bool operator == (const DirectoryIndexNode& other) const {
+      return pathHash == other.pathHash;
+  }
+
+  inline bool operator < (const DirectoryIndexNode& other) const {
+      return pathHash < other.pathHash;
+  }
+
+  inline bool operator > (const DirectoryIndexNode& other) const {
+      return pathHash > other.pathHash;
+  }
+};
+
+/**
+ * File or sub-directory in the directory index.
+ */
+struct DirectoryIndexChild {
+  // Offset of the name (NUL terminated) in DirectoryIndex::names.
+  uint32_t nameOffset;
+  FilesystemExtent extent;
+  uint8_t nameLength;
+
+  // Directory record flags (FLAG_CDBLOCK_*).
+  uint8_t flags;
+};
+
+static_assert(sizeof(DirectoryIndexChild) == 12, 
+  "DirectoryIndexChild size mismatch.");
+
+/**
+ * Names and locations of the children of every directory, so directories 
+ * can be listed without reading the disc. Allocated by 
+ * buildDirectoryIndex, release it with freeDirectoryIndex.
+ */
+struct DirectoryIndex {
+  // Sorted by path hash.
+  uint32_t numDirectories;
+  DirectoryIndexNode *directories;
+
+  uint32_t numChildren;
+  DirectoryIndexChild *children;
+
+  uint32_t namesSize;
+  char *names;
+};
+
+/**
+ * Position of a directory listing, see openDirectory.
+ */
+struct DirectoryHandle {
+  uint32_t nextChild;
+  uint32_t endChild;
+};
+
+/**
+ * Child returned by readDirectory.
+ */
+struct DirectoryEntry {
+  // NUL terminated, without the ';1' version of files. Points into the 
+  // directory index.
+  const char *name;
+  uint32_t nameLength;
+
+  bool isDirectory;
+  uint32_t lba;
+  uint32_t size;
+};
+
+/**
+ * Traffic counters of the cd-block read path.
+ */
+struct ReadStatistics {
+  // Number of cd_block_read_data commands issued.
+  uint32_t commandsIssued;
+
+  // Number of sectors transferred from the drive.
+  uint32_t sectorsRead;
+
+  // Number of bytes copied out of intermediate buffers (sector cache,
+  // prefetch window and bounce buffers).
+  uint32_t bytesCopied;
+
+  // Part of bytesCopied taken out of bounce buffers because the drive
+  // could not write there directly: the trailing partial sector of a file
+  // and the staging buffer of readFileBatch.
+  uint32_t bytesBounced;
+
+  // Sectors served by the sector cache (each one a drive read saved).
+  uint32_t cacheHits;
+
+  // Sectors looked up in the sector cache and read from the drive (or
+  // the prefetch window).
+  uint32_t cacheMisses;
+
+  // Drive reads not starting where the previous one ended, and the sum 
+  // of the distances (in sectors) the pickup had to travel for them.
+  uint32_t seeks;
+  uint32_t seekDistance;
+
+  // Sectors read ahead by the prefetch window, the ones later served 
+  // from it (each one a drive read saved) and the ones dropped unused.
+  uint32_t prefetchedSectors;
+  uint32_t prefetchHits;
+  uint32_t prefetchWasted;
+};
+
+/**
+ * File of a readFileBatch call.
+ */
+struct FileBatchEntry {
+  FilesystemEntry entry;
+
+  // Destination, must hold entry.size bytes.
+  void *buffer;
+
+  // Batches are read in disc order.
+  inline bool operator < (const FileBatchEntry& other) const {
+      return entry.lba < other.entry.lba;
+  }
+
+  inline bool operator > (const FileBatchEntry& other) const {
+      return entry.lba > other.entry.lba;
+  }
+};
+
+/**
+ * File read while the access trace is running, see startAccessTrace.
+ */
+struct FileAccessRecord {
+  uint32_t filenameHash;
+  uint32_t lba;
+  uint32_t size;
+
+  // Value of the trace clock when the file started being read.
+  uint32_t time;
+};
+
+/**
+ * Time source of the access trace (frame counter, timer...).
+ */
+typedef uint32_t (*AccessTraceClock)();
+
+/**
+ * State of an incremental file read, see beginFileContents.
+ */
+struct FileReadRequest {
+  // Next sector to be read.
+  uint32_t lba;
+
+  // Bytes still to be read.
+  uint32_t missingBytes;
+
+  // Where the next sector will be written.
+  uint8_t *buffer;
 };
 
 /**
@@ -232,28 +534,148 @@ extern void navigateFilesystem(FilesystemData *fsData,
 extern void printCdStructure(FilesystemData *fsData);
 
 /**
- * Return the size in bytes required to store the Filesystem Header Table.
+ * Return the size in bytes required to store the Filesystem Header Table
+ * (hashes and extents).
  */
 extern uint32_t getHeaderTableSize(FilesystemData *fsData);
 
 /**
- * Fill the passed Filesystem Header Table. The allocated header table 
+ * Fill the passed Filesystem Header Table. The headerTable->hashes 
  * pointer must point to a memory location with at least 
- * getHeaderTableSize() bytes available.
+ * getHeaderTableSize() bytes available, aligned to 4 bytes. Entries are 
+ * collected in a temporary table before being packed there.
  */
 extern void fillHeaderTable(FilesystemData *fsData, 
   FilesystemHeaderTable *headerTable);
 
+/**
+ * Allocate (malloc) and fill the Filesystem Header Table, reading every
+ * directory sector only once. Unlike getHeaderTableSize + fillHeaderTable
+ * the table is grown while the disc is walked. The user should free
+ * headerTable->hashes when done.
+ *
+ * @return 0 If successful.
+ */
+extern int buildHeaderTable(FilesystemData *fsData, 
+  FilesystemHeaderTable *headerTable);
+
+/**
+ * Same as buildHeaderTable, but directories are enumerated from the path
+ * table (read once, in a single request) and their extents are then read
+ * in LBA order instead of recursively, turning the random seeks of the
+ * directory walk into a near sequential sweep of the disc.
+ *
+ * @return 0 If successful.
+ */
+extern int buildHeaderTableFromPathTable(FilesystemData *fsData, 
+  FilesystemHeaderTable *headerTable);
+
+/**
+ * Load a precomputed index (see fileindex.h and tools/mkindex) from the 
+ * root directory into headerTable, skipping the directory scan entirely.
+ * The index also tells which files are LZSS containers. The user should
+ * free headerTable->hashes and headerTable->packedHashes when done.
+ *
+ * @param filename Name of the index file in the root directory.
+ *
+ * @return 0 If the index exists and passed every check, in case of 
+ *           failure the headerTable is left empty.
+ */
+extern int loadHeaderTableIndex(FilesystemData *fsData, const char *filename,
+  FilesystemHeaderTable *headerTable);
+
+/**
+ * Build the lookup structure used by getFileEntry on an already filled
+ * header table. Must be called again whenever the entries change.
+ *
+ * @param lookup Structure to build, BINARY_SEARCH releases any previous 
+ *               one and searches the hashes directly.
+ *
+ * @return 0 If successful, otherwise the table keeps using binary search.
+ */
+extern int buildHeaderTableLookup(FilesystemHeaderTable *headerTable, 
+  HeaderTableLookup lookup);
+
+/**
+ * Print (dbgio_buffer) the memory taken by the header table and the peak
+ * reached while building it, with the cost per 1000 files against 
+ * unpacked FilesystemEntry records and the most a builder can hold
+ * per 1000 files while growing its entries.
+ */
+extern void printHeaderTableMemory(FilesystemHeaderTable *headerTable);
+
 /**
  * Return file entry.
  * @param headerTable Filesystem header table.
  * @param filenameHash Hash of the file to be searched. Use 
- *                     getFilenameHash for this.
- * @param resultingEntry If file is found, the resulting entry point to 
- *                       the file entry on the header table.
+ *                     getFilenameHash for this. When the hash is shared
+ *                     by several files any of them can be returned, use
+ *                     the FilePath version to tell them apart.
+ * @param resultingEntry If file is found, it is filled with the unpacked
+ *                       entry from the header table.
+ *
+ * @return true If the file was found.
+ */
+extern bool getFileEntry(FilesystemHeaderTable *headerTable, 
+  uint32_t filenameHash, FilesystemEntry *resultingEntry);
+
+/**
+ * Same as above, using the secondary hash of the path when its filename
+ * hash collides with another file. Costs the same as the plain hash
+ * lookup when the disc has no collisions.
+ */
+extern bool getFileEntry(FilesystemHeaderTable *headerTable, FilePath path,
+  FilesystemEntry *resultingEntry);
+
+/**
+ * Return true if the index marked the file of filenameHash as an LZSS
+ * container. Only meaningful when headerTable->knowsPackedFiles is set.
+ */
+extern bool isPackedFile(FilesystemHeaderTable *headerTable, 
+  uint32_t filenameHash);
+
+/**
+ * Return true if filenameHash is shared by more than one file, meaning 
+ * the secondary hash is required to find the right one.
+ */
+extern bool isCollidingHash(FilesystemHeaderTable *headerTable, 
+  uint32_t filenameHash);
+
+/**
+ * Allocate (malloc) and fill the directory index. Directories are read 
+ * once, in LBA order, using the path table.
+ *
+ * @return 0 If successful, in case of failure the index is left empty.
+ */
+extern int buildDirectoryIndex(FilesystemData *fsData, 
+  DirectoryIndex *directoryIndex);
+
+/**
+ * Release the memory allocated by buildDirectoryIndex.
+ */
+extern void freeDirectoryIndex(DirectoryIndex *directoryIndex);
+
+/**
+ * Start listing a directory. Takes a binary search on the directory 
+ * index, the disc is not accessed.
+ *
+ * @param pathHash Hash of the directory path with the trailing '/' (for
+ *                 example "DATA/"_path.hash), HASH_SEED for the root.
+ * @param directory Position of the listing, used by readDirectory.
+ *
+ * @return 0 If the directory exists.
  */
-extern void getFileEntry(FilesystemHeaderTable *headerTable, 
-  uint32_t filenameHash, FilesystemEntry **resultingEntry);
+extern int openDirectory(DirectoryIndex *directoryIndex, uint32_t pathHash,
+  DirectoryHandle *directory);
+
+/**
+ * Return the next child of a directory opened with openDirectory, in the
+ * order they are recorded on the disc.
+ *
+ * @return false Once every child was returned.
+ */
+extern bool readDirectory(DirectoryIndex *directoryIndex, 
+  DirectoryHandle *directory, DirectoryEntry *entry);
 
 /**
  * Return file contents from the specified entry.
@@ -265,55 +687,139 @@ extern void getFileEntry(FilesystemHeaderTable *headerTable,
 extern int getFileContents(FilesystemEntry *entry, void *buffer);
 
 /**
- * Generate a hash based on passed parameters.
+ * Prepare an incremental read of the file contents from the specified 
+ * entry. No data is read until continueFileContents is called.
+ *
+ * @param entry A file entry in the header table.
+ * @param buffer File contents will be returned in this buffer.
+ * @param request Request state to be initialized.
+ */
+extern void beginFileContents(FilesystemEntry *entry, void *buffer,
+  FileReadRequest *request);
+
+/**
+ * Advance an incremental read started by beginFileContents. maxBytes is
+ * rounded up to whole sectors, so at least one sector is read per call.
+ * The read is complete when request->missingBytes reaches 0.
  *
- * @param filename Name of the file to generate the hash.
- * @param length Length of the filename string.
- * @param startingHash In case of appending to a hash, this is the 
- *                     starting hash.
- * @param firstPrime The first prime to be used in the sequence.
- * @param primeFactor The number we will multiply the prime each iteration.
- * @param lastPrime If not nullptr, returns the last prime used.
+ * @param request Request state.
+ * @param maxBytes Maximum number of bytes to be read in this call.
+ *
+ * @return 0 If reading was successful.
  */
-#ifdef __cplusplus
-constexpr uint32_t generateHash(const char* filename, uint32_t length, 
-  uint32_t startingHash, uint32_t firstPrime, uint32_t primeFactor, 
-  uint32_t *lastPrime) {
+extern int continueFileContents(FileReadRequest *request, 
+  uint32_t maxBytes);
 
-#else // __cplusplus
-uint32_t generateHash(const char* filename, uint32_t length, 
-  uint32_t startingHash, uint32_t firstPrime, uint32_t primeFactor, 
-  uint32_t *lastPrime) {
-#endif
+/**
+ * Read several files, in disc order instead of the given one so the 
+ * pickup sweeps the disc once. Neighbouring small files (up to 
+ * CDBLOCK_BATCH_MAX_GAP_SECTORS apart) are read with a single request 
+ * through a staging buffer of CDBLOCK_BATCH_STAGING_SECTORS and then 
+ * copied to their buffers, bigger files are read straight into theirs.
+ *
+ * @param entries Files to read, sorted by LBA in place.
+ *
+ * @return 0 If reading was successful.
+ */
+extern int readFileBatch(FileBatchEntry *entries, uint32_t numEntries);
+
+/**
+ * Read consecutive sectors straight into the passed buffer. Long runs are
+ * split in bursts of at most CDBLOCK_MAX_BURST_SECTORS sectors.
+ *
+ * @param lba First sector to be read.
+ * @param numSectors Number of sectors to read.
+ * @param buffer Destination, must hold numSectors * 2048 bytes.
+ *
+ * @return 0 If reading was successful.
+ */
+extern int readSectors(uint32_t lba, uint32_t numSectors, void *buffer);
 
-  assert(filename != nullptr);
+/**
+ * Read consecutive sectors of a file, as readSectors does, without reading
+ * ahead past the end of the file.
+ *
+ * @param lba First sector to be read.
+ * @param numSectors Number of sectors to read.
+ * @param endLBA Sector following the last one of the file.
+ * @param buffer Destination, must hold numSectors * 2048 bytes.
+ *
+ * @return 0 If reading was successful.
+ */
+extern int readFileSectors(uint32_t lba, uint32_t numSectors, 
+  uint32_t endLBA, void *buffer);
 
-  uint32_t hash = startingHash;
-  uint32_t prime = firstPrime;
-  for (uint32_t i = 0; i < length; ++i) {
-    hash += HASH_CHAR(filename[i]) * prime;
-    hash %= HASH_CUT_NUMBER;
-    prime *= primeFactor;
-  }
-    
-  if (lastPrime != nullptr)
-    *lastPrime = prime;
+/**
+ * Allocate a sector cache with numSectors slots, replacing any previous 
+ * one. Every read done through readSectors (directory traversal and file
+ * contents) is served from the cache when possible, and least recently 
+ * used slots are evicted first. Requests longer than half the cache are
+ * not inserted, so big files do not flush everything else.
+ *
+ * @param numSectors Number of cached sectors, 0 disables the cache.
+ *
+ * @return 0 If the cache could be allocated.
+ */
+extern int initializeSectorCache(uint32_t numSectors);
 
-  return hash;
-}
+/**
+ * Allocate a prefetch window of numSectors, replacing any previous one.
+ * A read starting where the previous one ended is extended to fill the
+ * window in the same drive command, the following sequential reads (such
+ * as streamed files and directory walks) are then served from memory.
+ * Reads of numSectors or more bypass the window.
+ *
+ * @param numSectors Size of the window, 0 disables prefetching.
+ *
+ * @return 0 If the window could be allocated.
+ */
+extern int initializePrefetchWindow(uint32_t numSectors);
 
 /**
- * Generate a cdblock filename hash.
+ * Drop every sector held by the sector cache and the prefetch window 
+ * (e.g. after a disc change).
  */
-#ifdef __cplusplus
-constexpr uint32_t getFilenameHash(const char *filename, uint32_t length) {
-#else // __cplusplus
-uint32_t getFilenameHash(const char *filename, uint32_t length) {
-#endif
+extern void invalidateSectorCache();
+
+/**
+ * Copy the read path counters into stats.
+ */
+extern void getReadStatistics(ReadStatistics *stats);
+
+/**
+ * Zero the read path counters.
+ */
+extern void resetReadStatistics();
 
-  return generateHash(filename, length, 0, HASH_PRIME, 
-    HASH_PRIME, nullptr);
-}
+/**
+ * Record every file read from now on (path hash, LBA, size and time) for
+ * tools/layoutplan. Once numRecords are taken the oldest ones are 
+ * overwritten.
+ *
+ * @param records User memory holding the trace.
+ * @param clock Time source, if nullptr records are numbered instead.
+ */
+extern void startAccessTrace(FileAccessRecord *records, uint32_t numRecords,
+  AccessTraceClock clock);
+
+/**
+ * Stop recording, the records are kept until the next startAccessTrace.
+ */
+extern void stopAccessTrace();
+
+/**
+ * Add a file read to the trace, if running. Called by the file reading 
+ * functions of this module, other readers (such as streamed files) 
+ * should call it when they open a file.
+ */
+extern void traceFileAccess(const FilesystemEntry *entry);
+
+/**
+ * Print (dbgio_buffer) the trace, oldest first, one "TRACE <hash> <lba>
+ * <size> <time>" line per record. Capture the output to feed 
+ * tools/layoutplan.
+ */
+extern void printAccessTrace();
 
 
 } // namespace cdblock
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+/**
+ * \file crc32.cpp
+ * CRC-32 (IEEE 802.3, as in zlib) for link and disc integrity checks.
+ *****************************************************************************/
+#include "crc32.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace {
+
+
+/**
+ * Slicing tables, generated at compile time. Table 0 is the classic byte
+ * at a time table, table k advances a byte through k more zero bytes.
+ *****************************************************************************/
+struct Crc32Tables {
+  crc32_t entries[CRC32_SLICES][256];
+};
+
+constexpr Crc32Tables makeTables() {
+  Crc32Tables tables = {};
+
+  for (uint32_t i = 0; i < 256; ++i) {
+    crc32_t crc = i;
+    for (uint32_t bit = 0; bit < 8; ++bit)
+      crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+
+    tables.entries[0][i] = crc;
+  }
+
+  for (uint32_t slice = 1; slice < CRC32_SLICES; ++slice) {
+    for (uint32_t i = 0; i < 256; ++i) {
+      const crc32_t previous = tables.entries[slice - 1][i];
+      tables.entries[slice][i] = (previous >> 8) ^ 
+        tables.entries[0][previous & 0xff];
+    }
+  }
+
+  return tables;
+}
+
+constexpr Crc32Tables crc32_tables = makeTables();
+
+inline uint32_t readLittleEndian(const unsigned char *data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) | 
+    ((uint32_t) data[3] << 24);
+}
+
+
+} // namespace ''
+
+crc32_t crc32_update(crc32_t crc, const unsigned char *data, size_t data_len) {
+  const crc32_t (*table)[256] = crc32_tables.entries;
+
+  // Bytes are read one by one, data needs no alignment.
+#if CRC32_SLICES > 1
+  while (data_len >= CRC32_SLICES) {
+#if CRC32_SLICES == 8
+    const uint32_t low = crc ^ readLittleEndian(data);
+    const uint32_t high = readLittleEndian(data + 4);
+
+    crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^
+      table[5][(low >> 16) & 0xff] ^ table[4][low >> 24] ^
+      table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff] ^
+      table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+#else
+    const uint32_t word = crc ^ readLittleEndian(data);
+
+    crc = table[3][word & 0xff] ^ table[2][(word >> 8) & 0xff] ^
+      table[1][(word >> 16) & 0xff] ^ table[0][word >> 24];
+#endif
+
+    data += CRC32_SLICES;
+    data_len -= CRC32_SLICES;
+  }
+#endif
+
+  while (data_len--) {
+    crc = table[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+    data++;
+  }
+
+  return crc;
+}
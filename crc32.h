@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+/**
+ * \file crc32.h
+ * CRC-32 (IEEE 802.3, as in zlib) for link and disc integrity checks.
+ *
+ *    Width        = 32
+ *    Poly         = 0x04c11db7
+ *    XorIn        = 0xffffffff
+ *    ReflectIn    = True
+ *    XorOut       = 0xffffffff
+ *    ReflectOut   = True
+ *    Algorithm    = slicing-by-4 (or 1, 8), see CRC32_SLICES
+ *****************************************************************************/
+#ifndef __CRC32__H__
+#define __CRC32__H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Bytes consumed per step of crc32_update, 1, 4 or 8. Each slice is a 1KB
+ * table. With 4 the tables alone are as large as the whole 4KB SH-2 cache,
+ * so they evict and get evicted by the code and the data being checked:
+ * a block costs a cache refill of the tables it touches, traded for a
+ * quarter of the loop steps and shifts of the byte at a time table. With
+ * 8 the tables are twice the cache, only worth it on the host (see
+ * tools/crcbench). With 1 the table takes a quarter of the cache, for
+ * code that checks little data between other cache heavy work.
+ *****************************************************************************/
+#ifndef CRC32_SLICES
+#define CRC32_SLICES 4
+#endif
+
+#if CRC32_SLICES != 1 && CRC32_SLICES != 4 && CRC32_SLICES != 8
+#error "CRC32_SLICES must be 1, 4 or 8"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The type of the CRC values.
+ *****************************************************************************/
+typedef uint32_t crc32_t;
+
+/**
+ * Calculate the initial crc value.
+ *
+ * \return     The initial crc value.
+ *****************************************************************************/
+static inline crc32_t crc32_init(void) { return 0xffffffff; }
+
+/**
+ * Update the crc value with new data. Data may be fed in any number of
+ * calls.
+ *
+ * \param crc      The current crc value.
+ * \param data     Pointer to a buffer of \a data_len bytes.
+ * \param data_len Number of bytes in the \a data buffer.
+ * \return         The updated crc value.
+ *****************************************************************************/
+crc32_t crc32_update(crc32_t crc, const unsigned char *data, size_t data_len);
+
+/**
+ * Calculate the final crc value.
+ *
+ * \param crc  The current crc value.
+ * \return     The final crc value.
+ *****************************************************************************/
+static inline crc32_t crc32_finalize(crc32_t crc) { return crc ^ 0xffffffff; }
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+
+#endif /* __CRC32__H__ */
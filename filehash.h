@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+#pragma once
+
+// Kept free of yaul so host tools hash paths exactly like the Saturn.
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Filename hash scheme, select at build time with -DHASH_VERSION=N.
+//   1: Polynomial hash reduced modulo HASH_CUT_NUMBER on every character.
+//   2: FNV-1a, a xor and a multiply per character. No division, which 
+//      the SH-2 lacks (each % above is a libgcc call).
+// Every component hashing paths (disc index, USB host) must agree on it.
+#ifndef HASH_VERSION
+#define HASH_VERSION 1
+#endif
+
+#define HASH_PRIME 31
+#define HASH_CUT_NUMBER 1000000009
+#define HASH_CHAR(X) ((X) - 31)
+
+#define HASH_FNV_OFFSET_BASIS 2166136261u
+#define HASH_FNV_PRIME 16777619u
+
+// Secondary hash (djb2), only used to tell apart colliding paths.
+#define HASH_SECONDARY_SEED 5381
+
+// Hash of the empty path (root directory).
+#if HASH_VERSION == 1
+#define HASH_SEED 0
+#elif HASH_VERSION == 2
+#define HASH_SEED HASH_FNV_OFFSET_BASIS
+#else
+#error "Unknown HASH_VERSION"
+#endif
+
+namespace CdBlock {
+
+
+/**
+ * Generate a hash based on passed parameters.
+ *
+ * @param filename Name of the file to generate the hash.
+ * @param length Length of the filename string.
+ * @param startingHash In case of appending to a hash, this is the 
+ *                     starting hash.
+ * @param firstPrime The first prime to be used in the sequence.
+ * @param primeFactor The number we will multiply the prime each iteration.
+ * @param lastPrime If not nullptr, returns the last prime used.
+ *
+ * The prime parameters only matter to HASH_VERSION 1, FNV-1a carries its
+ * whole state in the hash (lastPrime then returns firstPrime). Either way
+ * appending to a parent hash equals hashing the full path at once.
+ */
+#ifdef __cplusplus
+constexpr uint32_t generateHash(const char* filename, uint32_t length, 
+  uint32_t startingHash, uint32_t firstPrime, uint32_t primeFactor, 
+  uint32_t *lastPrime) {
+
+#else // __cplusplus
+uint32_t generateHash(const char* filename, uint32_t length, 
+  uint32_t startingHash, uint32_t firstPrime, uint32_t primeFactor, 
+  uint32_t *lastPrime) {
+#endif
+
+  assert(filename != nullptr);
+
+  uint32_t hash = startingHash;
+  uint32_t prime = firstPrime;
+
+#if HASH_VERSION == 1
+  for (uint32_t i = 0; i < length; ++i) {
+    hash += HASH_CHAR(filename[i]) * prime;
+    hash %= HASH_CUT_NUMBER;
+    prime *= primeFactor;
+  }
+#else
+  (void) primeFactor;
+  for (uint32_t i = 0; i < length; ++i) {
+    hash ^= (uint8_t) filename[i];
+    hash *= HASH_FNV_PRIME;
+  }
+#endif
+
+  if (lastPrime != nullptr)
+    *lastPrime = prime;
+
+  return hash;
+}
+
+/**
+ * Generate a cdblock filename hash.
+ */
+#ifdef __cplusplus
+constexpr uint32_t getFilenameHash(const char *filename, uint32_t length) {
+#else // __cplusplus
+uint32_t getFilenameHash(const char *filename, uint32_t length) {
+#endif
+
+  return generateHash(filename, length, HASH_SEED, HASH_PRIME, 
+    HASH_PRIME, nullptr);
+}
+
+/**
+ * Generate the secondary hash of a path, independent from the filename
+ * hash. Like generateHash, it can be appended to a parent hash.
+ */
+#ifdef __cplusplus
+constexpr uint32_t generateSecondaryHash(const char *filename, 
+  uint32_t length, uint32_t startingHash) {
+#else // __cplusplus
+uint32_t generateSecondaryHash(const char *filename, uint32_t length,
+  uint32_t startingHash) {
+#endif
+
+  uint32_t hash = startingHash;
+  for (uint32_t i = 0; i < length; ++i)
+    hash = (hash << 5) + hash + (uint8_t) filename[i];
+
+  return hash;
+}
+
+/**
+ * Generate a cdblock secondary filename hash.
+ */
+#ifdef __cplusplus
+constexpr uint32_t getSecondaryFilenameHash(const char *filename, 
+  uint32_t length) {
+#else // __cplusplus
+uint32_t getSecondaryFilenameHash(const char *filename, uint32_t length) {
+#endif
+
+  return generateSecondaryHash(filename, length, HASH_SECONDARY_SEED);
+}
+
+#ifdef __cplusplus
+/**
+ * Path already reduced to its filename hash. Build it with the _path 
+ * literal ("DIR/FILE.BIN"_path), which hashes at compile time when used 
+ * in a constant expression, so opening it is a pure table lookup.
+ */
+struct FilePath {
+  uint32_t hash;
+
+  // Only looked at when hash collides with another path on the disc.
+  uint32_t secondaryHash;
+
+  constexpr FilePath(uint32_t filenameHash, uint32_t pathSecondaryHash) 
+    : hash(filenameHash),
+      secondaryHash(pathSecondaryHash) {
+  }
+};
+#endif // __cplusplus
+
+
+} // namespace CdBlock
+
+#ifdef __cplusplus
+constexpr CdBlock::FilePath operator "" _path(const char *path, 
+  size_t length) {
+
+  return CdBlock::FilePath(CdBlock::getFilenameHash(path, length),
+    CdBlock::getSecondaryFilenameHash(path, length));
+}
+#endif // __cplusplus
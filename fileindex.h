@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+#pragma once
+
+// Kept free of yaul, shared with tools/mkindex.
+#include <stdint.h>
+
+/**
+ * Precomputed file index stored on the disc root by tools/mkindex. The 
+ * file is a FileIndexHeader followed by numEntries FileIndexEntry records
+ * sorted by filenameHash. Every field is big endian.
+ */
+#define FILE_INDEX_FILENAME "FILES.IDX"
+#define FILE_INDEX_MAGIC 0x46494458 // 'FIDX'
+#define FILE_INDEX_VERSION 1
+
+// Set in FileIndexEntry::size for files that are LZSS containers 
+// (lzss.h), the only files File decodes.
+#define FILE_INDEX_PACKED 0x80000000
+
+struct FileIndexHeader {
+  uint32_t magic;
+  uint32_t version;
+
+  // HASH_VERSION used to compute the filenameHash fields.
+  uint32_t hashVersion;
+  uint32_t numEntries;
+
+  // CRC-32 (crc32.h) of the numEntries records.
+  uint32_t checksum;
+};
+
+// Same layout as CdBlock::FilesystemEntry, once FILE_INDEX_PACKED is 
+// cleared from size.
+struct FileIndexEntry {
+  uint32_t filenameHash;
+  uint32_t lba;
+  uint32_t size;
+};
+
+static_assert(sizeof(FileIndexHeader) == 20, "FileIndexHeader size mismatch.");
+static_assert(sizeof(FileIndexEntry) == 12, "FileIndexEntry size mismatch.");
+
+/**
+ * Read a big endian 32 bit field of the index, at any alignment.
+ */
+inline uint32_t readFileIndexWord(const uint8_t *data) {
+  return ((uint32_t) data[0] << 24) | (data[1] << 16) | (data[2] << 8) | 
+    data[3];
+}
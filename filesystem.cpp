@@ -7,25 +7,215 @@
 
 
 #include <yaul.h>
-#include "crc.h"
+#include "crc32.h"
+#include "fileindex.h"
 #include "filesystem.h"
+#include "lzss.h"
+#include "search.h"
+#include "usbtransfer.h"
 
 FilesystemBackend Filesystem::defaultBackend;
 CdBlock::FilesystemData Filesystem::cdFilesystemData;
 CdBlock::FilesystemHeaderTable Filesystem::cdHeaderTable;
+CdBlock::DirectoryIndex Filesystem::cdDirectoryIndex;
+UsbFileIndex Filesystem::usbIndex;
+FilesystemStatistics Filesystem::statistics;
+HeapAllocator Filesystem::heapAllocator;
+Allocator *Filesystem::allocator = &Filesystem::heapAllocator;
+uint32_t Filesystem::asyncSequence;
+AsyncFile Filesystem::asyncRequests[FILESYSTEM_MAX_ASYNC_REQUESTS];
 
 // Debugging?
 // #define DEBUG_FILESYSTEM
 
+// Marks an empty slot in the sector ring of streamed files.
+#define INVALID_RING_SECTOR 0xFFFFFFFF
+
 namespace {
 
 
-enum TransferCommands {
-  TC_REQUEST_FILE = 0,
-  TC_REQUEST_FILE_SIZE,
-  TC_INVALID = 0xFF
+const UsbLink usbCartLink = {
+  usb_cart_byte_read,
+  usb_cart_long_read,
+  usb_cart_byte_send,
+  usb_cart_long_send
+};
+
+/**
+ * Hash a runtime path. The secondary hash is only computed when the 
+ * filename hash collides with another file on the disc.
+ */
+CdBlock::FilePath makeFilePath(const char* filename) {
+  assert(filename != nullptr);
+
+  const uint32_t length = strlen(filename);
+  const uint32_t hash = CdBlock::getFilenameHash(filename, length);
+
+  uint32_t secondaryHash = 0;
+  if (CdBlock::isCollidingHash(Filesystem::getCdBlockHeaderTable(), hash))
+    secondaryHash = CdBlock::getSecondaryFilenameHash(filename, length);
+
+  return CdBlock::FilePath(hash, secondaryHash);
+}
+
+/**
+ * Hash a runtime directory path the way directories are hashed in the
+ * directory index, ending with '/'.
+ */
+uint32_t makeDirectoryHash(const char* path) {
+  assert(path != nullptr);
+
+  while (*path == '/')
+    path++;
+
+  const uint32_t length = strlen(path);
+  if (length == 0)
+    return HASH_SEED;
+
+  uint32_t lastPrime = 0;
+  uint32_t hash = CdBlock::generateHash(path, length, HASH_SEED, HASH_PRIME, 
+    HASH_PRIME, &lastPrime);
+
+  // Add '/'
+  if (path[length - 1] != '/') {
+    hash = CdBlock::generateHash("/", 1, hash, lastPrime, HASH_PRIME, 
+      &lastPrime);
+  }
+
+  return hash;
+}
+
+/**
+ * Whether a cd-block file is an LZSS container (see lzss.h). Only the 
+ * files FILES.IDX marks are, without the index every file is read as it
+ * is on the disc, whatever its first bytes.
+ */
+bool isPackedEntry(const CdBlock::FilesystemEntry *entry) {
+  CdBlock::FilesystemHeaderTable *table = 
+    Filesystem::getCdBlockHeaderTable();
+
+  return table->knowsPackedFiles && 
+    CdBlock::isPackedFile(table, entry->filenameHash);
+}
+
+/**
+ * Read the header of an LZSS container. The sector stays in the sector
+ * cache, loading the file next does not transfer it again.
+ *
+ * @return 0 If the header is valid.
+ */
+int readCompressedHeader(CdBlock::FilesystemEntry *entry, 
+  LzssHeader *header) {
+
+  if (entry->size < LZSS_HEADER_SIZE)
+    return -1;
+
+  CdBlock::Sector sector;
+  if (CdBlock::readSectors(entry->lba, 1, sector.data) != 0)
+    return -1;
+
+  return Lzss::readHeader(sector.data, header) ? 0 : -1;
+}
+
+struct CompressedLoad {
+  CdBlock::FileReadRequest request;
+  uint8_t *staging;
+
+  // Bytes read into staging, and bytes of them already decoded.
+  uint32_t stagedBytes;
+  uint32_t consumedBytes;
 };
 
+/**
+ * Make sure numBytes not yet decoded are staged, reading as few sectors
+ * as possible. Leftovers are moved to the start of the staging buffer, 
+ * keeping sectors read after them 4 byte aligned.
+ */
+int stageCompressedBytes(CompressedLoad *load, uint32_t numBytes) {
+  const uint32_t availableBytes = load->stagedBytes - load->consumedBytes;
+  if (availableBytes >= numBytes)
+    return 0;
+
+  const uint32_t padding = (4 - (availableBytes & 3)) & 3;
+  memmove(load->staging + padding, load->staging + load->consumedBytes,
+    availableBytes);
+
+  load->consumedBytes = padding;
+  load->stagedBytes = padding + availableBytes;
+  numBytes += padding;
+
+  while (load->stagedBytes < numBytes) {
+    const uint32_t missingBytes = load->request.missingBytes;
+
+    // Truncated container.
+    if (missingBytes == 0)
+      return -1;
+
+    load->request.buffer = load->staging + load->stagedBytes;
+    const int stat = CdBlock::continueFileContents(&load->request, 
+      numBytes - load->stagedBytes);
+
+    if (stat != 0)
+      return stat;
+
+    load->stagedBytes += missingBytes - load->request.missingBytes;
+  }
+
+  return 0;
+}
+
+/**
+ * Load an LZSS container into dest, decoding every block once its sectors
+ * are read. Besides dest, only one block of packed data is held.
+ */
+int loadCompressedContents(CdBlock::FilesystemEntry *entry, 
+  const LzssHeader *header, uint8_t *dest, Allocator *allocator) {
+
+  // Largest block plus the sector read past it and the alignment padding.
+  const uint32_t stagingSize = header->blockSize + LZSS_BLOCK_HEADER_SIZE +
+    2048 + 3;
+
+  CompressedLoad load;
+  load.staging = (uint8_t*) allocator->allocate(stagingSize);
+  if (load.staging == nullptr)
+    return -1;
+
+  CdBlock::beginFileContents(entry, load.staging, &load.request);
+  load.stagedBytes = 0;
+  load.consumedBytes = 0;
+
+  int stat = stageCompressedBytes(&load, LZSS_HEADER_SIZE);
+  load.consumedBytes += LZSS_HEADER_SIZE;
+
+  const uint32_t numBlocks = Lzss::getNumBlocks(header);
+  for (uint32_t i = 0; i < numBlocks && stat == 0; ++i) {
+    stat = stageCompressedBytes(&load, LZSS_BLOCK_HEADER_SIZE);
+    if (stat != 0)
+      break;
+
+    const uint32_t payloadSize = 
+      Lzss::getPayloadSize(load.staging + load.consumedBytes);
+
+    if (payloadSize > header->blockSize) {
+      stat = -1;
+      break;
+    }
+
+    stat = stageCompressedBytes(&load, LZSS_BLOCK_HEADER_SIZE + payloadSize);
+    if (stat != 0)
+      break;
+
+    const uint32_t blockSize = Lzss::getBlockSize(header, i);
+    stat = Lzss::decodeBlock(load.staging + load.consumedBytes, 
+      dest + i * header->blockSize, blockSize);
+
+    load.consumedBytes += LZSS_BLOCK_HEADER_SIZE + payloadSize;
+  }
+
+  allocator->release(load.staging, stagingSize);
+  return stat;
+}
+
 uint32_t usbGetFileSize(uint32_t filenameHash) {
 
   // Send command and wait for our bytes.
@@ -36,37 +226,107 @@ uint32_t usbGetFileSize(uint32_t filenameHash) {
   return usb_cart_long_read();
 }
 
-inline uint32_t usbGetFileSize(const char* filename, uint32_t length) {
-  return usbGetFileSize(CdBlock::getFilenameHash(filename, length));
+/**
+ * Size of a file on the USB host, from the index when synced (no request
+ * is made) or asked to the host.
+ *
+ * @return Size of the file, 0 if not found.
+ */
+uint32_t usbGetIndexedFileSize(const UsbFileIndex *index, 
+  uint32_t filenameHash) {
+
+  if (!index->synced)
+    return usbGetFileSize(filenameHash);
+
+  uint32_t *found = nullptr;
+  CdBlock::binarySearch(index->hashes, index->numEntries, filenameHash, 
+    &found);
+
+  return (found != nullptr) ? index->sizes[found - index->hashes] : 0;
 }
 
-uint32_t usbGetFileData(const char* filename, uint32_t filenameLength, 
-  void* buffer) {
+/**
+ * Receive the manifest of the USB host into a new index.
+ *
+ * @return 0 If successful, index is only modified then.
+ */
+int usbGetManifest(UsbFileIndex *index) {
+  usb_cart_byte_send((uint8_t)TC_REQUEST_MANIFEST);
+
+  uint32_t manifestSize = 0;
+  if (UsbTransfer::receiveSize(&usbCartLink, &manifestSize) != 0)
+    return -1;
+
+  if (manifestSize % 8 != 0) {
+    UsbTransfer::abortBlocks(&usbCartLink, manifestSize);
+    return -1;
+  }
+
+  const uint32_t numEntries = manifestSize / 8;
+  uint32_t *hashes = nullptr;
+
+  if (numEntries > 0) {
+    hashes = (uint32_t*) malloc(manifestSize);
+    if (hashes == nullptr) {
+
+      // Drain the transfer, the host is already sending it.
+      UsbTransfer::receiveBlocks(&usbCartLink, nullptr, manifestSize);
+      return -1;
+    }
+
+    // Both sides are big endian, the manifest is used as received.
+    if (UsbTransfer::receiveBlocks(&usbCartLink, (uint8_t*) hashes, 
+      manifestSize) != 0) {
+
+      free(hashes);
+      return -1;
+    }
+
+    for (uint32_t i = 1; i < numEntries; ++i) {
+      if (hashes[i - 1] >= hashes[i]) {
+        free(hashes);
+        return -1;
+      }
+    }
+  }
+
+  free(index->hashes);
 
-  // Calculate hash.
-  const uint32_t hash = CdBlock::getFilenameHash(filename, filenameLength);
+  index->synced = true;
+  index->numEntries = numEntries;
+  index->hashes = hashes;
+  index->sizes = hashes + numEntries;
+  return 0;
+}
+
+/**
+ * Load a whole file, damaged blocks are sent again up to 
+ * USB_TRANSFER_MAX_RETRIES times.
+ *
+ * @param maxSize Bytes buffer holds, larger files are refused.
+ *
+ * @return Size of the file, 0 if not found or the transfer failed.
+ */
+uint32_t usbGetFileData(uint32_t hash, void* buffer, 
+  uint32_t maxSize = UINT32_MAX) {
 
   // Send command and wait for our bytes.
-  usb_cart_byte_send((uint8_t)TC_REQUEST_FILE);
+  usb_cart_byte_send((uint8_t)TC_REQUEST_FILE_BLOCKS);
   usb_cart_long_send(hash);
 
-  const uint32_t fileSize = usb_cart_long_read();
-  if (fileSize == 0)
-    return 0;
-
-  for (uint32_t i = 0; i < fileSize; ++i)
-    ((uint8_t*)buffer)[i] = (unsigned char) usb_cart_byte_read();
+  uint32_t fileSize = 0;
+  if (UsbTransfer::receiveSize(&usbCartLink, &fileSize, maxSize) != 0 || 
+    fileSize == 0) {
 
-  // Check crc.
-  const uint8_t crc = usb_cart_byte_read();
+    return 0;
+  }
 
-  // Calculate crc.
-  const uint8_t calculatedCRC = crc_finalize(crc_update(0, 
-    (const unsigned char*) buffer, fileSize));
+  if (UsbTransfer::receiveBlocks(&usbCartLink, (uint8_t*) buffer, 
+    fileSize) != 0) {
 
-  usb_cart_byte_send(calculatedCRC != crc);
+    return 0;
+  }
 
-  // Read bytes.
   return fileSize;
 }
 
@@ -74,59 +334,116 @@ uint32_t usbGetFileData(const char* filename, uint32_t filenameLength,
 } // namespace ''
 
 
-File::File(void *passPtr, const char *filename, FilesystemBackend pBackend)
+File::File(void *passPtr, CdBlock::FilePath path, FilesystemBackend pBackend,
+  FileMode pMode)
   : backend(pBackend),
+    mode(pMode),
     length(0),
-    seekPos(0) {
+    seekPos(0),
+    ptr(passPtr),
+    ownsData(passPtr == nullptr),
+    allocator(Filesystem::getAllocator()),
+    filenameHash(path.hash),
+    lba(0) {
+
+  // Only loaded contents can live in caller memory.
+  assert(ownsData || mode == FileMode::LOADED);
 
   switch (backend) {
   case FilesystemBackend::CDBLOCK:
     {
-      CdBlock::FilesystemEntry *fsEntry = nullptr;
-      CdBlock::getFileEntry(Filesystem::getCdBlockHeaderTable(),
-        CdBlock::getFilenameHash(filename, strlen(filename)), &fsEntry);
+      CdBlock::FilesystemEntry fsEntry;
+      const bool found = CdBlock::getFileEntry(
+        Filesystem::getCdBlockHeaderTable(), path, &fsEntry);
 
 #ifdef DEBUG_FILESYSTEM
-      if (fsEntry == nullptr) {
+      if (!found) {
         char tmpBuffer[1024];
-        sprintf(tmpBuffer, "File %s not found!\n", filename);
+        sprintf(tmpBuffer, "File %lu not found!\n", path.hash);
         dbgio_buffer(tmpBuffer);
         dbgio_flush();
       }
 #endif
 
-      assert(fsEntry != nullptr);
-      length = fsEntry->size;
-      ptr = malloc(fsEntry->size);
+      assert(found);
+      length = fsEntry.size;
 
-      assert(ptr != nullptr);
+      if (mode == FileMode::STREAMED) {
 
-      const int stat = CdBlock::getFileContents(fsEntry, ptr);
-      assert(stat == 0);
+        // Would read as packed bytes, containers are only decoded whole.
+        assert(!isPackedEntry(&fsEntry));
+        CdBlock::traceFileAccess(&fsEntry);
+
+        lba = fsEntry.lba;
+        ptr = allocator->allocate(FILE_STREAM_RING_SECTORS * 
+          sizeof(CdBlock::Sector));
+
+        assert(ptr != nullptr);
+
+        for (uint32_t i = 0; i < FILE_STREAM_RING_SECTORS; ++i)
+          ringSectors[i] = INVALID_RING_SECTOR;
+
+      } else {
+
+        // Containers are decoded when the file owns its contents, caller
+        // memory was sized after the packed file.
+        if (ownsData && isPackedEntry(&fsEntry)) {
+          LzssHeader header;
+          int stat = readCompressedHeader(&fsEntry, &header);
+          assert(stat == 0);
+
+          length = header.originalSize;
+          ptr = allocator->allocate(length);
+          assert(ptr != nullptr);
+
+          Filesystem::statistics.bytesAllocated += length;
+          Filesystem::statistics.bytesDecompressed += length;
+
+          stat = loadCompressedContents(&fsEntry, &header, (uint8_t*) ptr, 
+            allocator);
+
+          assert(stat == 0);
+
+        } else {
+          if (ownsData) {
+            ptr = allocator->allocate(fsEntry.size);
+            assert(ptr != nullptr);
+
+            Filesystem::statistics.bytesAllocated += fsEntry.size;
+          }
+
+          const int stat = CdBlock::getFileContents(&fsEntry, ptr);
+          assert(stat == 0);
+        }
+      }
     }
     break;
 
   case FilesystemBackend::USB:
     {
-      length = usbGetFileSize(filename, strlen(filename));
+      // Streaming is only available on the cd-block.
+      assert(mode == FileMode::LOADED);
+      length = usbGetIndexedFileSize(&Filesystem::usbIndex, path.hash);
 
 #ifdef DEBUG_FILESYSTEM
       if (length == 0) {
         char tmpBuffer[1024];
-        sprintf(tmpBuffer, "File %s not found!\n", filename);
+        sprintf(tmpBuffer, "File %lu not found!\n", path.hash);
         dbgio_buffer(tmpBuffer);
         dbgio_flush();
       }
 #endif
 
       assert(length != 0);
-      ptr = malloc(length);
-      assert(ptr != nullptr);
+      if (ownsData) {
+        ptr = allocator->allocate(length);
+        assert(ptr != nullptr);
+
+        Filesystem::statistics.bytesAllocated += length;
+      }
 
-      uint32_t getSize = 0;
-      do {
-        getSize = usbGetFileData(filename, strlen(filename), ptr);
-      } while (getSize != length);
+      const uint32_t getSize = usbGetFileData(path.hash, ptr, length);
+      assert(getSize == length);
     }
     break;
   default:
@@ -136,6 +453,13 @@ File::File(void *passPtr, const char *filename, FilesystemBackend pBackend)
   }
 }
 
+void AsyncFile::release() {
+  currentStatus = AsyncStatus::FREE;
+  ptr = nullptr;
+  callback = nullptr;
+  userData = nullptr;
+}
+
 File& File::operator = (File& other) {
   memcpy(this, &other, sizeof(File));
   memset(&other, 0, sizeof(File));
@@ -157,9 +481,16 @@ File::~File() {
 uint32_t File::readData(void* dest, uint32_t len) {
   switch (backend) {
   case FilesystemBackend::CDBLOCK:
+    if (mode == FileMode::STREAMED) {
+      assert(dest != nullptr);
+      return streamData((uint8_t*) dest, len);
+    }
+
+    // Fall through.
   case FilesystemBackend::USB:
     assert(dest != nullptr);
     memcpy(dest, (uint8_t*)ptr + seekPos, len);
+    Filesystem::statistics.bytesCopied += len;
     seekPos += len;
     return len;
      
@@ -170,6 +501,71 @@ uint32_t File::readData(void* dest, uint32_t len) {
   }
 }
 
+uint32_t File::streamData(uint8_t* dest, uint32_t len) {
+  CdBlock::Sector *ring = (CdBlock::Sector*) ptr;
+
+  // Never read past the end of file.
+  if (seekPos >= length)
+    return 0;
+
+  if (len > length - seekPos)
+    len = length - seekPos;
+
+  // Reads ahead stop at the last sector of the file.
+  const uint32_t endLBA = lba + (length + 2047) / 2048;
+
+  uint32_t missingBytes = len;
+  while (missingBytes > 0) {
+    const uint32_t sector = seekPos / 2048;
+    const uint32_t offset = seekPos % 2048;
+    const uint32_t slot = sector % FILE_STREAM_RING_SECTORS;
+
+    if (ringSectors[slot] != sector) {
+
+      // Whole sectors are read straight into dest, skipping the ring.
+      if (offset == 0 && missingBytes >= 2048) {
+        const uint32_t directBytes = (missingBytes / 2048) * 2048;
+        const int stat = CdBlock::readFileSectors(lba + sector, 
+          directBytes / 2048, endLBA, dest);
+
+        assert(stat == 0);
+
+        dest += directBytes;
+        seekPos += directBytes;
+        missingBytes -= directBytes;
+        continue;
+      }
+
+      // Fill the ring from this slot up to the last sector we need.
+      const uint32_t lastSector = (seekPos + missingBytes - 1) / 2048;
+      uint32_t numSectors = lastSector - sector + 1;
+      if (numSectors > FILE_STREAM_RING_SECTORS - slot)
+        numSectors = FILE_STREAM_RING_SECTORS - slot;
+
+      const int stat = CdBlock::readFileSectors(lba + sector, numSectors, 
+        endLBA, ring[slot].data);
+
+      assert(stat == 0);
+
+      for (uint32_t i = 0; i < numSectors; ++i)
+        ringSectors[slot + i] = sector + i;
+    }
+
+    uint32_t copyBytes = 2048 - offset;
+    if (copyBytes > missingBytes)
+      copyBytes = missingBytes;
+
+    memcpy(dest, ring[slot].data + offset, copyBytes);
+    Filesystem::statistics.bytesCopied += copyBytes;
+
+    dest += copyBytes;
+    seekPos += copyBytes;
+    missingBytes -= copyBytes;
+  }
+
+  return len;
+}
+
 void File::skipData(uint32_t len) {
   switch (backend) {
   case FilesystemBackend::CDBLOCK:
@@ -203,12 +599,123 @@ void File::seek(uint32_t fromPosition, uint32_t numOfBytes) {
   }
 }
   
+int File::reload() {
+  assert(backend == FilesystemBackend::USB);
+  assert(mode == FileMode::LOADED && ptr != nullptr);
+
+  const uint32_t numBlocks = (length + USB_TRANSFER_BLOCK_SIZE - 1) / 
+    USB_TRANSFER_BLOCK_SIZE;
+
+  usb_cart_byte_send((uint8_t)TC_REQUEST_FILE_DELTA);
+  usb_cart_long_send(filenameHash);
+  usb_cart_long_send(ownsData ? UINT32_MAX : length);
+  usb_cart_long_send(length);
+
+  for (uint32_t i = 0; i < numBlocks; ++i) {
+    const uint32_t offset = i * USB_TRANSFER_BLOCK_SIZE;
+    const uint32_t blockSize = (length - offset < USB_TRANSFER_BLOCK_SIZE) ?
+      length - offset : USB_TRANSFER_BLOCK_SIZE;
+
+    usb_cart_long_send(crc32_finalize(crc32_update(crc32_init(), 
+      (const uint8_t*) ptr + offset, blockSize)));
+  }
+
+  uint32_t deltaSize = 0;
+  if (UsbTransfer::receiveSize(&usbCartLink, &deltaSize) != 0 || 
+    deltaSize == 0) {
+
+    return -1;
+  }
+
+  // New size, CRC-32 of the new file, number of changed blocks and their
+  // indices. Used as received, both sides are big endian.
+  uint32_t *delta = nullptr;
+  if (deltaSize >= 3 * sizeof(uint32_t) && deltaSize % sizeof(uint32_t) == 0)
+    delta = (uint32_t*) malloc(deltaSize);
+
+  if (delta == nullptr) {
+    UsbTransfer::abortBlocks(&usbCartLink, deltaSize);
+    return -1;
+  }
+
+  if (UsbTransfer::receiveBlocks(&usbCartLink, (uint8_t*) delta, 
+    deltaSize) != 0) {
+
+    free(delta);
+    return -1;
+  }
+
+  const uint32_t newLength = delta[0];
+  const uint32_t fileCRC = delta[1];
+  const uint32_t numChanged = deltaSize / sizeof(uint32_t) - 3;
+  const uint32_t *changedBlocks = delta + 3;
+
+  // Doesn't fit caller memory, the host sends nothing else.
+  if (!ownsData && newLength > length) {
+    free(delta);
+    return -1;
+  }
+
+  // The host sends every listed block, refused if the list is broken.
+  const uint32_t newNumBlocks = (newLength + USB_TRANSFER_BLOCK_SIZE - 1) / 
+    USB_TRANSFER_BLOCK_SIZE;
+
+  bool valid = (delta[2] == numChanged);
+  for (uint32_t i = 0; i < numChanged && valid; ++i) {
+    valid = changedBlocks[i] < newNumBlocks &&
+      (i == 0 || changedBlocks[i] > changedBlocks[i - 1]);
+  }
+
+  uint8_t *resized = (uint8_t*) ptr;
+  if (valid && newLength != length && ownsData) {
+    resized = (uint8_t*) allocator->allocate(newLength);
+    valid = (resized != nullptr);
+  }
+
+  if (!valid) {
+    if (numChanged > 0)
+      UsbTransfer::abortBlocks(&usbCartLink, newLength);
+
+    free(delta);
+    return -1;
+  }
+
+  if (resized != ptr) {
+    memcpy(resized, ptr, (newLength < length) ? newLength : length);
+    allocator->release(ptr, length);
+
+    Filesystem::statistics.bytesAllocated += newLength;
+    ptr = resized;
+  }
+
+  length = newLength;
+
+  const int stat = UsbTransfer::receiveBlockList(&usbCartLink, 
+    (uint8_t*) ptr, length, changedBlocks, numChanged);
+
+  free(delta);
+  if (stat != 0)
+    return -1;
+
+  // Catches a changed block whose CRC matched the old one.
+  const crc32_t crc = crc32_finalize(crc32_update(crc32_init(), 
+    (const uint8_t*) ptr, length));
+
+  return (crc == fileCRC) ? 0 : -1;
+}
+
 void File::close() {
   switch (backend) {
   case FilesystemBackend::CDBLOCK:
   case FilesystemBackend::USB:
-    if (ptr != nullptr)
-      free(ptr);
+    if (ptr != nullptr && ownsData) {
+      const uint32_t size = (mode == FileMode::STREAMED) ?
+        FILE_STREAM_RING_SECTORS * sizeof(CdBlock::Sector)
+        :
+        length;
+
+      allocator->release(ptr, size);
+    }
     break;
 
   default:
@@ -222,22 +729,89 @@ void File::close() {
   seekPos = 0;
 }
 
-void Filesystem::initialize() {
+void Filesystem::initialize(CdBlock::HeaderTableLookup lookup, 
+  uint32_t cacheSectors, uint32_t prefetchSectors) {
+
   // CDBlock Initialization.
-  const int stat = CdBlock::initialize();
+  int stat = CdBlock::initialize();
+  assert(stat == 0);
+
+  stat = CdBlock::initializeSectorCache(cacheSectors);
+  assert(stat == 0);
+
+  stat = CdBlock::initializePrefetchWindow(prefetchSectors);
   assert(stat == 0);
 
   CdBlock::readFilesystem(&cdFilesystemData);
 
-  // Create cd entries table (necessary for looking for files).
-  const uint32_t tableSize = CdBlock::getHeaderTableSize(&cdFilesystemData);
-  cdHeaderTable.entries = (CdBlock::FilesystemEntry*) malloc(tableSize);
-  CdBlock::fillHeaderTable(&cdFilesystemData, &cdHeaderTable);
+  // Create cd entries table (necessary for looking for files). A 
+  // precomputed index is the fastest source, followed by the path table. 
+  // The directory walk is kept as last resort.
+  stat = CdBlock::loadHeaderTableIndex(&cdFilesystemData, 
+    FILE_INDEX_FILENAME, &cdHeaderTable);
+
+  if (stat != 0) {
+    stat = CdBlock::buildHeaderTableFromPathTable(&cdFilesystemData, 
+      &cdHeaderTable);
+  }
+
+  if (stat != 0)
+    stat = CdBlock::buildHeaderTable(&cdFilesystemData, &cdHeaderTable);
+
+  assert(stat == 0);
+
+  // Not fatal, lookups fall back to binary search if out of memory.
+  CdBlock::buildHeaderTableLookup(&cdHeaderTable, lookup);
 
   // Set default backend.
   defaultBackend = FilesystemBackend::CDBLOCK;
 }
   
+bool Filesystem::openDirectory(const char* path, 
+  CdBlock::DirectoryHandle *directory) {
+
+  return openDirectory(CdBlock::FilePath(makeDirectoryHash(path), 0), 
+    directory);
+}
+
+bool Filesystem::openDirectory(CdBlock::FilePath path, 
+  CdBlock::DirectoryHandle *directory) {
+
+  if (cdDirectoryIndex.directories == nullptr) {
+    const int stat = CdBlock::buildDirectoryIndex(&cdFilesystemData, 
+      &cdDirectoryIndex);
+
+    if (stat != 0)
+      return false;
+  }
+
+  return CdBlock::openDirectory(&cdDirectoryIndex, path.hash, 
+    directory) == 0;
+}
+
+bool Filesystem::readDirectory(CdBlock::DirectoryHandle *directory, 
+  CdBlock::DirectoryEntry *entry) {
+
+  return CdBlock::readDirectory(&cdDirectoryIndex, directory, entry);
+}
+
+int Filesystem::syncUsbIndex() {
+  return usbGetManifest(&usbIndex);
+}
+
+void Filesystem::setAllocator(Allocator *newAllocator) {
+  allocator = (newAllocator != nullptr) ? newAllocator : &heapAllocator;
+}
+
+void Filesystem::getStatistics(FilesystemStatistics *stats) {
+  assert(stats != nullptr);
+  *stats = statistics;
+}
+
+void Filesystem::resetStatistics() {
+  statistics = { 0, 0, 0 };
+}
+
 void Filesystem::printCdStructure() {
   CdBlock::printCdStructure(&cdFilesystemData);
 }
@@ -246,7 +820,14 @@ void Filesystem::setDefaultBackend(FilesystemBackend backend) {
   defaultBackend = backend;
 }
   
-File Filesystem::open(const char* filename, FilesystemBackend backend) {
+File Filesystem::open(const char* filename, FilesystemBackend backend,
+  FileMode mode) {
+
+  return open(makeFilePath(filename), backend, mode);
+}
+
+File Filesystem::open(CdBlock::FilePath path, FilesystemBackend backend,
+  FileMode mode) {
   const FilesystemBackend usingBackend = 
     (backend == FilesystemBackend::AUTO) ? 
     defaultBackend 
@@ -256,7 +837,7 @@ File Filesystem::open(const char* filename, FilesystemBackend backend) {
   switch (usingBackend) {
   case FilesystemBackend::CDBLOCK:
   case FilesystemBackend::USB:
-    return File(nullptr, filename, usingBackend);
+    return File(nullptr, path, usingBackend, mode);
 
   case FilesystemBackend::AUTO:
   default:
@@ -265,26 +846,280 @@ File Filesystem::open(const char* filename, FilesystemBackend backend) {
 
   // Never reaches.
   assert(false);
-  return File(nullptr, filename, usingBackend);
+  return File(nullptr, path, usingBackend, mode);
+}
+
+File Filesystem::open(const char* filename, void *dest,
+  FilesystemBackend backend) {
+
+  return open(makeFilePath(filename), dest, backend);
+}
+
+File Filesystem::open(CdBlock::FilePath path, void *dest,
+  FilesystemBackend backend) {
+
+  assert(dest != nullptr);
+
+  const FilesystemBackend usingBackend = 
+    (backend == FilesystemBackend::AUTO) ? 
+    defaultBackend 
+    : 
+    backend;
+
+  return File(dest, path, usingBackend, FileMode::LOADED);
 }
   
+int Filesystem::loadBatch(const FileLoadRequest *requests, 
+  uint32_t numRequests, FilesystemBackend backend) {
+
+  assert(requests != nullptr || numRequests == 0);
+
+  const FilesystemBackend usingBackend = 
+    (backend == FilesystemBackend::AUTO) ? 
+    defaultBackend 
+    : 
+    backend;
+
+  switch (usingBackend) {
+  case FilesystemBackend::CDBLOCK:
+    {
+      CdBlock::FileBatchEntry *entries = (CdBlock::FileBatchEntry*) malloc(
+        numRequests * sizeof(CdBlock::FileBatchEntry));
+
+      if (entries == nullptr && numRequests > 0)
+        return -1;
+
+      for (uint32_t i = 0; i < numRequests; ++i) {
+        assert(requests[i].dest != nullptr);
+        entries[i].buffer = requests[i].dest;
+
+        // Containers can't be decoded on the way, fail instead of 
+        // returning packed bytes.
+        if (!CdBlock::getFileEntry(getCdBlockHeaderTable(), requests[i].path,
+          &entries[i].entry) || isPackedEntry(&entries[i].entry)) {
+
+          free(entries);
+          return -1;
+        }
+      }
+
+      const int ret = CdBlock::readFileBatch(entries, numRequests);
+      free(entries);
+
+      return ret;
+    }
+
+  case FilesystemBackend::USB:
+    for (uint32_t i = 0; i < numRequests; ++i) {
+      assert(requests[i].dest != nullptr);
+
+      // Missing files are caught before any transfer once synced.
+      uint32_t maxSize = UINT32_MAX;
+      if (usbIndex.synced) {
+        maxSize = usbGetIndexedFileSize(&usbIndex, requests[i].path.hash);
+        if (maxSize == 0)
+          return -1;
+      }
+
+      if (usbGetFileData(requests[i].path.hash, requests[i].dest, 
+        maxSize) == 0) {
+
+        return -1;
+      }
+    }
+    return 0;
+
+  default:
+  case FilesystemBackend::AUTO:
+    break;
+  }
+
+  assert(false);
+  return -1;
+}
+
+CdBlock::FilePath Filesystem::getFilePath(const char* filename) {
+  return makeFilePath(filename);
+}
+
+AsyncFile *Filesystem::openAsync(const char* filename, void *dest,
+  AsyncCallback callback, void *userData, FilesystemBackend backend) {
+
+  return openAsync(makeFilePath(filename), dest, callback, userData, 
+    backend);
+}
+
+AsyncFile *Filesystem::openAsync(CdBlock::FilePath path, void *dest,
+  AsyncCallback callback, void *userData, FilesystemBackend backend) {
+
+  assert(dest != nullptr);
+
+  const FilesystemBackend usingBackend = 
+    (backend == FilesystemBackend::AUTO) ? 
+    defaultBackend 
+    : 
+    backend;
+
+  AsyncFile *request = nullptr;
+  for (uint32_t i = 0; i < FILESYSTEM_MAX_ASYNC_REQUESTS; ++i) {
+    if (asyncRequests[i].currentStatus == AsyncStatus::FREE) {
+      request = &asyncRequests[i];
+      break;
+    }
+  }
+
+  if (request == nullptr)
+    return nullptr;
+
+  request->backend = usingBackend;
+  request->sequence = asyncSequence++;
+  request->filenameHash = path.hash;
+
+  request->ptr = dest;
+  request->callback = callback;
+  request->userData = userData;
+
+  switch (usingBackend) {
+  case FilesystemBackend::CDBLOCK:
+    {
+      CdBlock::FilesystemEntry fsEntry;
+      const bool found = CdBlock::getFileEntry(getCdBlockHeaderTable(), 
+        path, &fsEntry);
+
+      // Containers can't be decoded incrementally, they fail as missing
+      // files instead of returning packed bytes.
+      if (found && !isPackedEntry(&fsEntry)) {
+        request->length = fsEntry.size;
+        CdBlock::beginFileContents(&fsEntry, dest, &request->readRequest);
+      } else {
+        // No buffer marks the request to fail on the next update.
+        request->length = 0;
+        request->readRequest.missingBytes = 0;
+        request->readRequest.buffer = nullptr;
+      }
+    }
+    break;
+
+  case FilesystemBackend::USB:
+    // Size is only known once the transfer happens, unless synced.
+    request->length = usbIndex.synced ? 
+      usbGetIndexedFileSize(&usbIndex, path.hash) : 0;
+
+    request->readRequest.missingBytes = 0;
+    break;
+
+  default:
+  case FilesystemBackend::AUTO:
+    assert(false);
+    break;
+  }
+
+  request->currentStatus = AsyncStatus::PENDING;
+  return request;
+}
+
+void Filesystem::updateAsync(uint32_t byteBudget) {
+  for (;;) {
+
+    // Serve the oldest pending request first.
+    AsyncFile *request = nullptr;
+    for (uint32_t i = 0; i < FILESYSTEM_MAX_ASYNC_REQUESTS; ++i) {
+      AsyncFile *candidate = &asyncRequests[i];
+      if (candidate->currentStatus != AsyncStatus::PENDING)
+        continue;
+
+      if (request == nullptr || 
+        (int32_t) (candidate->sequence - request->sequence) < 0) {
+
+        request = candidate;
+      }
+    }
+
+    if (request == nullptr)
+      return;
+
+    bool failed = false;
+    uint32_t transferredBytes = 0;
+
+    switch (request->backend) {
+    case FilesystemBackend::CDBLOCK:
+      if (request->readRequest.buffer == nullptr) {
+        failed = true;
+      } else {
+        const uint32_t lba = request->readRequest.lba;
+        failed = CdBlock::continueFileContents(&request->readRequest, 
+          byteBudget) != 0;
+
+        // Drive reads whole sectors, a small file costs one too.
+        transferredBytes = (request->readRequest.lba - lba) * 2048;
+      }
+      break;
+
+    case FilesystemBackend::USB:
+      // Missing files fail without a request once synced.
+      if (!usbIndex.synced || request->length != 0) {
+        request->length = usbGetFileData(request->filenameHash, 
+          request->ptr, usbIndex.synced ? request->length : UINT32_MAX);
+      }
+
+      failed = (request->length == 0);
+      transferredBytes = request->length;
+      break;
+
+    default:
+    case FilesystemBackend::AUTO:
+      assert(false);
+      break;
+    }
+
+    if (failed)
+      request->currentStatus = AsyncStatus::FAILED;
+    else if (request->readRequest.missingBytes == 0)
+      request->currentStatus = AsyncStatus::DONE;
+
+    if (request->currentStatus != AsyncStatus::PENDING && 
+      request->callback != nullptr) {
+
+      request->callback(request, request->userData);
+    }
+
+    // Continue with the next request only if budget is left.
+    if (transferredBytes >= byteBudget)
+      return;
+
+    byteBudget -= transferredBytes;
+  }
+}
+
 uint32_t Filesystem::getFileSize(uint32_t filenameHash) {
+  if (defaultBackend != FilesystemBackend::CDBLOCK)
+    return getFileSize(CdBlock::FilePath(filenameHash, 0));
+
+  // No secondary hash to pick a colliding file, take the main table one.
+  CdBlock::FilesystemEntry fsEntry;
+  if (!CdBlock::getFileEntry(getCdBlockHeaderTable(), filenameHash, 
+    &fsEntry)) {
+
+    return INVALID_FILE_SIZE;
+  }
+
+  return fsEntry.size;
+}
+
+uint32_t Filesystem::getFileSize(CdBlock::FilePath path) {
   switch (defaultBackend) {
   case FilesystemBackend::CDBLOCK:
     {
-      CdBlock::FilesystemEntry *fsEntry = nullptr;
-      CdBlock::getFileEntry(getCdBlockHeaderTable(), 
-        filenameHash, &fsEntry);
-
-      if (fsEntry == nullptr)
+      CdBlock::FilesystemEntry fsEntry;
+      if (!CdBlock::getFileEntry(getCdBlockHeaderTable(), path, &fsEntry))
         return INVALID_FILE_SIZE;
       else
-        return fsEntry->size;
+        return fsEntry.size;
     }
 
   case FilesystemBackend::USB:
     {
-      const uint32_t size = usbGetFileSize(filenameHash);
+      const uint32_t size = usbGetIndexedFileSize(&usbIndex, path.hash);
       if (size == 0)
         return INVALID_FILE_SIZE;
       else
@@ -301,6 +1136,5 @@ uint32_t Filesystem::getFileSize(uint32_t filenameHash) {
 }
   
 uint32_t Filesystem::getFileSize(const char* filename) {
-  return getFileSize(CdBlock::getFilenameHash(filename, strlen(filename)));
+  return getFileSize(makeFilePath(filename));
 }
-
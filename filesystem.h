@@ -9,10 +9,34 @@
 #define _FILESYSTEM_H_
 
 #include <yaul.h>
+#include "allocator.h"
 #include "cdblock.h"
 
 #define INVALID_FILE_SIZE 0xFFFFFFFF
 
+// Default number of sectors held by the cd-block sector cache (2KB each),
+// select at build time with -DFILESYSTEM_SECTOR_CACHE_SECTORS=N. 0 
+// disables the cache.
+#ifndef FILESYSTEM_SECTOR_CACHE_SECTORS
+#define FILESYSTEM_SECTOR_CACHE_SECTORS 16
+#endif
+
+// Default number of sectors read ahead by the cd-block prefetch window 
+// (2KB each), select at build time with -DFILESYSTEM_PREFETCH_SECTORS=N.
+// 0 disables the window.
+#ifndef FILESYSTEM_PREFETCH_SECTORS
+#define FILESYSTEM_PREFETCH_SECTORS 16
+#endif
+
+// Number of sectors kept in memory by a FileMode::STREAMED file.
+#define FILE_STREAM_RING_SECTORS 4
+
+// Maximum number of asynchronous requests in flight.
+#define FILESYSTEM_MAX_ASYNC_REQUESTS 8
+
+// Default number of bytes transferred by each Filesystem::updateAsync call.
+#define FILESYSTEM_ASYNC_TICK_BUDGET (8 * 2048)
+
 enum class FilesystemBackend {
   CDBLOCK,
   USB,
@@ -21,9 +45,86 @@ enum class FilesystemBackend {
   AUTO
 };
 
-// Forward declaration.
+enum class FileMode {
+  // The whole file is read into memory when opened. Files packed by 
+  // tools/lzsspack (cd-block only, marked by the FILES.IDX of 
+  // tools/mkindex) are decoded while they are read, size() is then the
+  // unpacked size.
+  LOADED,
+
+  // Only a ring of FILE_STREAM_RING_SECTORS sectors is kept in memory and
+  // sectors are read on demand by readData. CDBLOCK backend only, packed
+  // files can't be streamed.
+  STREAMED
+};
+
+enum class AsyncStatus {
+  // Slot not in use.
+  FREE,
+
+  // Data is still being transferred.
+  PENDING,
+
+  // Whole file is available at the destination buffer.
+  DONE,
+
+  // Transfer failed, destination contents are undefined.
+  FAILED
+};
+
+/**
+ * Memory traffic of loaded files, on top of CdBlock::ReadStatistics.
+ */
+struct FilesystemStatistics {
+  // Bytes allocated to hold the contents of LOADED files.
+  uint32_t bytesAllocated;
+
+  // Bytes copied by File::readData out of loaded contents or the sector
+  // ring of STREAMED files.
+  uint32_t bytesCopied;
+
+  // Bytes produced by decoding compressed (LZSS container) files.
+  uint32_t bytesDecompressed;
+};
+
+/**
+ * Files served by the USB host, fetched in one request by 
+ * Filesystem::syncUsbIndex. Laid out like CdBlock::FilesystemHeaderTable:
+ * sorted filename hashes and the size of the file at the same index.
+ */
+struct UsbFileIndex {
+  // False until the first successful sync, sizes are asked to the host
+  // on every query until then.
+  bool synced;
+
+  uint32_t numEntries;
+
+  // Both arrays share one allocation (malloc), made by syncUsbIndex.
+  uint32_t *hashes;
+  uint32_t *sizes;
+};
+
+/**
+ * File of a Filesystem::loadBatch call.
+ */
+struct FileLoadRequest {
+  CdBlock::FilePath path;
+
+  // Destination, must hold getFileSize(path) bytes.
+  void *dest;
+};
+
+// Forward declarations.
+class AsyncFile;
 class Filesystem;
 
+/**
+ * Called from Filesystem::updateAsync when an asynchronous request 
+ * finishes (successfully or not). Parameters are the finished request and
+ * the user data pointer passed to Filesystem::openAsync.
+ */
+typedef void (*AsyncCallback)(AsyncFile*, void*);
+
 class File {
 
 friend class Filesystem;
@@ -41,33 +142,250 @@ public:
   void seek(uint32_t fromPosition, uint32_t numOfBytes);
   void close();
 
-  inline void *getData() const { return ptr; }
+  /**
+   * Bring the contents up to date with the USB host (USB backend only),
+   * transferring only the USB_TRANSFER_BLOCK_SIZE blocks that changed.
+   * Edits that keep data in place are cheap, inserting bytes resends 
+   * everything after them. Owned contents are reallocated when the size 
+   * changed, caller memory can't grow past the current size. The read
+   * position is kept.
+   *
+   * @return 0 If successful, otherwise the contents are undefined and the
+   *         file should be opened again.
+   */
+  int reload();
+
+  // Streamed files have no in-memory copy and return nullptr.
+  inline void *getData() const { 
+    return (mode == FileMode::STREAMED) ? nullptr : ptr; 
+  }
+
   inline uint32_t size() const { return length; }
 
   ~File();
 
 private:
-  File(void *ptr, const char* filename, FilesystemBackend backend);
+  File(void *ptr, CdBlock::FilePath path, FilesystemBackend backend,
+    FileMode mode);
+
+  uint32_t streamData(uint8_t* dest, uint32_t len);
 
   FilesystemBackend backend;
+  FileMode mode;
   uint32_t length;
   uint32_t seekPos;
+
+  // File contents when LOADED, sector ring when STREAMED.
+  void *ptr;
+
+  // False when ptr is caller memory given to Filesystem::open, which is
+  // then never freed.
+  bool ownsData;
+
+  // Where ptr came from when owned, the Filesystem allocator at the time 
+  // the file was opened.
+  Allocator *allocator;
+
+  // Hash of the path, for reload.
+  uint32_t filenameHash;
+
+  // First sector of the file and file sector held by each ring slot
+  // (STREAMED only).
+  uint32_t lba;
+  uint32_t ringSectors[FILE_STREAM_RING_SECTORS];
+};
+
+/**
+ * Handle of a file being loaded by Filesystem::openAsync. Handles are
+ * owned by Filesystem and must be given back with release() once the
+ * caller is done polling them.
+ */
+class AsyncFile {
+
+friend class Filesystem;
+public:
+  AsyncFile(AsyncFile& other) = delete;
+
+  inline AsyncStatus status() const { return currentStatus; }
+  inline bool isDone() const { return currentStatus == AsyncStatus::DONE; }
+
+  inline void *getData() const { return ptr; }
+  inline uint32_t size() const { return length; }
+  inline uint32_t loadedBytes() const { 
+    return length - readRequest.missingBytes; 
+  }
+
+  // Cancel the transfer (if still pending) and free the handle.
+  void release();
+
+private:
+  AsyncFile() = default;
+
+  FilesystemBackend backend;
+  AsyncStatus currentStatus;
+
+  // Requests are served in order of arrival.
+  uint32_t sequence;
+
+  uint32_t filenameHash;
+  uint32_t length;
   void *ptr;
+
+  CdBlock::FileReadRequest readRequest;
+
+  AsyncCallback callback;
+  void *userData;
 };
 
 class Filesystem {
+
+friend class File;
 public:
-  static void initialize();
+  /**
+   * Read the disc filesystem and build the header table.
+   * @param lookup Structure used to search the table, see 
+   *               CdBlock::HeaderTableLookup.
+   * @param cacheSectors Sectors held by the cd-block sector cache, 0 
+   *                     disables it.
+   * @param prefetchSectors Sectors of the cd-block prefetch window, 0 
+   *                        disables it.
+   */
+  static void initialize(
+    CdBlock::HeaderTableLookup lookup = CdBlock::HeaderTableLookup::BINARY_SEARCH,
+    uint32_t cacheSectors = FILESYSTEM_SECTOR_CACHE_SECTORS,
+    uint32_t prefetchSectors = FILESYSTEM_PREFETCH_SECTORS);
   static void printCdStructure();
   static void setDefaultBackend(FilesystemBackend backend);
 
+  /**
+   * Allocator used by files opened from now on for their contents (or 
+   * sector ring when STREAMED). Files keep the allocator they were opened
+   * with. nullptr selects the libc heap, the default.
+   */
+  static void setAllocator(Allocator *allocator);
+  static inline Allocator *getAllocator() { return allocator; }
+
   static File open(const char* filename, 
+    FilesystemBackend backend = FilesystemBackend::AUTO,
+    FileMode mode = FileMode::LOADED);
+
+  // Same as above, without hashing the path at runtime.
+  static File open(CdBlock::FilePath path, 
+    FilesystemBackend backend = FilesystemBackend::AUTO,
+    FileMode mode = FileMode::LOADED);
+
+  /**
+   * Load the whole file straight into caller memory (VRAM, an arena...),
+   * without any intermediate heap copy. The File does not own dest, 
+   * closing it leaves dest untouched. Compressed files are not decoded.
+   *
+   * @param dest Destination, must hold getFileSize(filename) bytes.
+   */
+  static File open(const char* filename, void *dest,
     FilesystemBackend backend = FilesystemBackend::AUTO);
 
+  static File open(CdBlock::FilePath path, void *dest,
+    FilesystemBackend backend = FilesystemBackend::AUTO);
+
+  /**
+   * Load several whole files, blocking until every one is done. On the
+   * cd-block files are read in disc order (see CdBlock::readFileBatch),
+   * whatever the order of requests.
+   *
+   * @return 0 If every file was found and read. Packed files (see 
+   *         FileMode::LOADED) fail the batch, they can't be decoded there.
+   */
+  static int loadBatch(const FileLoadRequest *requests, 
+    uint32_t numRequests, 
+    FilesystemBackend backend = FilesystemBackend::AUTO);
+
+  // Hash a runtime path, for FileLoadRequest.
+  static CdBlock::FilePath getFilePath(const char* filename);
+
+  /**
+   * Start loading the whole file into dest without blocking. Data is
+   * transferred by later calls to updateAsync.
+   *
+   * @param filename Path of the file.
+   * @param dest Destination buffer, must hold getFileSize(filename) bytes.
+   * @param callback Optional function called when the request finishes.
+   * @param userData Optional pointer passed to callback.
+   *
+   * @return Request handle or nullptr if every request slot is busy. A
+   *         missing file, or a packed one (see FileMode::LOADED) which 
+   *         can't be decoded incrementally, still gets a handle, which 
+   *         turns FAILED (and calls callback) on the next updateAsync.
+   */
+  static AsyncFile *openAsync(const char* filename, void *dest,
+    AsyncCallback callback = nullptr, void *userData = nullptr,
+    FilesystemBackend backend = FilesystemBackend::AUTO);
+
+  static AsyncFile *openAsync(CdBlock::FilePath path, void *dest,
+    AsyncCallback callback = nullptr, void *userData = nullptr,
+    FilesystemBackend backend = FilesystemBackend::AUTO);
+
+  /**
+   * Advance pending asynchronous requests, oldest first, transferring at
+   * most byteBudget bytes (rounded up to whole sectors). Meant to be 
+   * called once per frame. USB requests are not incremental and finish
+   * in a single call.
+   */
+  static void updateAsync(uint32_t byteBudget = FILESYSTEM_ASYNC_TICK_BUDGET);
+
+  /**
+   * Size of the file as stored. For LZSS containers this is the packed
+   * size, the one caller memory passed to open must hold. File::size() 
+   * of a LOADED file that owns its contents is the unpacked size.
+   */
   static uint32_t getFileSize(const char* filename);
 
+  static uint32_t getFileSize(CdBlock::FilePath path);
+
+  // Colliding hashes can't be told apart (one of the files sharing the
+  // hash is returned), prefer the versions above.
   static uint32_t getFileSize(uint32_t filenameHash);
 
+  /**
+   * Start listing a directory of the disc (CDBLOCK backend only). The 
+   * first call builds the directory index, reading every directory once,
+   * later calls don't access the drive.
+   *
+   * @param path Directory path, with or without the trailing '/'. An 
+   *             empty path or "/" is the root directory.
+   * @param directory Position of the listing, used by readDirectory.
+   *
+   * @return true If the directory exists.
+   */
+  static bool openDirectory(const char* path, 
+    CdBlock::DirectoryHandle *directory);
+
+  // Same as above, path must end with '/' (for example "DATA/"_path).
+  static bool openDirectory(CdBlock::FilePath path, 
+    CdBlock::DirectoryHandle *directory);
+
+  /**
+   * Return the next child of a directory opened with openDirectory.
+   *
+   * @return false Once every child was returned.
+   */
+  static bool readDirectory(CdBlock::DirectoryHandle *directory, 
+    CdBlock::DirectoryEntry *entry);
+
+  /**
+   * Fetch the name hash and size of every file served by the USB host in
+   * a single request. From then on sizes (and whether a file exists) are
+   * answered locally and opening a USB file costs one request instead of
+   * two. Call again after adding, removing or resizing files on the host.
+   *
+   * @return 0 If successful, otherwise the previous index is kept.
+   */
+  static int syncUsbIndex();
+
+  static inline const UsbFileIndex *getUsbIndex() { return &usbIndex; }
+
+  static void getStatistics(FilesystemStatistics *stats);
+  static void resetStatistics();
+
   static CdBlock::FilesystemHeaderTable *getCdBlockHeaderTable() { 
     return &cdHeaderTable; 
   }
@@ -75,9 +393,20 @@ public:
 private:
   static FilesystemBackend defaultBackend;
 
+  static FilesystemStatistics statistics;
+
+  static HeapAllocator heapAllocator;
+  static Allocator *allocator;
+
+  static uint32_t asyncSequence;
+  static AsyncFile asyncRequests[FILESYSTEM_MAX_ASYNC_REQUESTS];
+
   static void* filesystemPtr;
   static CdBlock::FilesystemData cdFilesystemData;
   static CdBlock::FilesystemHeaderTable cdHeaderTable;
+  static CdBlock::DirectoryIndex cdDirectoryIndex;
+
+  static UsbFileIndex usbIndex;
 };
 
 
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+#include <assert.h>
+#include <string.h>
+#include "lzss.h"
+
+namespace Lzss {
+
+
+bool readHeader(const uint8_t *data, LzssHeader *header) {
+  assert(data != nullptr);
+  assert(header != nullptr);
+
+  header->magic = readWord(data);
+  header->originalSize = readWord(data + 4);
+  header->blockSize = readWord(data + 8);
+
+  return header->magic == LZSS_MAGIC && header->blockSize > 0 &&
+    header->blockSize <= LZSS_MAX_BLOCK_SIZE;
+}
+
+void writeHeader(const LzssHeader *header, uint8_t *data) {
+  assert(header != nullptr);
+  assert(data != nullptr);
+
+  const uint32_t words[] = {
+    header->magic, header->originalSize, header->blockSize
+  };
+
+  for (uint32_t i = 0; i < 3; ++i) {
+    data[i * 4] = words[i] >> 24;
+    data[i * 4 + 1] = words[i] >> 16;
+    data[i * 4 + 2] = words[i] >> 8;
+    data[i * 4 + 3] = words[i];
+  }
+}
+
+int decodeBlock(const uint8_t *block, uint8_t *dest, uint32_t size) {
+  assert(block != nullptr);
+  assert(dest != nullptr || size == 0);
+
+  const uint32_t payloadSize = getPayloadSize(block);
+  const uint8_t *src = block + LZSS_BLOCK_HEADER_SIZE;
+  const uint8_t *srcEnd = src + payloadSize;
+
+  if (readWord(block) & LZSS_STORED_BLOCK) {
+    if (payloadSize != size)
+      return -1;
+
+    memcpy(dest, src, size);
+    return 0;
+  }
+
+  uint8_t *out = dest;
+  uint8_t *outEnd = dest + size;
+
+  // Bit 8 tells when the flags byte is used up.
+  uint32_t flags = 0;
+
+  while (out < outEnd) {
+    flags >>= 1;
+    if ((flags & 0x100) == 0) {
+      if (src == srcEnd)
+        return -1;
+
+      flags = *src++ | 0xFF00;
+    }
+
+    if (flags & 1) {
+      if (src == srcEnd)
+        return -1;
+
+      *out++ = *src++;
+      continue;
+    }
+
+    if (srcEnd - src < 2)
+      return -1;
+
+    const uint32_t distance = ((src[0] << 4) | (src[1] >> 4)) + 1;
+    uint32_t matchLength = (src[1] & 0xF) + LZSS_MIN_MATCH;
+    src += 2;
+
+    if (distance > (uint32_t) (out - dest) ||
+      matchLength > (uint32_t) (outEnd - out)) {
+
+      return -1;
+    }
+
+    // Matches may overlap the bytes they produce, copy one at a time.
+    const uint8_t *match = out - distance;
+    while (matchLength-- > 0)
+      *out++ = *match++;
+  }
+
+  return (src == srcEnd) ? 0 : -1;
+}
+
+
+} // namespace Lzss
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+#pragma once
+
+// Kept free of yaul, shared with tools/lzsspack.
+#include <stdint.h>
+
+/**
+ * Compressed container written by tools/lzsspack and recognized by File.
+ * The file is an LzssHeader followed by the blocks, each one holding
+ * blockSize bytes of the original file (the last one may be shorter). A
+ * block is a 32 bit word with the payload size, and LZSS_STORED_BLOCK set
+ * when the payload is a raw copy, followed by the payload. Blocks only
+ * reference their own bytes, so they are decoded as soon as they arrive.
+ * Every field is big endian.
+ */
+#define LZSS_MAGIC 0x4C5A5331 // 'LZS1'
+#define LZSS_STORED_BLOCK 0x80000000
+
+#define LZSS_HEADER_SIZE 12
+#define LZSS_BLOCK_HEADER_SIZE 4
+
+#define LZSS_DEFAULT_BLOCK_SIZE 16384
+#define LZSS_MAX_BLOCK_SIZE 65536
+
+// Payload of compressed blocks: a flags byte (LSB first, 1 for a literal
+// byte, 0 for a match) ahead of every 8 items. A match is 2 bytes,
+// LZSS_WINDOW_BITS of distance - 1 followed by LZSS_LENGTH_BITS of
+// length - LZSS_MIN_MATCH.
+#define LZSS_WINDOW_BITS 12
+#define LZSS_LENGTH_BITS 4
+#define LZSS_WINDOW_SIZE (1 << LZSS_WINDOW_BITS)
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH (LZSS_MIN_MATCH + (1 << LZSS_LENGTH_BITS) - 1)
+
+struct LzssHeader {
+  uint32_t magic;
+
+  // Size of the decoded file.
+  uint32_t originalSize;
+
+  // Decoded size of every block but the last one.
+  uint32_t blockSize;
+};
+
+static_assert(sizeof(LzssHeader) == LZSS_HEADER_SIZE,
+  "LzssHeader size mismatch.");
+
+namespace Lzss {
+
+
+/**
+ * Parse the container header at the start of a file.
+ *
+ * @param data First LZSS_HEADER_SIZE bytes of the file.
+ * @param header Native endian result.
+ *
+ * @return true If data holds a valid header.
+ */
+extern bool readHeader(const uint8_t *data, LzssHeader *header);
+
+/**
+ * Write the header in disc (big endian) order.
+ */
+extern void writeHeader(const LzssHeader *header, uint8_t *data);
+
+/**
+ * Read a big endian 32 bit word, at any alignment.
+ */
+inline uint32_t readWord(const uint8_t *data) {
+  return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+/**
+ * Bytes following the block header of the block starting at data.
+ */
+inline uint32_t getPayloadSize(const uint8_t *block) {
+  return readWord(block) & ~LZSS_STORED_BLOCK;
+}
+
+/**
+ * Decoded size of the given block.
+ */
+inline uint32_t getBlockSize(const LzssHeader *header, uint32_t block) {
+  const uint32_t offset = block * header->blockSize;
+  const uint32_t remainingBytes = header->originalSize - offset;
+
+  return (remainingBytes < header->blockSize) ?
+    remainingBytes : header->blockSize;
+}
+
+inline uint32_t getNumBlocks(const LzssHeader *header) {
+  return (header->originalSize + header->blockSize - 1) / header->blockSize;
+}
+
+/**
+ * Decode a whole block (header and payload).
+ *
+ * @param block Block header followed by getPayloadSize(block) bytes.
+ * @param dest Destination of the decoded bytes.
+ * @param size Decoded size of the block, see getBlockSize.
+ *
+ * @return 0 If the block decoded to exactly size bytes.
+ */
+extern int decodeBlock(const uint8_t *block, uint8_t *dest, uint32_t size);
+
+
+} // namespace Lzss
@@ -19,6 +19,17 @@
 namespace {
 
 
+// Literal paths hash at compile time to the getFilenameHash value, 
+// whatever the HASH_VERSION.
+static_assert("TEST_FILE.TXT"_path.hash == CdBlock::getFilenameHash(
+  "TEST_FILE.TXT", sizeof("TEST_FILE.TXT") - 1), 
+  "Compile time path hash mismatch.");
+
+static_assert("A_FOLDER/ANOTHER_TEST_FILE.TXT"_path.hash == 
+  CdBlock::getFilenameHash("A_FOLDER/ANOTHER_TEST_FILE.TXT", 
+    sizeof("A_FOLDER/ANOTHER_TEST_FILE.TXT") - 1), 
+  "Compile time path hash mismatch.");
+
 void printToBuffer(const char* contents, uint32_t size) {
   static char tmpMsgBuffer[1024];
 
@@ -28,8 +39,8 @@ void printToBuffer(const char* contents, uint32_t size) {
   dbgio_buffer(tmpMsgBuffer);
 }
 
-void printFileContents(const char* filename) {
-  File handle = Filesystem::open(filename);
+void printFileContents(CdBlock::FilePath path) {
+  File handle = Filesystem::open(path);
   printToBuffer(static_cast<const char*>(handle.getData()), 
     handle.size());
 }
@@ -79,20 +90,22 @@ int main(void) {
 
   dbgio_buffer("\nSaturn Drive contents:\n");
   Filesystem::printCdStructure();
+  CdBlock::printHeaderTableMemory(Filesystem::getCdBlockHeaderTable());
 
   // Select between loading from the USB (cd folder) or from the disk itself.
   // Filesystem::setDefaultBackend(FilesystemBackend::USB);
+  // Filesystem::syncUsbIndex();
   Filesystem::setDefaultBackend(FilesystemBackend::CDBLOCK);
 
   char tmpBuffer[1024];
   sprintf(tmpBuffer, "\n\nTEST_FILE.TXT contents:\n");
   dbgio_buffer(tmpBuffer);
 
-  printFileContents("TEST_FILE.TXT");
+  printFileContents("TEST_FILE.TXT"_path);
 
   sprintf(tmpBuffer, "\n\nA_FOLDER/ANOTHER_TEST_FILE.TXT contents:\n");
   dbgio_buffer(tmpBuffer);
-  printFileContents("A_FOLDER/ANOTHER_TEST_FILE.TXT");
+  printFileContents("A_FOLDER/ANOTHER_TEST_FILE.TXT"_path);
 
   dbgio_flush();
   vdp_sync(0);
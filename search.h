@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+#pragma once
+
+// Kept free of yaul, shared by the cd and USB file tables and host tools.
+#include <stdint.h>
+
+namespace CdBlock {
+
+
+/**
+ * Return the first element not less than searchElement, or 
+ * entries + entriesLength if there is none. The loop has no data 
+ * dependent branch and always runs log2(entriesLength) times.
+ */
+template <typename T>
+T *lowerBound(T *entries, uint32_t entriesLength, const T& searchElement) {
+  if (entriesLength == 0)
+    return entries;
+
+  T *base = entries;
+  uint32_t length = entriesLength;
+  while (length > 1) {
+    const uint32_t half = length / 2;
+    base = (base[half] < searchElement) ? base + half : base;
+    length -= half;
+  }
+
+  return (*base < searchElement) ? base + 1 : base;
+}
+
+/**
+ * Set foundEntry to the element equal to searchElement, or nullptr if
+ * there is none.
+ */
+template <typename T>
+void binarySearch(T *entries, uint32_t entriesLength, 
+  T searchElement, T **foundEntry) {
+
+  T *found = lowerBound(entries, entriesLength, searchElement);
+  if (found != entries + entriesLength && *found == searchElement)
+    *foundEntry = found;
+  else
+    *foundEntry = nullptr;
+}
+
+/**
+ * Climb from a node past the end of an Eytzinger tree back to the next
+ * node in sorted order, or 0 if there is none. Every time the descent 
+ * went right (odd index) that subtree is done, the first left turn marks 
+ * the node we are looking for.
+ */
+inline uint32_t eytzingerAscend(uint32_t node) {
+  return node >> __builtin_ffs(~node);
+}
+
+/**
+ * Copy the sorted entries to tree in Eytzinger (breadth first) order, 
+ * using an in-order traversal of the implicit tree. Both tree and 
+ * indices are 1-based and hold entriesLength + 1 elements, indices gets
+ * the position in entries of every node.
+ */
+template <typename T>
+void fillEytzinger(const T *entries, uint32_t entriesLength, T *tree,
+  uint32_t *indices) {
+
+  uint32_t node = 1;
+  for (uint32_t i = 0; ; ++i) {
+    while (node <= entriesLength)
+      node *= 2;
+
+    node = eytzingerAscend(node);
+    if (node == 0)
+      break;
+
+    tree[node] = entries[i];
+    indices[node] = i;
+    node = 2 * node + 1;
+  }
+}
+
+/**
+ * Same result as lowerBound over the entries fillEytzinger was given,
+ * returned as an index. The descent has no data dependent branch, the 
+ * tree is walked down to the leaves and the lower bound recovered from 
+ * the path taken.
+ */
+template <typename T>
+uint32_t eytzingerLowerBound(const T *tree, const uint32_t *indices,
+  uint32_t entriesLength, const T& searchElement) {
+
+  uint32_t node = 1;
+  while (node <= entriesLength)
+    node = 2 * node + (tree[node] < searchElement);
+
+  node = eytzingerAscend(node);
+  return (node != 0) ? indices[node] : entriesLength;
+}
+
+
+
+} // namespace CdBlock
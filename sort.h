@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+#pragma once
+
+// Kept free of yaul, shared by the table builders and host tools.
+#include <assert.h>
+#include <stdint.h>
+
+namespace CdBlock {
+
+
+/**
+ * In-place sorts of arrays of T, which must have operator < (and > for
+ * partition). None of them allocates or recurses, introSort is the one
+ * to call, the others are its building blocks.
+ */
+
+template <typename T>
+void insertionSort(T *entries, uint32_t length) {
+  for (uint32_t i = 1; i < length; ++i) {
+    const T value = entries[i];
+
+    uint32_t j = i;
+    for (; j > 0 && value < entries[j - 1]; --j)
+      entries[j] = entries[j - 1];
+
+    entries[j] = value;
+  }
+}
+
+template <typename T>
+void siftDown(T *entries, uint32_t root, uint32_t length) {
+  const T value = entries[root];
+  for (;;) {
+    uint32_t child = root * 2 + 1;
+    if (child >= length)
+      break;
+
+    if (child + 1 < length && entries[child] < entries[child + 1])
+      child++;
+
+    if (!(value < entries[child]))
+      break;
+
+    entries[root] = entries[child];
+    root = child;
+  }
+
+  entries[root] = value;
+}
+
+template <typename T>
+void heapSort(T *entries, uint32_t length) {
+  for (uint32_t i = length / 2; i > 0; --i)
+    siftDown(entries, i - 1, length);
+
+  for (uint32_t i = length; i > 1; --i) {
+    const T tmp = entries[0];
+    entries[0] = entries[i - 1];
+    entries[i - 1] = tmp;
+
+    siftDown(entries, 0, i - 1);
+  }
+}
+
+/**
+ * Hoare partition around the median of the first, middle and last 
+ * elements. Both returned halves, [0, result] and [result + 1, length),
+ * are non empty.
+ */
+template <typename T>
+uint32_t partition(T *entries, uint32_t length) {
+  const uint32_t middle = (length - 1) / 2;
+  const uint32_t last = length - 1;
+
+  // Order first, middle and last so the middle holds the median.
+  if (entries[middle] < entries[0]) {
+    const T tmp = entries[middle];
+    entries[middle] = entries[0];
+    entries[0] = tmp;
+  }
+
+  if (entries[last] < entries[middle]) {
+    const T tmp = entries[last];
+    entries[last] = entries[middle];
+    entries[middle] = tmp;
+
+    if (entries[middle] < entries[0]) {
+      const T tmp2 = entries[middle];
+      entries[middle] = entries[0];
+      entries[0] = tmp2;
+    }
+  }
+
+  const T pivot = entries[middle];
+  int32_t l = -1;
+  int32_t r = length;
+  for (;;) {
+    do {
+      l++;
+    } while (entries[l] < pivot);
+    
+    do {
+      r--;
+    } while (entries[r] > pivot);
+
+    if (l >= r)
+      return r;
+  
+    // Swap
+    const T tmp = entries[r];
+    entries[r] = entries[l];
+    entries[l] = tmp;
+  }
+}
+
+/**
+ * Introsort without recursion: the larger half of every partition is 
+ * pushed on a fixed stack and the smaller one is sorted right away, so 
+ * at most log2(length) ranges are ever pending. Ranges partitioned too 
+ * many times (adversarial orderings) are finished with heapsort.
+ */
+template <typename T>
+void introSort(T *entries, uint32_t length) {
+  struct Range {
+    uint32_t first;
+    uint32_t length;
+    uint32_t depthLeft;
+  };
+
+  // Ranges shorter than this are insertion sorted.
+  const uint32_t insertionLength = 16;
+
+  uint32_t depthLimit = 0;
+  for (uint32_t i = length; i > 1; i >>= 1)
+    depthLimit += 2;
+
+  Range stack[32];
+  uint32_t stackSize = 0;
+
+  Range range = { 0, length, depthLimit };
+  for (;;) {
+    T *first = entries + range.first;
+
+    if (range.length <= insertionLength) {
+      insertionSort(first, range.length);
+
+    } else if (range.depthLeft == 0) {
+      heapSort(first, range.length);
+
+    } else {
+      assert(stackSize < 32);
+      const uint32_t split = partition(first, range.length) + 1;
+      const uint32_t depthLeft = range.depthLeft - 1;
+
+      Range lower = { range.first, split, depthLeft };
+      Range upper = { range.first + split, range.length - split, depthLeft };
+
+      if (lower.length < upper.length) {
+        stack[stackSize++] = upper;
+        range = lower;
+      } else {
+        stack[stackSize++] = lower;
+        range = upper;
+      }
+
+      continue;
+    }
+
+    if (stackSize == 0)
+      break;
+
+    range = stack[--stackSize];
+  }
+}
+
+
+} // namespace CdBlock
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+/*
+ * Host tool that replays a recorded open/close trace against the File
+ * allocators (allocator.h), to size arenas and pools before trying them
+ * on the Saturn. Every block is filled with a pattern when opened and
+ * checked when closed, so overlapping blocks are reported.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++14 -O2 -I. tools/allocreplay.cpp allocator.cpp \
+ *     -o allocreplay
+ *
+ * Usage:
+ *   allocreplay <trace> heap
+ *   allocreplay <trace> arena <bytes>
+ *   allocreplay <trace> pool <512> <2048> <8192> <32768>
+ *     Number of blocks of each pool class, bigger requests or exhausted
+ *     classes fall back to the heap.
+ *
+ * Trace format, one command per line ('#' starts a comment):
+ *   open <id> <size>   File id opened, size bytes allocated.
+ *   close <id>         File id closed.
+ *   reset              Level change, every file is closed and arenas
+ *                      are reset.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <vector>
+
+#include "allocator.h"
+
+
+namespace {
+
+
+struct Block {
+  uint8_t *ptr;
+  uint32_t size;
+};
+
+void fillBlock(const Block& block, uint32_t id) {
+  for (uint32_t i = 0; i < block.size; ++i)
+    block.ptr[i] = (uint8_t) (id * 31 + i);
+}
+
+bool checkBlock(const Block& block, uint32_t id) {
+  for (uint32_t i = 0; i < block.size; ++i) {
+    if (block.ptr[i] != (uint8_t) (id * 31 + i))
+      return false;
+  }
+
+  return true;
+}
+
+void printStatistics(const char *name, const Allocator *allocator) {
+  AllocatorStatistics stats;
+  allocator->getStatistics(&stats);
+
+  printf("%s: %u allocations, %u failed, %u bytes in use, "
+    "high water mark %u bytes\n", name, stats.numAllocations,
+    stats.failedAllocations, stats.bytesInUse, stats.highWaterMark);
+}
+
+
+} // namespace ''
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s <trace> heap\n"
+                    "       %s <trace> arena <bytes>\n"
+                    "       %s <trace> pool <512> <2048> <8192> <32768>\n",
+                    argv[0], argv[0], argv[0]);
+    return 1;
+  }
+
+  FILE *trace = fopen(argv[1], "r");
+  if (trace == nullptr) {
+    fprintf(stderr, "%s: can't open\n", argv[1]);
+    return 1;
+  }
+
+  HeapAllocator heapAllocator;
+  std::vector<uint8_t> memory;
+  Allocator *allocator = nullptr;
+  ArenaAllocator *arenaAllocator = nullptr;
+
+  if (strcmp(argv[2], "heap") == 0) {
+    allocator = &heapAllocator;
+
+  } else if (strcmp(argv[2], "arena") == 0 && argc == 4) {
+    memory.resize(strtoul(argv[3], nullptr, 0));
+    arenaAllocator = new ArenaAllocator(memory.data(), memory.size());
+    allocator = arenaAllocator;
+
+  } else if (strcmp(argv[2], "pool") == 0 &&
+    argc == 3 + ALLOCATOR_POOL_CLASSES) {
+
+    uint32_t blocksPerClass[ALLOCATOR_POOL_CLASSES];
+    for (uint32_t i = 0; i < ALLOCATOR_POOL_CLASSES; ++i)
+      blocksPerClass[i] = strtoul(argv[3 + i], nullptr, 0);
+
+    memory.resize(PoolAllocator::getPoolSize(blocksPerClass));
+    allocator = new PoolAllocator(memory.data(), blocksPerClass,
+      &heapAllocator);
+
+  } else {
+    fprintf(stderr, "Unknown allocator %s\n", argv[2]);
+    return 1;
+  }
+
+  std::map<uint32_t, Block> openFiles;
+  uint32_t lineNumber = 0;
+  uint32_t corruptedBlocks = 0;
+  char line[256];
+
+  auto closeFile = [&](std::map<uint32_t, Block>::iterator file) {
+    if (!checkBlock(file->second, file->first)) {
+      printf("line %u: file %u was overwritten\n", lineNumber, file->first);
+      corruptedBlocks++;
+    }
+
+    allocator->release(file->second.ptr, file->second.size);
+    openFiles.erase(file);
+  };
+
+  while (fgets(line, sizeof(line), trace) != nullptr) {
+    lineNumber++;
+
+    char command[16];
+    uint32_t id = 0;
+    uint32_t size = 0;
+
+    if (line[0] == '#' || sscanf(line, "%15s", command) != 1)
+      continue;
+
+    if (strcmp(command, "open") == 0 &&
+      sscanf(line, "%*s %u %u", &id, &size) == 2) {
+
+      if (openFiles.count(id) != 0) {
+        fprintf(stderr, "line %u: file %u already open\n", lineNumber, id);
+        return 1;
+      }
+
+      Block block = { (uint8_t*) allocator->allocate(size), size };
+      if (block.ptr == nullptr) {
+        printf("line %u: out of memory opening file %u (%u bytes)\n",
+          lineNumber, id, size);
+        continue;
+      }
+
+      fillBlock(block, id);
+      openFiles[id] = block;
+
+    } else if (strcmp(command, "close") == 0 &&
+      sscanf(line, "%*s %u", &id) == 1) {
+
+      auto file = openFiles.find(id);
+      if (file != openFiles.end())
+        closeFile(file);
+
+    } else if (strcmp(command, "reset") == 0) {
+      while (!openFiles.empty())
+        closeFile(openFiles.begin());
+
+      if (arenaAllocator != nullptr)
+        arenaAllocator->reset();
+
+    } else {
+      fprintf(stderr, "line %u: unknown command\n", lineNumber);
+      return 1;
+    }
+  }
+
+  fclose(trace);
+
+  printStatistics(argv[2], allocator);
+  if (allocator != &heapAllocator)
+    printStatistics("heap", &heapAllocator);
+
+  printf("%u corrupted blocks\n", corruptedBlocks);
+
+  if (allocator != &heapAllocator)
+    delete allocator;
+
+  return corruptedBlocks != 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+/*
+ * Host tool that searches paths whose filename hashes collide, builds a
+ * disc image holding them (with the drive simulated by tools/host) and
+ * checks every file still resolves to its own contents: through
+ * Filesystem, and through the tables of every header table builder with
+ * every lookup structure. The hash-only lookups, which can't tell the
+ * colliding files apart, must return the file kept in the main table.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++14 -g -O1 -fsanitize=address,undefined -Itools/host -I. \
+ *     tools/collisioncheck.cpp tools/host/hostsaturn.cpp \
+ *     tools/host/isoimage.cpp allocator.cpp cdblock.cpp crc32.cpp \
+ *     filesystem.cpp lzss.cpp usbtransfer.cpp -o collisioncheck
+ *
+ * Pass the same -DHASH_VERSION as the Saturn build.
+ *
+ * Usage:
+ *   collisioncheck [pairs]
+ *     Number of colliding pairs on the disc, 3 by default. They are
+ *     spread over the root, a subdirectory and across both. Exits 0 if
+ *     every check passed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "filesystem.h"
+#include "host/hostsaturn.h"
+#include "host/isoimage.h"
+
+
+namespace {
+
+
+uint32_t numFailures = 0;
+
+void fail(const std::string& path, const char *what) {
+  fprintf(stderr, "%s: %s\n", path.c_str(), what);
+  numFailures++;
+}
+
+/**
+ * Random 8.3 name, in the directory of the given index (0 is the root).
+ */
+std::string makePath(std::mt19937 *random, uint32_t directory) {
+  const char characters[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+  std::string path = (directory == 0) ? "" : "SUB/";
+  for (uint32_t i = 0; i < 8; ++i)
+    path += characters[(*random)() % (sizeof(characters) - 1)];
+
+  return path + ".BIN";
+}
+
+uint32_t getHash(const std::string& path) {
+  return CdBlock::getFilenameHash(path.c_str(), path.size());
+}
+
+/**
+ * Pairs of paths sharing a filename hash (and not the secondary one).
+ * Pairs 0, 1 and 2 are in the root, in SUB and across both, then again.
+ */
+std::vector<std::string> findCollisions(uint32_t numPairs) {
+  std::mt19937 random(1);
+  std::vector<std::string> paths;
+
+  for (uint32_t pair = 0; pair < numPairs; ++pair) {
+    const uint32_t firstDirectory = (pair % 3 == 1) ? 1 : 0;
+    const uint32_t secondDirectory = (pair % 3 == 0) ? 0 : 1;
+
+    // Birthday search, about 2^16 paths of each directory per pair.
+    std::unordered_map<uint32_t, std::string> seen;
+    for (;;) {
+      const std::string first = makePath(&random, firstDirectory);
+      seen.emplace(getHash(first), first);
+
+      const std::string second = makePath(&random, secondDirectory);
+      auto found = seen.find(getHash(second));
+      if (found == seen.end() || found->second == second)
+        continue;
+
+      const std::string& other = found->second;
+      if (CdBlock::getSecondaryFilenameHash(other.c_str(), other.size()) ==
+        CdBlock::getSecondaryFilenameHash(second.c_str(), second.size())) {
+
+        continue;
+      }
+
+      paths.push_back(other);
+      paths.push_back(second);
+      break;
+    }
+  }
+
+  return paths;
+}
+
+/**
+ * Entry the hash-only lookup of table gives, which must be the one of the
+ * colliding files kept in the main table.
+ */
+void checkMainEntry(const char *name, CdBlock::FilesystemHeaderTable *table,
+  const IsoImageFile& first, const IsoImageFile& second) {
+
+  CdBlock::FilesystemEntry entry;
+  CdBlock::FilesystemEntry firstEntry;
+  CdBlock::FilesystemEntry secondEntry;
+
+  if (!CdBlock::getFileEntry(table, getHash(first.path), &entry) ||
+    !CdBlock::getFileEntry(table,
+      Filesystem::getFilePath(first.path.c_str()), &firstEntry) ||
+    !CdBlock::getFileEntry(table,
+      Filesystem::getFilePath(second.path.c_str()), &secondEntry)) {
+
+    fail(first.path, name);
+    return;
+  }
+
+  if (entry.lba != firstEntry.lba && entry.lba != secondEntry.lba)
+    fail(first.path, name);
+}
+
+/**
+ * Every file must be found in table, with every lookup structure, at the
+ * position the table of Filesystem::initialize gives. Frees table.
+ */
+void checkHeaderTable(const char *name, CdBlock::FilesystemHeaderTable *table,
+  const std::vector<IsoImageFile>& files) {
+
+  CdBlock::FilesystemHeaderTable *reference =
+    Filesystem::getCdBlockHeaderTable();
+
+  if (table->numCollisions != reference->numCollisions)
+    fail(name, "header table holds other collisions");
+
+  const CdBlock::HeaderTableLookup lookups[] = {
+    CdBlock::HeaderTableLookup::BINARY_SEARCH,
+    CdBlock::HeaderTableLookup::EYTZINGER
+  };
+
+  for (CdBlock::HeaderTableLookup lookup : lookups) {
+    if (CdBlock::buildHeaderTableLookup(table, lookup) != 0)
+      fail(name, "can't build the lookup");
+
+    for (const IsoImageFile& file : files) {
+      const CdBlock::FilePath path =
+        Filesystem::getFilePath(file.path.c_str());
+
+      CdBlock::FilesystemEntry entry;
+      CdBlock::FilesystemEntry expected;
+      if (!CdBlock::getFileEntry(table, path, &entry) ||
+        !CdBlock::getFileEntry(reference, path, &expected) ||
+        entry.size != file.data.size() || entry.lba != expected.lba) {
+
+        fail(file.path, name);
+      }
+    }
+
+    for (uint32_t i = 0; i + 1 < files.size(); i += 2)
+      checkMainEntry(name, table, files[i], files[i + 1]);
+  }
+
+  free(table->hashes);
+  free(table->collisions);
+  free(table->lookupHashes);
+}
+
+void checkHeaderTables(const std::vector<IsoImageFile>& files) {
+  CdBlock::FilesystemData fsData;
+  if (CdBlock::readFilesystem(&fsData) != 0) {
+    fail("", "can't read the filesystem");
+    return;
+  }
+
+  CdBlock::FilesystemHeaderTable table = {};
+  table.hashes = (uint32_t*) malloc(CdBlock::getHeaderTableSize(&fsData));
+  CdBlock::fillHeaderTable(&fsData, &table);
+  checkHeaderTable("wrong entry in the filled table", &table, files);
+
+  table = {};
+  if (CdBlock::buildHeaderTable(&fsData, &table) != 0)
+    fail("", "can't build the header table");
+  else
+    checkHeaderTable("wrong entry in the walk table", &table, files);
+
+  table = {};
+  if (CdBlock::buildHeaderTableFromPathTable(&fsData, &table) != 0)
+    fail("", "can't build the header table from the path table");
+  else
+    checkHeaderTable("wrong entry in the path table table", &table, files);
+}
+
+/**
+ * Files of Filesystem, by path and, for the size, by hash alone.
+ */
+void checkFiles(const std::vector<IsoImageFile>& files) {
+  for (const IsoImageFile& file : files) {
+    if (Filesystem::getFileSize(file.path.c_str()) != file.data.size())
+      fail(file.path, "size differs");
+
+    File loaded = Filesystem::open(file.path.c_str());
+    if (loaded.size() != file.data.size() ||
+      memcmp(loaded.getData(), file.data.data(), file.data.size()) != 0) {
+
+      fail(file.path, "loaded contents differ");
+    }
+
+    loaded.close();
+  }
+
+  CdBlock::FilesystemHeaderTable *table = Filesystem::getCdBlockHeaderTable();
+  for (uint32_t i = 0; i + 1 < files.size(); i += 2) {
+    const uint32_t hash = getHash(files[i].path);
+
+    CdBlock::FilesystemEntry entry;
+    if (!CdBlock::getFileEntry(table, hash, &entry) ||
+      Filesystem::getFileSize(hash) != entry.size) {
+
+      fail(files[i].path, "size by hash isn't the main table one");
+    }
+  }
+}
+
+
+} // namespace ''
+
+int main(int argc, char **argv) {
+  const uint32_t numPairs = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 3;
+  if (argc > 2 || numPairs == 0) {
+    fprintf(stderr, "Usage: %s [pairs]\n", argv[0]);
+    return 1;
+  }
+
+  // Sizes differ, so a file resolved to its pair is caught by size too.
+  std::vector<IsoImageFile> files;
+  for (const std::string& path : findCollisions(numPairs)) {
+    IsoImageFile file;
+    file.path = path;
+    file.data.resize(100 + 2100 * files.size());
+
+    for (uint32_t i = 0; i < file.data.size(); ++i)
+      file.data[i] = (uint8_t) (i * 31 + files.size());
+
+    printf("%08x %s\n", getHash(path), path.c_str());
+    files.push_back(file);
+  }
+
+  std::vector<uint8_t> image = IsoImage::build(files);
+  HostSaturn::setDiscImage(&image);
+
+  Filesystem::initialize();
+  Filesystem::setDefaultBackend(FilesystemBackend::CDBLOCK);
+  if (Filesystem::getCdBlockHeaderTable()->numCollisions != 2 * numPairs)
+    fail("", "collisions not moved out of the main table");
+
+  checkFiles(files);
+  checkHeaderTables(files);
+
+  printf("%zu files, %u failures\n", files.size(), numFailures);
+  return numFailures != 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+/*
+ * Host tool that checks crc32_update against reference vectors and a bit
+ * at a time implementation (fed in every possible split), then times it
+ * against the CRC-8 of crc.h.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++14 -O2 -I. tools/crcbench.cpp crc.cpp crc32.cpp -o crcbench
+ *
+ * Add -DCRC32_SLICES=1 or 8 to time the other table sizes.
+ *
+ * Usage:
+ *   crcbench [megabytes]
+ *     Size of the timed buffer, 16MB by default.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "crc.h"
+#include "crc32.h"
+
+
+namespace {
+
+
+struct ReferenceVector {
+  const char *data;
+  crc32_t crc;
+};
+
+const ReferenceVector referenceVectors[] = {
+  { "", 0x00000000 },
+  { "a", 0xe8b7be43 },
+  { "abc", 0x352441c2 },
+  { "123456789", 0xcbf43926 },
+  { "message digest", 0x20159d7f },
+  { "abcdefghijklmnopqrstuvwxyz", 0x4c2750bd },
+  { "The quick brown fox jumps over the lazy dog", 0x414fa339 }
+};
+
+crc32_t crc32Bitwise(const unsigned char *data, size_t length) {
+  crc32_t crc = crc32_init();
+
+  for (size_t i = 0; i < length; ++i) {
+    crc ^= data[i];
+    for (uint32_t bit = 0; bit < 8; ++bit)
+      crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+  }
+
+  return crc32_finalize(crc);
+}
+
+bool checkReferenceVectors() {
+  bool ok = true;
+
+  for (const ReferenceVector& vector : referenceVectors) {
+    const crc32_t crc = crc32_finalize(crc32_update(crc32_init(),
+      (const unsigned char*) vector.data, strlen(vector.data)));
+
+    if (crc != vector.crc) {
+      printf("\"%s\": %08x, expected %08x\n", vector.data, crc, vector.crc);
+      ok = false;
+    }
+  }
+
+  return ok;
+}
+
+/**
+ * Every length up to 64 bytes, at every alignment, fed in two parts split
+ * at every point.
+ */
+bool checkSplits() {
+  unsigned char data[72];
+  for (uint32_t i = 0; i < sizeof(data); ++i)
+    data[i] = (uint8_t) (i * 2654435761u >> 24);
+
+  for (uint32_t offset = 0; offset < 8; ++offset) {
+    for (uint32_t length = 0; length <= 64; ++length) {
+      const unsigned char *start = data + offset;
+      const crc32_t expected = crc32Bitwise(start, length);
+
+      for (uint32_t split = 0; split <= length; ++split) {
+        crc32_t crc = crc32_update(crc32_init(), start, split);
+        crc = crc32_update(crc, start + split, length - split);
+
+        if (crc32_finalize(crc) != expected) {
+          printf("offset %u length %u split %u: mismatch\n", offset, length,
+            split);
+
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+template <typename F>
+double timeMegabytesPerSecond(const std::vector<unsigned char>& buffer,
+  F function) {
+
+  const auto start = std::chrono::steady_clock::now();
+  function();
+
+  const std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  return buffer.size() / elapsed.count() / (1024 * 1024);
+}
+
+
+} // namespace ''
+
+int main(int argc, char **argv) {
+  const uint32_t megabytes = (argc > 1) ? strtoul(argv[1], nullptr, 0) : 16;
+
+  const bool vectorsOk = checkReferenceVectors();
+  const bool splitsOk = checkSplits();
+  printf("reference vectors: %s\n", vectorsOk ? "ok" : "FAILED");
+  printf("incremental splits: %s\n", splitsOk ? "ok" : "FAILED");
+
+  std::vector<unsigned char> buffer(megabytes * 1024 * 1024);
+  for (size_t i = 0; i < buffer.size(); ++i)
+    buffer[i] = (uint8_t) (i * 2654435761u >> 24);
+
+  volatile uint32_t sink = 0;
+
+  const double crc8Speed = timeMegabytesPerSecond(buffer, [&]() {
+    sink = crc_finalize(crc_update(crc_init(), buffer.data(),
+      buffer.size()));
+  });
+
+  const double crc32Speed = timeMegabytesPerSecond(buffer, [&]() {
+    sink = crc32_finalize(crc32_update(crc32_init(), buffer.data(),
+      buffer.size()));
+  });
+
+  (void) sink;
+  printf("crc-8:                %8.1f MB/s\n", crc8Speed);
+  printf("crc-32 slicing-by-%u:  %8.1f MB/s\n", CRC32_SLICES, crc32Speed);
+
+  return (vectorsOk && splitsOk) ? 0 : 1;
+}
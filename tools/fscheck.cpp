@@ -0,0 +1,1100 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+/*
+ * Host tool that runs the cd-block side of Filesystem over a disc image,
+ * with the drive simulated by tools/host, and checks every way of reading
+ * a file against the cd directory the image was made from. Built with
+ * the sanitizers, as below, it doubles as the memory check of cdblock.cpp
+ * and filesystem.cpp.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++14 -g -O1 -fsanitize=address,undefined -Itools/host -I. \
+ *     tools/fscheck.cpp tools/host/hostsaturn.cpp tools/host/isoimage.cpp \
+ *     allocator.cpp cdblock.cpp crc32.cpp filesystem.cpp lzss.cpp \
+ *     usbtransfer.cpp -o fscheck
+ *
+ * Pass the same -DHASH_VERSION as the Saturn build.
+ *
+ * Usage:
+ *   fscheck <cd directory> [image.iso]
+ *     Check image.iso, or an image built in memory from the directory,
+ *     against the files of the directory: their sizes, whole loads, loads
+ *     into caller memory, streamed reads and random seeks (with the sector
+ *     cache cold and warm, and the prefetch window off and on), batched
+ *     and asynchronous loads, and the listing of every directory. Header
+ *     tables are built again by the other builders and must agree with
+ *     the one Filesystem::initialize made, searched with every lookup
+ *     structure (see CdBlock::HeaderTableLookup). Path hashes appended to
+ *     the hash of each parent directory must equal the hash of the whole
+ *     path. Files FILES.IDX marks as packed (see tools/mkindex) must load
+ *     decoded and fail every read that can't decode them. Exits 0 if
+ *     every check passed.
+ *
+ *     An image holding a FILES.IDX must have been patched by mkindex, its
+ *     index has to be the one Filesystem::initialize loads. To check a 
+ *     packed disc through its index, LOADED files decoding the containers
+ *     it marks:
+ *       lzsspack -l packed.txt cd packed
+ *       mkindex placeholder packed
+ *       mkimage packed packed.iso
+ *       mkindex patch packed.iso packed.txt
+ *       fscheck packed packed.iso
+ *
+ *     Reads are also timed with the latency of the simulated drive (see
+ *     HostDriveTiming) and reported:
+ *       file    Drive commands and bytes copied out of intermediate
+ *               buffers to load each file, with the sector cache cold.
+ *       boot    Drive reads of the boot of main.cpp followed by a level
+ *               load (every file, then the boot files again), with the
+ *               sector cache off and on.
+ *       stream  Effective throughput of streaming the largest file, with
+ *               the prefetch window off and on.
+ *       batch   Seeks and time of loading every file in a shuffled order,
+ *               one at a time and through Filesystem::loadBatch.
+ *       async   Worst drive time spent in a tick (frame) loading every
+ *               file with a blocking open per tick, and with openAsync.
+ *       table   Memory of the header table of Filesystem::initialize,
+ *               kept and at peak while building it, the peak per 1000
+ *               files of building a 20000 file disc, then the drive reads
+ *               of building it: counting the files and filling the table
+ *               (the walk done twice before a single walk replaced
+ *               them), the single walk, and the sweep of the directories
+ *               listed by the path table.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "fileindex.h"
+#include "filesystem.h"
+#include "lzss.h"
+#include "host/hostsaturn.h"
+#include "host/isoimage.h"
+
+
+namespace {
+
+
+uint32_t numFailures = 0;
+
+void fail(const std::string& path, const char *what) {
+  fprintf(stderr, "%s: %s\n", path.c_str(), what);
+  numFailures++;
+}
+
+/**
+ * An image given with a FILES.IDX has been through mkindex patch, whose
+ * index Filesystem::initialize must have loaded. The directory holds the
+ * placeholder, the other checks get the index of the image instead.
+ */
+void checkIndex(std::vector<IsoImageFile> *files) {
+  auto index = std::find_if(files->begin(), files->end(),
+    [](const IsoImageFile& file) { return file.path == FILE_INDEX_FILENAME; });
+
+  if (index == files->end())
+    return;
+
+  File patched = Filesystem::open(index->path.c_str(), index->data.data());
+  patched.close();
+
+  CdBlock::FilesystemHeaderTable *table = Filesystem::getCdBlockHeaderTable();
+  if (!table->knowsPackedFiles) {
+    fail(index->path, "index of the image was not loaded");
+    return;
+  }
+
+  printf("%s: %u files, %u packed\n", FILE_INDEX_FILENAME, table->numEntries,
+    table->numPackedFiles);
+}
+
+/**
+ * Return true if FILES.IDX marked the file as an LZSS container.
+ */
+bool isPacked(const IsoImageFile& file) {
+  CdBlock::FilesystemHeaderTable *table = Filesystem::getCdBlockHeaderTable();
+  CdBlock::FilesystemEntry entry;
+
+  return table->knowsPackedFiles && CdBlock::getFileEntry(table,
+    Filesystem::getFilePath(file.path.c_str()), &entry) &&
+    CdBlock::isPackedFile(table, entry.filenameHash);
+}
+
+/**
+ * Contents File reads for a file of the directory, the containers 
+ * FILES.IDX marks are decoded by LOADED files.
+ */
+std::vector<uint8_t> getLoadedContents(const IsoImageFile& file) {
+  const std::vector<uint8_t>& data = file.data;
+
+  LzssHeader header;
+  if (!isPacked(file) || data.size() < LZSS_HEADER_SIZE ||
+    !Lzss::readHeader(data.data(), &header)) {
+
+    return data;
+  }
+
+  std::vector<uint8_t> contents(header.originalSize);
+  uint32_t offset = LZSS_HEADER_SIZE;
+
+  for (uint32_t i = 0; i < Lzss::getNumBlocks(&header); ++i) {
+    const uint32_t blockSize = Lzss::getBlockSize(&header, i);
+    if (offset + LZSS_BLOCK_HEADER_SIZE > data.size() ||
+      Lzss::decodeBlock(data.data() + offset,
+        contents.data() + i * header.blockSize, blockSize) != 0) {
+
+      return data;
+    }
+
+    offset += LZSS_BLOCK_HEADER_SIZE +
+      Lzss::getPayloadSize(data.data() + offset);
+  }
+
+  return contents;
+}
+
+void checkLoaded(const IsoImageFile& file) {
+  const std::vector<uint8_t> contents = getLoadedContents(file);
+
+  File loaded = Filesystem::open(file.path.c_str());
+  if (loaded.size() != contents.size() ||
+    memcmp(loaded.getData(), contents.data(), contents.size()) != 0) {
+
+    fail(file.path, "loaded contents differ");
+  }
+
+  loaded.close();
+
+  // Caller memory gets the file as it is on the disc.
+  std::vector<uint8_t> buffer(file.data.size() + 1, 0xA5);
+  File placed = Filesystem::open(file.path.c_str(), buffer.data());
+
+  if (placed.size() != file.data.size() ||
+    memcmp(buffer.data(), file.data.data(), file.data.size()) != 0) {
+
+    fail(file.path, "contents loaded into caller memory differ");
+  }
+
+  if (buffer.back() != 0xA5)
+    fail(file.path, "load into caller memory overran the file size");
+
+  placed.close();
+}
+
+void checkStreamed(const IsoImageFile& file, std::mt19937 *random) {
+  const uint32_t size = file.data.size();
+  std::vector<uint8_t> buffer(size);
+
+  File streamed = Filesystem::open(file.path.c_str(),
+    FilesystemBackend::AUTO, FileMode::STREAMED);
+
+  if (streamed.size() != size) {
+    fail(file.path, "streamed size differs");
+    streamed.close();
+    return;
+  }
+
+  // Odd chunks, to cross sector and ring boundaries at every offset.
+  uint32_t offset = 0;
+  while (offset < size) {
+    const uint32_t chunk = std::min<uint32_t>(size - offset, 1237);
+    if (streamed.readData(buffer.data() + offset, chunk) != chunk)
+      break;
+
+    offset += chunk;
+  }
+
+  if (offset != size || buffer != file.data)
+    fail(file.path, "streamed contents differ");
+
+  for (uint32_t i = 0; i < 32 && size > 0; ++i) {
+    const uint32_t start = (*random)() % size;
+    const uint32_t length = 1 + (*random)() % std::min<uint32_t>(
+      size - start, 3 * 2048);
+
+    streamed.seek(SEEK_SET, start);
+    if (streamed.readData(buffer.data(), length) != length ||
+      memcmp(buffer.data(), file.data.data() + start, length) != 0) {
+
+      fail(file.path, "random seek read differs");
+      break;
+    }
+  }
+
+  streamed.close();
+}
+
+void checkFiles(const std::vector<IsoImageFile>& files) {
+  std::mt19937 random(1);
+
+  for (const IsoImageFile& file : files) {
+    if (Filesystem::getFileSize(file.path.c_str()) != file.data.size())
+      fail(file.path, "size differs");
+
+    checkLoaded(file);
+
+    // Packed files can't be streamed, see checkPacked.
+    if (!isPacked(file))
+      checkStreamed(file, &random);
+  }
+}
+
+/**
+ * Load every file with Filesystem::loadBatch, in batches of requests in
+ * reverse order, so each batch has to be sorted by LBA.
+ */
+void checkBatches(const std::vector<IsoImageFile>& files) {
+  const uint32_t batchSize = 7;
+
+  for (uint32_t first = 0; first < files.size(); first += batchSize) {
+    const uint32_t numRequests =
+      std::min<uint32_t>(files.size() - first, batchSize);
+
+    std::vector<std::vector<uint8_t>> buffers(numRequests);
+    std::vector<FileLoadRequest> requests;
+
+    for (uint32_t i = 0; i < numRequests; ++i) {
+      const IsoImageFile& file = files[first + numRequests - 1 - i];
+      buffers[i].assign(file.data.size() + 1, 0xA5);
+      requests.push_back({ Filesystem::getFilePath(file.path.c_str()),
+        buffers[i].data() });
+    }
+
+    if (Filesystem::loadBatch(requests.data(), numRequests) != 0) {
+      fail(files[first].path, "batch load failed");
+      continue;
+    }
+
+    for (uint32_t i = 0; i < numRequests; ++i) {
+      const IsoImageFile& file = files[first + numRequests - 1 - i];
+      if (memcmp(buffers[i].data(), file.data.data(), file.data.size()) != 0)
+        fail(file.path, "batch loaded contents differ");
+
+      if (buffers[i].back() != 0xA5)
+        fail(file.path, "batch load overran the file size");
+    }
+  }
+
+  // A missing file fails the whole batch before anything is read.
+  uint8_t buffer = 0;
+  const FileLoadRequest missing[] = {
+    { Filesystem::getFilePath(files[0].path.c_str()), &buffer },
+    { Filesystem::getFilePath("NOT/ON/THE/DISC.BIN"), &buffer }
+  };
+
+  if (Filesystem::loadBatch(missing, 2) == 0)
+    fail("NOT/ON/THE/DISC.BIN", "batch with a missing file loaded");
+}
+
+void countFinished(AsyncFile*, void *userData) {
+  (*(uint32_t*) userData)++;
+}
+
+/**
+ * Load every file with Filesystem::openAsync, filling every request slot
+ * and updating with a budget smaller than a sector, so requests finish
+ * over many updates. A missing file must fail through the callback.
+ */
+void checkAsync(const std::vector<IsoImageFile>& files) {
+  for (uint32_t first = 0; first < files.size();
+    first += FILESYSTEM_MAX_ASYNC_REQUESTS) {
+
+    const uint32_t numRequests = std::min<uint32_t>(files.size() - first,
+      FILESYSTEM_MAX_ASYNC_REQUESTS);
+
+    std::vector<std::vector<uint8_t>> buffers(numRequests);
+    std::vector<AsyncFile*> requests(numRequests);
+    uint32_t numFinished = 0;
+    uint32_t numBytes = 0;
+
+    for (uint32_t i = 0; i < numRequests; ++i) {
+      const IsoImageFile& file = files[first + i];
+      numBytes += file.data.size();
+      buffers[i].assign(file.data.size() + 1, 0xA5);
+      requests[i] = Filesystem::openAsync(file.path.c_str(),
+        buffers[i].data(), countFinished, &numFinished);
+
+      if (requests[i] == nullptr)
+        fail(file.path, "no free asynchronous request slot");
+    }
+
+    // Bounded, a request that never finishes must not hang the check.
+    for (uint32_t update = 0; numFinished < numRequests &&
+      update <= numBytes / 1000 + numRequests; ++update) {
+
+      Filesystem::updateAsync(1000);
+    }
+
+    for (uint32_t i = 0; i < numRequests; ++i) {
+      const IsoImageFile& file = files[first + i];
+      if (requests[i] == nullptr)
+        continue;
+
+      const AsyncFile *request = requests[i];
+      if (request->status() != AsyncStatus::DONE ||
+        request->size() != file.data.size() ||
+        memcmp(buffers[i].data(), file.data.data(), file.data.size()) != 0) {
+
+        fail(file.path, "asynchronous load differs");
+      }
+
+      if (buffers[i].back() != 0xA5)
+        fail(file.path, "asynchronous load overran the file size");
+
+      requests[i]->release();
+    }
+
+    if (numFinished != numRequests)
+      fail(files[first].path, "asynchronous callbacks missing");
+  }
+
+  uint8_t buffer = 0;
+  uint32_t numFinished = 0;
+  AsyncFile *missing = Filesystem::openAsync("NOT/ON/THE/DISC.BIN", &buffer,
+    countFinished, &numFinished);
+
+  if (missing == nullptr) {
+    fail("NOT/ON/THE/DISC.BIN", "no asynchronous request for missing file");
+    return;
+  }
+
+  Filesystem::updateAsync();
+  if (missing->status() != AsyncStatus::FAILED || numFinished != 1)
+    fail("NOT/ON/THE/DISC.BIN", "asynchronous load of missing file");
+
+  missing->release();
+}
+
+/**
+ * Batched and asynchronous loads of a packed file must fail rather than
+ * return the container.
+ */
+void checkPacked(const std::vector<IsoImageFile>& files) {
+  for (const IsoImageFile& file : files) {
+    if (!isPacked(file))
+      continue;
+
+    std::vector<uint8_t> buffer(file.data.size());
+    const FileLoadRequest request = {
+      Filesystem::getFilePath(file.path.c_str()), buffer.data() };
+
+    if (Filesystem::loadBatch(&request, 1) == 0)
+      fail(file.path, "batch with a packed file loaded");
+
+    uint32_t numFinished = 0;
+    AsyncFile *async = Filesystem::openAsync(file.path.c_str(),
+      buffer.data(), countFinished, &numFinished);
+
+    if (async == nullptr) {
+      fail(file.path, "no asynchronous request for packed file");
+      continue;
+    }
+
+    Filesystem::updateAsync();
+    if (async->status() != AsyncStatus::FAILED || numFinished != 1)
+      fail(file.path, "asynchronous load of packed file");
+
+    async->release();
+  }
+}
+
+/**
+ * Listing of every directory holding files, compared to the paths.
+ */
+void checkDirectories(const std::vector<IsoImageFile>& files) {
+  struct Child {
+    bool isDirectory;
+    uint32_t size;
+  };
+
+  std::map<std::string, std::map<std::string, Child>> expected;
+  for (const IsoImageFile& file : files) {
+    size_t start = 0;
+    for (;;) {
+      const size_t end = file.path.find('/', start);
+      const std::string parent = file.path.substr(0, start);
+      const std::string name = file.path.substr(start, end - start);
+
+      if (end == std::string::npos) {
+        expected[parent][name] = { false, (uint32_t) file.data.size() };
+        break;
+      }
+
+      expected[parent][name] = { true, 0 };
+      start = end + 1;
+    }
+  }
+
+  for (const auto& directory : expected) {
+    CdBlock::DirectoryHandle handle;
+    if (!Filesystem::openDirectory(directory.first.c_str(), &handle)) {
+      fail(directory.first, "directory not found");
+      continue;
+    }
+
+    std::set<std::string> listed;
+    CdBlock::DirectoryEntry entry;
+
+    while (Filesystem::readDirectory(&handle, &entry)) {
+      const std::string name(entry.name, entry.nameLength);
+      const auto child = directory.second.find(name);
+
+      if (child == directory.second.end() ||
+        child->second.isDirectory != entry.isDirectory ||
+        (!entry.isDirectory && child->second.size != entry.size)) {
+
+        fail(directory.first + name, "listed wrong");
+      }
+
+      listed.insert(name);
+    }
+
+    if (listed.size() != directory.second.size())
+      fail(directory.first, "listing misses children");
+  }
+}
+
+/**
+ * Every file must be found in table with its size, at the place the table
+ * of Filesystem::initialize gives, with every lookup structure. Hashes
+ * between them must not be found. Frees table.
+ */
+void checkHeaderTable(const char *name, CdBlock::FilesystemHeaderTable *table,
+  const std::vector<IsoImageFile>& files) {
+
+  CdBlock::FilesystemHeaderTable *reference =
+    Filesystem::getCdBlockHeaderTable();
+
+  if (table->numEntries != reference->numEntries ||
+    table->numCollisions != reference->numCollisions) {
+
+    fail(name, "header table holds other entries");
+  }
+
+  const CdBlock::HeaderTableLookup lookups[] = {
+    CdBlock::HeaderTableLookup::BINARY_SEARCH,
+    CdBlock::HeaderTableLookup::EYTZINGER
+  };
+
+  for (CdBlock::HeaderTableLookup lookup : lookups) {
+    if (CdBlock::buildHeaderTableLookup(table, lookup) != 0)
+      fail(name, "can't build the lookup");
+
+    for (const IsoImageFile& file : files) {
+      const CdBlock::FilePath path =
+        Filesystem::getFilePath(file.path.c_str());
+
+      CdBlock::FilesystemEntry entry;
+      CdBlock::FilesystemEntry expected;
+      if (!CdBlock::getFileEntry(table, path, &entry) ||
+        !CdBlock::getFileEntry(reference, path, &expected) ||
+        entry.size != file.data.size() || entry.lba != expected.lba) {
+
+        fail(file.path, name);
+      }
+    }
+
+    for (uint32_t i = 0; i <= table->numEntries; ++i) {
+      const uint32_t hash = (i < table->numEntries) ?
+        table->hashes[i] + 1 : 0;
+
+      CdBlock::FilesystemEntry entry;
+      if (!std::binary_search(table->hashes,
+          table->hashes + table->numEntries, hash) &&
+        CdBlock::getFileEntry(table, hash, &entry)) {
+
+        fail(name, "found a hash not in the table");
+        break;
+      }
+    }
+  }
+
+  free(table->hashes);
+  free(table->collisions);
+  free(table->lookupHashes);
+}
+
+void checkHeaderTables(const std::vector<IsoImageFile>& files) {
+  CdBlock::FilesystemData fsData;
+  if (CdBlock::readFilesystem(&fsData) != 0) {
+    fail("", "can't read the filesystem");
+    return;
+  }
+
+  CdBlock::FilesystemHeaderTable table = {};
+  table.hashes = (uint32_t*) malloc(CdBlock::getHeaderTableSize(&fsData));
+  CdBlock::fillHeaderTable(&fsData, &table);
+  checkHeaderTable("entry missing from the filled table", &table, files);
+
+  table = {};
+  if (CdBlock::buildHeaderTable(&fsData, &table) != 0)
+    fail("", "can't build the header table");
+  else
+    checkHeaderTable("entry missing from the walk table", &table, files);
+
+  table = {};
+  if (CdBlock::buildHeaderTableFromPathTable(&fsData, &table) != 0)
+    fail("", "can't build the header table from the path table");
+  else
+    checkHeaderTable("entry missing from the path table table", &table, files);
+}
+
+/**
+ * Directory lookups append names to the hash of their parent, which must
+ * give the hash of the whole path.
+ */
+void checkHashes(const std::vector<IsoImageFile>& files) {
+  constexpr CdBlock::FilePath literal = "A_FOLDER/FILE.TXT"_path;
+  if (literal.hash != CdBlock::getFilenameHash("A_FOLDER/FILE.TXT", 17))
+    fail("A_FOLDER/FILE.TXT", "_path hash differs from the runtime one");
+
+  for (const IsoImageFile& file : files) {
+    const char *path = file.path.c_str();
+    const uint32_t length = file.path.size();
+
+    const uint32_t hash = CdBlock::getFilenameHash(path, length);
+    const uint32_t secondaryHash =
+      CdBlock::getSecondaryFilenameHash(path, length);
+
+    for (uint32_t split = 0; split <= length; ++split) {
+      uint32_t prime = 0;
+      const uint32_t parentHash = CdBlock::generateHash(path, split,
+        HASH_SEED, HASH_PRIME, HASH_PRIME, &prime);
+
+      const uint32_t parentSecondaryHash = CdBlock::generateSecondaryHash(
+        path, split, HASH_SECONDARY_SEED);
+
+      if (CdBlock::generateHash(path + split, length - split, parentHash,
+          prime, HASH_PRIME, nullptr) != hash ||
+        CdBlock::generateSecondaryHash(path + split, length - split,
+          parentSecondaryHash) != secondaryHash) {
+
+        fail(file.path, "appended hash differs");
+        break;
+      }
+    }
+  }
+}
+
+void printReadStatistics(const char *name) {
+  CdBlock::ReadStatistics stats;
+  CdBlock::getReadStatistics(&stats);
+
+  printf("%-11s %6u commands, %7u sectors, %6u cache hits, "
+    "%6u prefetch hits\n", name, stats.commandsIssued, stats.sectorsRead,
+    stats.cacheHits, stats.prefetchHits);
+}
+
+/**
+ * Reads with the prefetch window disabled must return the same data and
+ * never hit it, a sequential stream through the largest file with the
+ * window enabled must be served by it and stop reading ahead at the end
+ * of the file.
+ */
+void checkPrefetch(const std::vector<IsoImageFile>& files) {
+  CdBlock::ReadStatistics stats;
+
+  CdBlock::initializePrefetchWindow(0);
+  CdBlock::invalidateSectorCache();
+  CdBlock::resetReadStatistics();
+  checkFiles(files);
+  printReadStatistics("no prefetch");
+
+  CdBlock::getReadStatistics(&stats);
+  if (stats.prefetchHits != 0 || stats.prefetchedSectors != 0)
+    fail("prefetch", "disabled window was used");
+
+  CdBlock::initializePrefetchWindow(FILESYSTEM_PREFETCH_SECTORS);
+
+  const IsoImageFile& largest = *std::max_element(files.begin(), files.end(),
+    [](const IsoImageFile& a, const IsoImageFile& b) {
+      return a.data.size() < b.data.size();
+    });
+
+  // Reads of a sector at a time, only a window can merge them. Builds
+  // with -DFILESYSTEM_PREFETCH_SECTORS=0 have none.
+  if (largest.data.size() <= 2 * 2048 || FILESYSTEM_PREFETCH_SECTORS == 0)
+    return;
+
+  CdBlock::invalidateSectorCache();
+  CdBlock::resetReadStatistics();
+
+  std::vector<uint8_t> buffer(largest.data.size());
+  File streamed = Filesystem::open(largest.path.c_str(),
+    FilesystemBackend::AUTO, FileMode::STREAMED);
+
+  uint32_t offset = 0;
+  while (offset < buffer.size()) {
+    const uint32_t chunk = std::min<uint32_t>(buffer.size() - offset, 2048);
+    if (streamed.readData(buffer.data() + offset, chunk) != chunk)
+      break;
+
+    offset += chunk;
+  }
+
+  streamed.close();
+
+  if (buffer != largest.data)
+    fail(largest.path, "prefetched stream contents differ");
+
+  CdBlock::getReadStatistics(&stats);
+  if (stats.prefetchHits == 0)
+    fail(largest.path, "sequential stream missed the prefetch window");
+
+  if (stats.sectorsRead > (largest.data.size() + 2047) / 2048)
+    fail(largest.path, "stream read ahead past the end of the file");
+}
+
+/**
+ * Load every file into caller memory with the sector cache cold. Prints
+ * the drive commands and the bytes copied (and bounced) of each.
+ */
+void reportFiles(const std::vector<IsoImageFile>& files) {
+  for (const IsoImageFile& file : files) {
+    std::vector<uint8_t> buffer(file.data.size());
+
+    CdBlock::invalidateSectorCache();
+    CdBlock::resetReadStatistics();
+    Filesystem::open(file.path.c_str(), buffer.data()).close();
+
+    CdBlock::ReadStatistics stats;
+    CdBlock::getReadStatistics(&stats);
+
+    printf("file %-32s %7zu bytes: %3u commands, %4u sectors, "
+      "%7u bytes copied, %5u bounced\n", file.path.c_str(), file.data.size(),
+      stats.commandsIssued, stats.sectorsRead, stats.bytesCopied,
+      stats.bytesBounced);
+  }
+}
+
+/**
+ * Print the traffic of the simulated drive since the last
+ * HostSaturn::resetDriveStatistics.
+ */
+void printDriveStatistics(const char *name) {
+  HostDriveStatistics stats;
+  HostSaturn::getDriveStatistics(&stats);
+
+  printf("%-24s %5u commands, %6u sectors, %4u seeks over %7u sectors, "
+    "%8.1f ms seeking, %8.1f ms\n", name, stats.numReads,
+    (uint32_t) (stats.bytesRead / 2048), stats.numSeeks,
+    (uint32_t) stats.seekDistance, stats.seekTime / 1000.0,
+    stats.time / 1000.0);
+}
+
+/**
+ * Load every file, in a shuffled order, one at a time and then with
+ * Filesystem::loadBatch. Prints what reading in disc order saves.
+ */
+void reportBatch(const std::vector<IsoImageFile>& files) {
+  std::vector<const IsoImageFile*> order;
+  for (const IsoImageFile& file : files)
+    order.push_back(&file);
+
+  std::mt19937 random(2);
+  std::shuffle(order.begin(), order.end(), random);
+
+  std::vector<std::vector<uint8_t>> buffers(order.size());
+  std::vector<FileLoadRequest> requests;
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    buffers[i].resize(order[i]->data.size());
+    requests.push_back({ Filesystem::getFilePath(order[i]->path.c_str()),
+      buffers[i].data() });
+  }
+
+  CdBlock::invalidateSectorCache();
+  HostSaturn::resetDriveStatistics();
+
+  for (uint32_t i = 0; i < order.size(); ++i)
+    Filesystem::open(requests[i].path, requests[i].dest).close();
+
+  printDriveStatistics("batch in request order");
+
+  CdBlock::invalidateSectorCache();
+  HostSaturn::resetDriveStatistics();
+
+  if (Filesystem::loadBatch(requests.data(), requests.size()) != 0)
+    fail("", "batch load failed");
+
+  printDriveStatistics("batch in disc order");
+}
+
+/**
+ * Load every file into caller memory, a blocking open per tick and then
+ * through Filesystem::openAsync with an updateAsync per tick (a full
+ * budget and a single sector). Prints the number of ticks and the worst
+ * drive time spent in one, which a frame (16.7ms) has to absorb.
+ */
+void reportAsync(const std::vector<IsoImageFile>& files) {
+  std::vector<std::vector<uint8_t>> buffers(files.size());
+  for (uint32_t i = 0; i < files.size(); ++i)
+    buffers[i].resize(files[i].data.size());
+
+  HostDriveStatistics stats;
+  uint64_t tickStart = 0;
+  uint64_t worstTick = 0;
+
+  auto endTick = [&]() {
+    HostSaturn::getDriveStatistics(&stats);
+    worstTick = std::max(worstTick, stats.time - tickStart);
+    tickStart = stats.time;
+  };
+
+  CdBlock::invalidateSectorCache();
+  HostSaturn::resetDriveStatistics();
+
+  for (uint32_t i = 0; i < files.size(); ++i) {
+    Filesystem::open(files[i].path.c_str(), buffers[i].data()).close();
+    endTick();
+  }
+
+  printf("blocking open:          %4zu ticks, worst tick %8.1f ms\n",
+    files.size(), worstTick / 1000.0);
+
+  const uint32_t budgets[] = { FILESYSTEM_ASYNC_TICK_BUDGET, 2048 };
+  for (uint32_t budget : budgets) {
+    CdBlock::invalidateSectorCache();
+    HostSaturn::resetDriveStatistics();
+    tickStart = 0;
+    worstTick = 0;
+
+    AsyncFile *requests[FILESYSTEM_MAX_ASYNC_REQUESTS] = {};
+    uint32_t nextFile = 0;
+    uint32_t numTicks = 0;
+
+    for (;;) {
+      bool pending = false;
+      for (AsyncFile *& request : requests) {
+        if (request != nullptr && request->status() != AsyncStatus::PENDING) {
+          request->release();
+          request = nullptr;
+        }
+
+        if (request == nullptr && nextFile < files.size()) {
+          request = Filesystem::openAsync(files[nextFile].path.c_str(),
+            buffers[nextFile].data());
+
+          nextFile++;
+        }
+
+        pending |= (request != nullptr);
+      }
+
+      if (!pending)
+        break;
+
+      Filesystem::updateAsync(budget);
+      endTick();
+      numTicks++;
+    }
+
+    printf("openAsync, %5u budget: %4u ticks, worst tick %8.1f ms\n",
+      budget, numTicks, worstTick / 1000.0);
+  }
+}
+
+/**
+ * Stream the largest file a sector at a time, as an audio or video player
+ * would, with the prefetch window off and on. Prints the throughput the
+ * drive latency (see HostDriveTiming) leaves.
+ */
+void reportStream(const std::vector<IsoImageFile>& files) {
+  const IsoImageFile& largest = *std::max_element(files.begin(), files.end(),
+    [](const IsoImageFile& a, const IsoImageFile& b) {
+      return a.data.size() < b.data.size();
+    });
+
+  const uint32_t windows[] = { 0, FILESYSTEM_PREFETCH_SECTORS };
+  std::vector<uint8_t> buffer(2048);
+
+  for (uint32_t window : windows) {
+    CdBlock::initializePrefetchWindow(window);
+    CdBlock::invalidateSectorCache();
+    HostSaturn::resetDriveStatistics();
+
+    File streamed = Filesystem::open(largest.path.c_str(),
+      FilesystemBackend::AUTO, FileMode::STREAMED);
+
+    while (streamed.readData(buffer.data(), buffer.size()) != 0)
+      ;
+
+    streamed.close();
+
+    HostDriveStatistics stats;
+    HostSaturn::getDriveStatistics(&stats);
+
+    const double kilobytesPerSecond = (stats.time == 0) ? 0 :
+      largest.data.size() / 1024.0 / (stats.time / 1000000.0);
+
+    printf("stream %s, %2u sector window: %4u commands, %7.1f KB/s\n",
+      largest.path.c_str(), window, stats.numReads, kilobytesPerSecond);
+  }
+
+  CdBlock::initializePrefetchWindow(FILESYSTEM_PREFETCH_SECTORS);
+}
+
+/**
+ * Replay the reads of main.cpp: reading the filesystem and building the
+ * header table as Filesystem::initialize does, walking the directories
+ * for printCdStructure and opening its two files. A level load follows,
+ * every file, then the boot files again on the way back to the menu.
+ * Prints the drive reads the sector cache saves, the prefetch window is
+ * on in both runs.
+ */
+void reportBoot(const std::vector<IsoImageFile>& files) {
+  const char *bootPaths[] = {
+    "TEST_FILE.TXT", "A_FOLDER/ANOTHER_TEST_FILE.TXT" };
+
+  std::vector<std::string> bootFiles;
+  for (const char *path : bootPaths) {
+    if (Filesystem::getFileSize(path) != 0)
+      bootFiles.push_back(path);
+  }
+
+  const uint32_t cacheSizes[] = { 0, FILESYSTEM_SECTOR_CACHE_SECTORS };
+  HostDriveStatistics uncached = {};
+
+  for (uint32_t cacheSize : cacheSizes) {
+    CdBlock::initializeSectorCache(cacheSize);
+    HostSaturn::resetDriveStatistics();
+
+    CdBlock::FilesystemData fsData;
+    CdBlock::FilesystemHeaderTable table = {};
+    if (CdBlock::readFilesystem(&fsData) != 0) {
+      fail("", "can't read the filesystem");
+      break;
+    }
+
+    if (CdBlock::loadHeaderTableIndex(&fsData, FILE_INDEX_FILENAME,
+      &table) != 0 &&
+      CdBlock::buildHeaderTableFromPathTable(&fsData, &table) != 0 &&
+      CdBlock::buildHeaderTable(&fsData, &table) != 0) {
+
+      fail("", "can't build the header table");
+    }
+
+    free(table.hashes);
+    free(table.collisions);
+    free(table.packedHashes);
+
+    CdBlock::navigateFilesystem(&fsData,
+      [](CdBlock::DirectoryRecord*, int, void*) {}, nullptr);
+
+    for (const std::string& path : bootFiles)
+      Filesystem::open(path.c_str()).close();
+
+    printDriveStatistics(cacheSize == 0 ? "boot, no cache" : "boot, cache");
+
+    for (const IsoImageFile& file : files)
+      Filesystem::open(file.path.c_str()).close();
+
+    for (const std::string& path : bootFiles)
+      Filesystem::open(path.c_str()).close();
+
+    printDriveStatistics(cacheSize == 0 ? "level, no cache" : 
+      "level, cache");
+
+    HostDriveStatistics stats;
+    HostSaturn::getDriveStatistics(&stats);
+    if (cacheSize == 0) {
+      uncached = stats;
+      continue;
+    }
+
+    printf("sector cache of %u sectors saved %u of %u drive commands, "
+      "%u of %u sectors, %.1f ms\n", cacheSize,
+      uncached.numReads - stats.numReads, uncached.numReads,
+      (uint32_t) ((uncached.bytesRead - stats.bytesRead) / 2048),
+      (uint32_t) (uncached.bytesRead / 2048),
+      (uncached.time - stats.time) / 1000.0);
+  }
+
+  CdBlock::initializeSectorCache(FILESYSTEM_SECTOR_CACHE_SECTORS);
+}
+
+/**
+ * Build the header table with every builder, with the sector cache and
+ * the prefetch window off so every directory sector read reaches the
+ * drive. The directory walk used to be done twice, once to count the
+ * files (getHeaderTableSize) and once to fill the table. The path table
+ * builder trades the seeks of the recursive walk for a sweep in disc
+ * order.
+ */
+void reportHeaderTables() {
+  CdBlock::FilesystemData fsData;
+  if (CdBlock::readFilesystem(&fsData) != 0) {
+    fail("", "can't read the filesystem");
+    return;
+  }
+
+  CdBlock::printHeaderTableMemory(Filesystem::getCdBlockHeaderTable());
+
+  CdBlock::initializeSectorCache(0);
+  CdBlock::initializePrefetchWindow(0);
+
+  CdBlock::FilesystemHeaderTable table = {};
+  HostSaturn::resetDriveStatistics();
+  table.hashes = (uint32_t*) malloc(CdBlock::getHeaderTableSize(&fsData));
+  printDriveStatistics("table count");
+
+  HostSaturn::resetDriveStatistics();
+  CdBlock::fillHeaderTable(&fsData, &table);
+  printDriveStatistics("table fill");
+  free(table.hashes);
+  free(table.collisions);
+
+  table = {};
+  HostSaturn::resetDriveStatistics();
+  if (CdBlock::buildHeaderTable(&fsData, &table) == 0)
+    printDriveStatistics("table walk");
+
+  free(table.hashes);
+  free(table.collisions);
+
+  table = {};
+  HostSaturn::resetDriveStatistics();
+  if (CdBlock::buildHeaderTableFromPathTable(&fsData, &table) == 0)
+    printDriveStatistics("table path table");
+
+  free(table.hashes);
+  free(table.collisions);
+
+  CdBlock::initializeSectorCache(FILESYSTEM_SECTOR_CACHE_SECTORS);
+  CdBlock::initializePrefetchWindow(FILESYSTEM_PREFETCH_SECTORS);
+}
+
+/**
+ * Build the header table of a synthetic disc of numFiles files with the
+ * walk and path table builders. Prints their peak memory per 1000 files,
+ * on a disc large enough for the fixed costs of building not to count.
+ * Leaves the synthetic disc in the drive.
+ */
+void reportLargeHeaderTables(uint32_t numFiles) {
+  // 100 files a directory, nested so the root (of which the walk only
+  // reads the first sector) holds few directories.
+  std::vector<IsoImageFile> files(numFiles);
+  for (uint32_t i = 0; i < numFiles; ++i) {
+    char path[32];
+    snprintf(path, sizeof(path), "DIR%03u/SUB%u/FILE%02u.BIN", i / 1000,
+      i / 100 % 10, i % 100);
+
+    files[i].path = path;
+    files[i].data.assign(1, i);
+  }
+
+  static std::vector<uint8_t> image;
+  image = IsoImage::build(files);
+  HostSaturn::setDiscImage(&image);
+  CdBlock::invalidateSectorCache();
+
+  CdBlock::FilesystemData fsData;
+  if (CdBlock::readFilesystem(&fsData) != 0) {
+    fail("", "can't read the synthetic filesystem");
+    return;
+  }
+
+  for (uint32_t builder = 0; builder < 2; ++builder) {
+    CdBlock::FilesystemHeaderTable table = {};
+    const int stat = (builder == 0) ?
+      CdBlock::buildHeaderTable(&fsData, &table) :
+      CdBlock::buildHeaderTableFromPathTable(&fsData, &table);
+
+    if (stat != 0 || table.numEntries != numFiles) {
+      fail("", "can't build the synthetic header table");
+    } else {
+      printf("table %-10s %u files, %u bytes at peak, %u per 1000 files\n",
+        (builder == 0) ? "walk" : "path table", numFiles,
+        table.peakBuildBytes,
+        (uint32_t) ((uint64_t) table.peakBuildBytes * 1000 / numFiles));
+    }
+
+    free(table.hashes);
+    free(table.collisions);
+  }
+}
+
+} // namespace ''
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "Usage: %s <cd directory> [image.iso]\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<IsoImageFile> files;
+  if (IsoImage::readDirectory(argv[1], &files) != 0 || files.empty()) {
+    fprintf(stderr, "Can't read %s\n", argv[1]);
+    return 1;
+  }
+
+  std::vector<uint8_t> image;
+  if (argc == 3) {
+    if (HostSaturn::loadDiscImage(argv[2], &image) != 0) {
+      fprintf(stderr, "Can't read %s\n", argv[2]);
+      return 1;
+    }
+  } else {
+    image = IsoImage::build(files);
+  }
+
+  HostSaturn::setDiscImage(&image);
+  Filesystem::initialize();
+  Filesystem::setDefaultBackend(FilesystemBackend::CDBLOCK);
+
+  if (argc == 3)
+    checkIndex(&files);
+
+  CdBlock::invalidateSectorCache();
+  CdBlock::resetReadStatistics();
+  checkFiles(files);
+  printReadStatistics("cold");
+
+  // Same reads again, the last ones now served by the sector cache.
+  CdBlock::resetReadStatistics();
+  checkFiles(files);
+  printReadStatistics("warm");
+
+  // Batches, asynchronous loads and streams only read the files as they
+  // are on the disc.
+  std::vector<IsoImageFile> rawFiles;
+  for (const IsoImageFile& file : files) {
+    if (!isPacked(file))
+      rawFiles.push_back(file);
+  }
+
+  reportFiles(files);
+  reportBoot(files);
+
+  if (!rawFiles.empty()) {
+    checkPrefetch(rawFiles);
+    reportStream(rawFiles);
+    reportBatch(rawFiles);
+    reportAsync(rawFiles);
+    checkBatches(rawFiles);
+    checkAsync(rawFiles);
+  }
+
+  checkPacked(files);
+  checkDirectories(files);
+  checkHeaderTables(files);
+  reportHeaderTables();
+  reportLargeHeaderTables(20000);
+  HostSaturn::setDiscImage(&image);
+  CdBlock::invalidateSectorCache();
+  checkHashes(files);
+
+  printf("%zu files, %u failures\n", files.size(), numFailures);
+  return numFailures != 0;
+}
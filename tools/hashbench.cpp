@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+/*
+ * Host tool that hashes the paths of a large synthetic tree with the
+ * filename hash of filehash.h: checks that appending a name to the hash
+ * of its directory equals hashing the whole path, counts the paths
+ * sharing a hash, and times the hash in hashes per second.
+ *
+ * Build (from the repository root), once per hash version compared:
+ *   g++ -std=c++14 -O2 -I. -DHASH_VERSION=2 tools/hashbench.cpp \
+ *     -o hashbench
+ *
+ * Usage:
+ *   hashbench [paths]
+ *     Number of paths in the tree, 1000000 by default. Colliding pairs
+ *     are printed next to the number expected of a hash uniform over the
+ *     same range (HASH_CUT_NUMBER values for HASH_VERSION 1, 2^32 
+ *     otherwise), pairs sharing the secondary hash too (which 
+ *     getFileEntry can't tell apart) fail the check. Exits 0 if every 
+ *     check passed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "filehash.h"
+
+
+namespace {
+
+
+const char *prefixes[] = { "TEX", "MAP", "SND", "OBJ", "PAL", "FNT" };
+const char *extensions[] = { "BIN", "TGA", "PCM", "DAT" };
+
+/**
+ * Directory of a tree laid out as a game disc would be, levels holding
+ * zones holding numbered 8.3 assets.
+ */
+std::string getDirectory(uint32_t index) {
+  char directory[32];
+  snprintf(directory, sizeof(directory), "LEVEL%02u/ZONE%03u/",
+    index / 100 % 100, index % 100);
+
+  return directory;
+}
+
+std::string getName(uint32_t index) {
+  char name[16];
+  snprintf(name, sizeof(name), "%s%05u.%s",
+    prefixes[index % (sizeof(prefixes) / sizeof(prefixes[0]))], index / 6,
+    extensions[index / 6 % (sizeof(extensions) / sizeof(extensions[0]))]);
+
+  return name;
+}
+
+/**
+ * Every path, at least 100 files in each of up to 10000 directories.
+ * Names repeat across directories, only the directory tells them apart.
+ */
+std::vector<std::string> makeTree(uint32_t numPaths) {
+  const uint32_t filesPerDirectory = std::max<uint32_t>(100,
+    (numPaths + 9999) / 10000);
+
+  std::vector<std::string> paths;
+  paths.reserve(numPaths);
+
+  for (uint32_t i = 0; i < numPaths; ++i) {
+    paths.push_back(getDirectory(i / filesPerDirectory) +
+      getName(i % filesPerDirectory));
+  }
+
+  return paths;
+}
+
+uint32_t getHash(const std::string& path) {
+  return CdBlock::getFilenameHash(path.c_str(), path.size());
+}
+
+/**
+ * Hash of a path appended to the hash of its directory, as the header
+ * table builders do.
+ */
+uint32_t getAppendedHash(const std::string& path) {
+  const size_t slash = path.rfind('/') + 1;
+
+  uint32_t prime = HASH_PRIME;
+  const uint32_t directoryHash = CdBlock::generateHash(path.c_str(), slash,
+    HASH_SEED, HASH_PRIME, HASH_PRIME, &prime);
+
+  return CdBlock::generateHash(path.c_str() + slash, path.size() - slash,
+    directoryHash, prime, HASH_PRIME, nullptr);
+}
+
+/**
+ * Colliding pairs of the filename hash, and of the filename and the
+ * secondary hash together.
+ */
+std::pair<uint64_t, uint64_t> countCollisions(
+  const std::vector<std::string>& paths) {
+
+  std::vector<std::pair<uint32_t, uint32_t>> hashes;
+  hashes.reserve(paths.size());
+
+  for (const std::string& path : paths) {
+    hashes.emplace_back(getHash(path), CdBlock::getSecondaryFilenameHash(
+      path.c_str(), path.size()));
+  }
+
+  std::sort(hashes.begin(), hashes.end());
+
+  // A run of k equal hashes holds k * (k - 1) / 2 pairs.
+  std::pair<uint64_t, uint64_t> numPairs(0, 0);
+  uint64_t run = 0;
+  uint64_t bothRun = 0;
+
+  for (size_t i = 1; i < hashes.size(); ++i) {
+    run = (hashes[i].first == hashes[i - 1].first) ? run + 1 : 0;
+    bothRun = (hashes[i] == hashes[i - 1]) ? bothRun + 1 : 0;
+
+    numPairs.first += run;
+    numPairs.second += bothRun;
+  }
+
+  return numPairs;
+}
+
+double timeHashes(const std::vector<std::string>& paths, uint32_t numRounds,
+  uint32_t *result) {
+
+  uint32_t combined = 0;
+  const auto start = std::chrono::steady_clock::now();
+
+  for (uint32_t round = 0; round < numRounds; ++round) {
+    for (const std::string& path : paths)
+      combined += getHash(path);
+  }
+
+  const std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  // Printed by the caller, so the loop can't be dropped.
+  *result = combined;
+
+  return paths.size() * (double) numRounds / elapsed.count();
+}
+
+} // namespace ''
+
+int main(int argc, char **argv) {
+  const uint32_t numPaths = (argc > 1) ? strtoul(argv[1], nullptr, 0) :
+    1000000;
+
+  if (numPaths == 0) {
+    fprintf(stderr, "Usage: %s [paths]\n", argv[0]);
+    return 1;
+  }
+
+  const std::vector<std::string> paths = makeTree(numPaths);
+  uint32_t numFailures = 0;
+
+  for (const std::string& path : paths) {
+    if (getAppendedHash(path) != getHash(path)) {
+      fprintf(stderr, "%s: appended hash differs\n", path.c_str());
+      numFailures++;
+      break;
+    }
+  }
+
+#if HASH_VERSION == 1
+  const double numHashes = HASH_CUT_NUMBER;
+#else
+  const double numHashes = 4294967296.0;
+#endif
+
+  const std::pair<uint64_t, uint64_t> numPairs = countCollisions(paths);
+  const double expectedPairs = (double) numPaths * (numPaths - 1) / 2 /
+    numHashes;
+
+  printf("HASH_VERSION %d, %u paths: %llu colliding pairs (%.1f expected), "
+    "%llu sharing the secondary hash\n", HASH_VERSION, numPaths,
+    (unsigned long long) numPairs.first, expectedPairs,
+    (unsigned long long) numPairs.second);
+
+  if (numPairs.second != 0) {
+    fprintf(stderr, "paths getFileEntry can't tell apart\n");
+    numFailures++;
+  }
+
+  // Rounds so the timed loop hashes at least 10 million paths.
+  const uint32_t numRounds = std::max<uint32_t>(1, 10000000 / numPaths);
+  uint32_t result = 0;
+  const double hashesPerSecond = timeHashes(paths, numRounds, &result);
+
+  printf("HASH_VERSION %d: %.1f million hashes per second (result %08x)\n",
+    HASH_VERSION, hashesPerSecond / 1000000.0, result);
+
+  return numFailures != 0;
+}
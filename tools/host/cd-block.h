@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+/*
+ * Host stand-in for the yaul cd-block driver, see yaul.h.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+extern int cd_block_init(int16_t standbyTime);
+extern int cd_block_cmd_is_auth(uint16_t *discType);
+extern int cd_block_bypass_copy_protection();
+extern int cd_block_read_data(uint16_t fad, uint32_t length,
+  uint8_t *outputBuffer);
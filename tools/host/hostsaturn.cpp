@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+#include <unistd.h>
+
+#include <yaul.h>
+#include <cd-block.h>
+
+#include "hostsaturn.h"
+
+
+namespace {
+
+
+const std::vector<uint8_t> *discImage = nullptr;
+HostDriveStatistics driveStatistics = { 0, 0, 0, 0, 0, 0, 150 };
+
+HostDriveTiming driveTiming = {
+  HOST_DRIVE_COMMAND_TIME,
+  HOST_DRIVE_SECTOR_TIME,
+  HOST_DRIVE_SEEK_TIME,
+  HOST_DRIVE_SEEK_SECTORS_PER_MS
+};
+
+int usbCartFd = -1;
+
+
+} // namespace ''
+
+void dbgio_buffer(const char *buffer) {
+  fputs(buffer, stdout);
+}
+
+void dbgio_flush() {
+  fflush(stdout);
+}
+
+uint8_t usb_cart_byte_read() {
+  uint8_t byte = 0;
+  if (usbCartFd < 0 || read(usbCartFd, &byte, 1) != 1) {
+    fprintf(stderr, "USB cart read failed\n");
+    abort();
+  }
+
+  return byte;
+}
+
+uint32_t usb_cart_long_read() {
+  uint32_t word = 0;
+  for (uint32_t i = 0; i < 4; ++i)
+    word = (word << 8) | usb_cart_byte_read();
+
+  return word;
+}
+
+void usb_cart_byte_send(uint8_t byte) {
+  if (usbCartFd < 0 || write(usbCartFd, &byte, 1) != 1) {
+    fprintf(stderr, "USB cart write failed\n");
+    abort();
+  }
+}
+
+void usb_cart_long_send(uint32_t word) {
+  for (int32_t shift = 24; shift >= 0; shift -= 8)
+    usb_cart_byte_send(word >> shift);
+}
+
+int cd_block_init(int16_t) {
+  return (discImage != nullptr) ? 0 : -1;
+}
+
+int cd_block_cmd_is_auth(uint16_t*) {
+  return 1;
+}
+
+int cd_block_bypass_copy_protection() {
+  return 0;
+}
+
+int cd_block_read_data(uint16_t fad, uint32_t length, uint8_t *outputBuffer) {
+  assert(discImage != nullptr);
+  assert(fad >= 150);
+
+  const uint32_t numSectors = (length + 2047) / 2048;
+
+  driveStatistics.numReads++;
+  driveStatistics.bytesRead += length;
+  driveStatistics.time += driveTiming.commandTime +
+    (uint64_t) numSectors * driveTiming.sectorTime;
+
+  if (fad != driveStatistics.lastFad) {
+    const uint32_t distance = (fad > driveStatistics.lastFad) ?
+      fad - driveStatistics.lastFad : driveStatistics.lastFad - fad;
+
+    const uint64_t seekTime = driveTiming.seekTime +
+      (uint64_t) distance * 1000 / driveTiming.seekSectorsPerMs;
+
+    driveStatistics.numSeeks++;
+    driveStatistics.seekDistance += distance;
+    driveStatistics.time += seekTime;
+    driveStatistics.seekTime += seekTime;
+  }
+
+  driveStatistics.lastFad = fad + numSectors;
+
+  const size_t offset = (size_t) (fad - 150) * 2048;
+  const size_t available = (offset < discImage->size()) ?
+    discImage->size() - offset : 0;
+
+  const size_t copied = (length < available) ? length : available;
+  memcpy(outputBuffer, discImage->data() + offset, copied);
+  memset(outputBuffer + copied, 0, length - copied);
+
+  return 0;
+}
+
+namespace HostSaturn {
+
+
+void setDiscImage(const std::vector<uint8_t> *image) {
+  discImage = image;
+}
+
+int loadDiscImage(const char *filename, std::vector<uint8_t> *image) {
+  FILE *handle = fopen(filename, "rb");
+  if (handle == nullptr)
+    return -1;
+
+  fseek(handle, 0, SEEK_END);
+  image->resize(ftell(handle));
+  fseek(handle, 0, SEEK_SET);
+
+  const size_t numRead = fread(image->data(), 1, image->size(), handle);
+  fclose(handle);
+
+  return (numRead == image->size()) ? 0 : -1;
+}
+
+void setUsbCart(int fd) {
+  usbCartFd = fd;
+}
+
+void setDriveTiming(const HostDriveTiming& timing) {
+  driveTiming = timing;
+}
+
+void getDriveStatistics(HostDriveStatistics *stats) {
+  *stats = driveStatistics;
+}
+
+void resetDriveStatistics() {
+  driveStatistics = HostDriveStatistics();
+  driveStatistics.lastFad = 150;
+}
+
+
+} // namespace HostSaturn
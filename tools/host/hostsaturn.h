@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+// Default HostDriveTiming, roughly a 2x drive: 150 sectors per second,
+// a few milliseconds to start every transfer, and seeks taking 80ms plus
+// the pickup travel (a full stroke over a 74 minute disc is ~330ms).
+#define HOST_DRIVE_COMMAND_TIME 4000
+#define HOST_DRIVE_SECTOR_TIME 6667
+#define HOST_DRIVE_SEEK_TIME 80000
+#define HOST_DRIVE_SEEK_SECTORS_PER_MS 1300
+
+/**
+ * Latency of the simulated drive, in microseconds. Reads still return at
+ * once, the time they would take is only added to
+ * HostDriveStatistics::time.
+ */
+struct HostDriveTiming {
+  // Cost of every cd_block_read_data call, and of each sector it returns.
+  uint32_t commandTime;
+  uint32_t sectorTime;
+
+  // Cost of a read not starting where the previous one ended: a fixed
+  // part, and the pickup travel at seekSectorsPerMs.
+  uint32_t seekTime;
+  uint32_t seekSectorsPerMs;
+};
+
+/**
+ * Traffic of the simulated drive.
+ */
+struct HostDriveStatistics {
+  // cd_block_read_data calls and bytes they returned.
+  uint32_t numReads;
+  uint64_t bytesRead;
+
+  // Reads not starting at lastFad, and the sum of the distances (in
+  // sectors) the pickup travelled for them.
+  uint32_t numSeeks;
+  uint64_t seekDistance;
+
+  // Time the reads would have taken (see HostDriveTiming), in
+  // microseconds, and the part of it spent seeking.
+  uint64_t time;
+  uint64_t seekTime;
+
+  // Sector following the last one read, where the pickup stands.
+  uint32_t lastFad;
+};
+
+namespace HostSaturn {
+
+
+/**
+ * Serve drive reads from image, 2048 byte sectors from LBA 0. The image
+ * must outlive every read, reads past its end return zeros.
+ */
+extern void setDiscImage(const std::vector<uint8_t> *image);
+
+/**
+ * Read a whole disc image (.iso, 2048 byte sectors) into image.
+ *
+ * @return 0 If successful.
+ */
+extern int loadDiscImage(const char *filename, std::vector<uint8_t> *image);
+
+/**
+ * Exchange USB cart bytes through fd (a socket or pipe to tools/usbserver),
+ * -1 to unplug the cart. Link errors abort the program.
+ */
+extern void setUsbCart(int fd);
+
+/**
+ * Latency of the reads from now on, HOST_DRIVE_* until set.
+ */
+extern void setDriveTiming(const HostDriveTiming& timing);
+
+extern void getDriveStatistics(HostDriveStatistics *stats);
+
+/**
+ * Zero the counters and park the pickup at the start of the disc (FAD
+ * 150), so every measure starts from the same place.
+ */
+extern void resetDriveStatistics();
+
+
+} // namespace HostSaturn
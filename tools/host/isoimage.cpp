@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+
+#include "isoimage.h"
+
+
+namespace {
+
+
+const uint32_t SECTOR_SIZE = 2048;
+
+// System area, primary volume descriptor and terminator.
+const uint32_t FIRST_FREE_LBA = 18;
+
+struct Directory {
+  std::string name;
+
+  // Index of the parent in path table order (the root is its own).
+  uint32_t parent;
+
+  // Children by identifier, index of a directory or file.
+  std::map<std::string, uint32_t> subdirectories;
+  std::map<std::string, uint32_t> files;
+
+  uint32_t lba = 0;
+  uint32_t numSectors = 0;
+};
+
+void writeLittle16(uint8_t *dest, uint32_t value) {
+  dest[0] = value;
+  dest[1] = value >> 8;
+}
+
+void writeBig16(uint8_t *dest, uint32_t value) {
+  dest[0] = value >> 8;
+  dest[1] = value;
+}
+
+void writeLittle32(uint8_t *dest, uint32_t value) {
+  for (uint32_t i = 0; i < 4; ++i)
+    dest[i] = value >> (8 * i);
+}
+
+void writeBig32(uint8_t *dest, uint32_t value) {
+  for (uint32_t i = 0; i < 4; ++i)
+    dest[i] = value >> (24 - 8 * i);
+}
+
+// Both byte orders, little endian first.
+void writeBoth16(uint8_t *dest, uint32_t value) {
+  writeLittle16(dest, value);
+  writeBig16(dest + 2, value);
+}
+
+void writeBoth32(uint8_t *dest, uint32_t value) {
+  writeLittle32(dest, value);
+  writeBig32(dest + 4, value);
+}
+
+std::vector<uint8_t> makeDirectoryRecord(const std::string& identifier,
+  uint32_t lba, uint32_t size, bool isDirectory) {
+
+  const uint32_t length = 33 + identifier.size() +
+    ((identifier.size() & 1) == 0);
+
+  std::vector<uint8_t> record(length, 0);
+  record[0] = length;
+  writeBoth32(&record[2], lba);
+  writeBoth32(&record[10], size);
+  record[25] = isDirectory ? 2 : 0;
+  writeBoth16(&record[28], 1);
+  record[32] = identifier.size();
+  memcpy(&record[33], identifier.data(), identifier.size());
+
+  return record;
+}
+
+std::vector<uint8_t> makePathTable(const std::vector<Directory>& directories,
+  bool bigEndian) {
+
+  std::vector<uint8_t> table;
+  for (const Directory& directory : directories) {
+    const std::string identifier = directory.name.empty() ?
+      std::string(1, '\0') : directory.name;
+
+    std::vector<uint8_t> record(8 + identifier.size() +
+      (identifier.size() & 1), 0);
+
+    record[0] = identifier.size();
+    if (bigEndian) {
+      writeBig32(&record[2], directory.lba);
+      writeBig16(&record[6], directory.parent + 1);
+    } else {
+      writeLittle32(&record[2], directory.lba);
+      writeLittle16(&record[6], directory.parent + 1);
+    }
+
+    memcpy(&record[8], identifier.data(), identifier.size());
+    table.insert(table.end(), record.begin(), record.end());
+  }
+
+  return table;
+}
+
+uint32_t getNumSectors(uint32_t size) {
+  return (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+
+} // namespace ''
+
+namespace IsoImage {
+
+
+std::vector<uint8_t> build(const std::vector<IsoImageFile>& files) {
+  std::vector<Directory> tree(1);
+  tree[0].parent = 0;
+
+  // Files hang from directories created in any order first.
+  for (uint32_t i = 0; i < files.size(); ++i) {
+    uint32_t current = 0;
+    size_t start = 0;
+
+    for (;;) {
+      const size_t end = files[i].path.find('/', start);
+      const std::string name = files[i].path.substr(start, end - start);
+
+      if (end == std::string::npos) {
+        tree[current].files[name + ";1"] = i;
+        break;
+      }
+
+      auto found = tree[current].subdirectories.find(name);
+      if (found == tree[current].subdirectories.end()) {
+        Directory directory;
+        directory.name = name;
+        directory.parent = current;
+
+        tree.push_back(directory);
+        found = tree[current].subdirectories.emplace(name,
+          tree.size() - 1).first;
+      }
+
+      current = found->second;
+      start = end + 1;
+    }
+  }
+
+  // Path table order: by level, then parent, then name.
+  std::vector<uint32_t> order(1, 0);
+  std::vector<uint32_t> position(tree.size(), 0);
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    position[order[i]] = i;
+    for (const auto& child : tree[order[i]].subdirectories)
+      order.push_back(child.second);
+  }
+
+  std::vector<Directory> directories;
+  for (uint32_t index : order) {
+    directories.push_back(tree[index]);
+    directories.back().parent = position[tree[index].parent];
+
+    for (auto& child : directories.back().subdirectories)
+      child.second = position[child.second];
+  }
+
+  // Records are laid out twice, for the sizes and then the locations.
+  auto layoutRecords = [&](const Directory& directory,
+    const std::vector<uint32_t>& fileLBAs) {
+
+    std::vector<std::vector<uint8_t>> records;
+    records.push_back(makeDirectoryRecord(std::string(1, '\0'),
+      directory.lba, directory.numSectors * SECTOR_SIZE, true));
+
+    const Directory& parent = directories[directory.parent];
+    records.push_back(makeDirectoryRecord(std::string(1, '\1'),
+      parent.lba, parent.numSectors * SECTOR_SIZE, true));
+
+    std::map<std::string, std::vector<uint8_t>> children;
+    for (const auto& child : directory.subdirectories) {
+      const Directory& subdirectory = directories[child.second];
+      children[child.first] = makeDirectoryRecord(child.first,
+        subdirectory.lba, subdirectory.numSectors * SECTOR_SIZE, true);
+    }
+
+    for (const auto& child : directory.files) {
+      children[child.first] = makeDirectoryRecord(child.first,
+        fileLBAs.empty() ? 0 : fileLBAs[child.second],
+        files[child.second].data.size(), false);
+    }
+
+    for (const auto& child : children)
+      records.push_back(child.second);
+
+    // Records never cross a sector.
+    std::vector<uint8_t> extent;
+    for (const std::vector<uint8_t>& record : records) {
+      const uint32_t used = extent.size() % SECTOR_SIZE;
+      if (used + record.size() > SECTOR_SIZE)
+        extent.resize(extent.size() + SECTOR_SIZE - used, 0);
+
+      extent.insert(extent.end(), record.begin(), record.end());
+    }
+
+    extent.resize(getNumSectors(extent.size()) * SECTOR_SIZE, 0);
+    return extent;
+  };
+
+  const uint32_t pathTableSize = makePathTable(directories, false).size();
+  const uint32_t pathTableSectors = getNumSectors(pathTableSize);
+
+  uint32_t lba = FIRST_FREE_LBA;
+  const uint32_t littlePathTableLBA = lba;
+  lba += pathTableSectors;
+
+  const uint32_t bigPathTableLBA = lba;
+  lba += pathTableSectors;
+
+  const std::vector<uint32_t> noLBAs;
+  for (Directory& directory : directories) {
+    directory.numSectors = layoutRecords(directory, noLBAs).size() /
+      SECTOR_SIZE;
+
+    directory.lba = lba;
+    lba += directory.numSectors;
+  }
+
+  std::vector<uint32_t> fileLBAs(files.size(), 0);
+  for (const Directory& directory : directories) {
+    for (const auto& child : directory.files) {
+      fileLBAs[child.second] = lba;
+      lba += std::max(getNumSectors(files[child.second].data.size()), 1u);
+    }
+  }
+
+  std::vector<uint8_t> image((size_t) lba * SECTOR_SIZE, 0);
+  auto sector = [&](uint32_t sectorLBA) {
+    return &image[(size_t) sectorLBA * SECTOR_SIZE];
+  };
+
+  uint8_t *descriptor = sector(16);
+  descriptor[0] = 1;
+  memcpy(descriptor + 1, "CD001", 5);
+  descriptor[6] = 1;
+  memset(descriptor + 8, ' ', 64);
+  writeBoth32(descriptor + 80, lba);
+  writeBoth16(descriptor + 120, 1);
+  writeBoth16(descriptor + 124, 1);
+  writeBoth16(descriptor + 128, SECTOR_SIZE);
+  writeBoth32(descriptor + 132, pathTableSize);
+  writeLittle32(descriptor + 140, littlePathTableLBA);
+  writeBig32(descriptor + 148, bigPathTableLBA);
+
+  const std::vector<uint8_t> rootRecord = makeDirectoryRecord(
+    std::string(1, '\0'), directories[0].lba,
+    directories[0].numSectors * SECTOR_SIZE, true);
+
+  memcpy(descriptor + 156, rootRecord.data(), rootRecord.size());
+  descriptor[881] = 1;
+
+  uint8_t *terminator = sector(17);
+  terminator[0] = 0xFF;
+  memcpy(terminator + 1, "CD001", 5);
+  terminator[6] = 1;
+
+  const std::vector<uint8_t> littlePathTable =
+    makePathTable(directories, false);
+
+  const std::vector<uint8_t> bigPathTable = makePathTable(directories, true);
+  memcpy(sector(littlePathTableLBA), littlePathTable.data(), pathTableSize);
+  memcpy(sector(bigPathTableLBA), bigPathTable.data(), pathTableSize);
+
+  for (const Directory& directory : directories) {
+    const std::vector<uint8_t> extent = layoutRecords(directory, fileLBAs);
+    memcpy(sector(directory.lba), extent.data(), extent.size());
+  }
+
+  for (uint32_t i = 0; i < files.size(); ++i) {
+    if (!files[i].data.empty()) {
+      memcpy(sector(fileLBAs[i]), files[i].data.data(),
+        files[i].data.size());
+    }
+  }
+
+  return image;
+}
+
+int readDirectory(const std::string& root, std::vector<IsoImageFile> *files) {
+  std::vector<std::string> pending(1, "");
+
+  while (!pending.empty()) {
+    const std::string relative = pending.back();
+    pending.pop_back();
+
+    DIR *directory = opendir((root + "/" + relative).c_str());
+    if (directory == nullptr)
+      return -1;
+
+    while (const dirent *child = readdir(directory)) {
+      const std::string name = child->d_name;
+      if (name == "." || name == "..")
+        continue;
+
+      const std::string path = relative + name;
+      const std::string hostPath = root + "/" + path;
+
+      struct stat status;
+      if (stat(hostPath.c_str(), &status) != 0)
+        continue;
+
+      if (S_ISDIR(status.st_mode)) {
+        pending.push_back(path + "/");
+        continue;
+      }
+
+      IsoImageFile file;
+      file.path = path;
+      file.data.resize(status.st_size);
+
+      FILE *handle = fopen(hostPath.c_str(), "rb");
+      if (handle == nullptr)
+        continue;
+
+      const size_t numRead = fread(file.data.data(), 1, file.data.size(),
+        handle);
+
+      fclose(handle);
+
+      if (numRead == file.data.size())
+        files->push_back(file);
+    }
+
+    closedir(directory);
+  }
+
+  return 0;
+}
+
+
+} // namespace IsoImage
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * File of a disc image built by buildIsoImage.
+ */
+struct IsoImageFile {
+  // Path from the root, '/' separated, already in disc case (for example
+  // "A_FOLDER/FILE.TXT"). Directories are created as needed.
+  std::string path;
+  std::vector<uint8_t> data;
+};
+
+namespace IsoImage {
+
+
+/**
+ * Build a minimal ISO9660 image: an empty system area, the primary volume
+ * descriptor, both path tables, directories (children sorted by name)
+ * and file contents in path table order. Both byte orders are written
+ * wherever ISO9660 has them, so the image reads the same on the Saturn
+ * and the host.
+ */
+extern std::vector<uint8_t> build(const std::vector<IsoImageFile>& files);
+
+/**
+ * Files of a host directory, as build takes them. Names are taken as
+ * they are, the directory should already hold disc names.
+ *
+ * @return 0 If the directory could be read.
+ */
+extern int readDirectory(const std::string& root,
+  std::vector<IsoImageFile> *files);
+
+
+} // namespace IsoImage
@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+/*
+ * Host stand-in for the parts of yaul used by the filesystem, so host
+ * tools build cdblock.cpp and filesystem.cpp unchanged. Put tools/host
+ * first on the include path and link tools/host/hostsaturn.cpp, which
+ * serves the drive from a disc image and the USB cart from a file
+ * descriptor (see hostsaturn.h).
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define __packed __attribute__((packed))
+
+#define LBA2FAD(lba) ((lba) + 150)
+
+extern void dbgio_buffer(const char *buffer);
+extern void dbgio_flush();
+
+extern uint8_t usb_cart_byte_read();
+extern uint32_t usb_cart_long_read();
+extern void usb_cart_byte_send(uint8_t byte);
+extern void usb_cart_long_send(uint32_t word);
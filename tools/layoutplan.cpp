@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+/*
+ * Host tool that plans the file layout of the disc from an access trace
+ * (CdBlock::startAccessTrace / printAccessTrace), so files read together
+ * end up next to each other. Files are placed in order of first access,
+ * followed by the files missing from the trace.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++14 -O2 -I. tools/layoutplan.cpp -o layoutplan
+ *
+ * Pass the same -DHASH_VERSION as the Saturn build.
+ *
+ * Usage:
+ *   layoutplan <trace log> <cd directory> [sort file]
+ *     The trace log is the captured dbgio output, only "TRACE" lines are
+ *     read. The sort file is written for mkisofs -sort (higher weights
+ *     are placed first). The trace is replayed against a simple seek
+ *     model for the current and the planned layout.
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "filehash.h"
+
+
+namespace {
+
+
+const uint32_t SECTOR_SIZE = 2048;
+
+// Seek model: any seek costs SEEK_BASE_MS, plus up to SEEK_FULL_MS more
+// for a full stroke over DISC_SECTORS (74 minutes).
+const double SEEK_BASE_MS = 80.0;
+const double SEEK_FULL_MS = 300.0;
+const double DISC_SECTORS = 333000.0;
+
+struct HostFile {
+  std::string path;
+  uint32_t size;
+};
+
+struct TraceRecord {
+  uint32_t filenameHash;
+  uint32_t lba;
+  uint32_t size;
+  uint32_t time;
+};
+
+struct SeekReport {
+  uint32_t seeks;
+  uint64_t distance;
+  double milliseconds;
+};
+
+/**
+ * Hash every file under the cd directory the way Filesystem::open
+ * hashes its paths.
+ */
+void scanFiles(const std::string& root, const std::string& relativePath,
+  std::map<uint32_t, HostFile> *files) {
+
+  const std::string path = relativePath.empty() ?
+    root : root + "/" + relativePath;
+
+  DIR *directory = opendir(path.c_str());
+  if (directory == nullptr)
+    return;
+
+  std::vector<std::string> names;
+  while (struct dirent *entry = readdir(directory)) {
+    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+      names.push_back(entry->d_name);
+  }
+
+  closedir(directory);
+  std::sort(names.begin(), names.end());
+
+  for (const std::string& name : names) {
+    const std::string childPath = relativePath.empty() ?
+      name : relativePath + "/" + name;
+
+    struct stat childStat;
+    if (stat((root + "/" + childPath).c_str(), &childStat) != 0)
+      continue;
+
+    if (S_ISDIR(childStat.st_mode)) {
+      scanFiles(root, childPath, files);
+      continue;
+    }
+
+    const uint32_t hash = CdBlock::getFilenameHash(childPath.c_str(),
+      childPath.size());
+
+    if (files->count(hash) != 0) {
+      fprintf(stderr, "Hash collision between %s and %s, ignoring the "
+        "second one\n", (*files)[hash].path.c_str(), childPath.c_str());
+      continue;
+    }
+
+    (*files)[hash] = { childPath, (uint32_t) childStat.st_size };
+  }
+}
+
+bool readTrace(const char *tracePath, std::vector<TraceRecord> *records) {
+  FILE *handle = fopen(tracePath, "r");
+  if (handle == nullptr)
+    return false;
+
+  char line[256];
+  while (fgets(line, sizeof(line), handle) != nullptr) {
+    const char *start = strstr(line, "TRACE ");
+    TraceRecord record;
+
+    if (start != nullptr && sscanf(start, "TRACE %x %u %u %u",
+      &record.filenameHash, &record.lba, &record.size, &record.time) == 4) {
+
+      records->push_back(record);
+    }
+  }
+
+  fclose(handle);
+
+  // Records wrap around in the ring, order them back by time.
+  std::stable_sort(records->begin(), records->end(),
+    [](const TraceRecord& a, const TraceRecord& b) {
+      return a.time < b.time;
+    });
+
+  return true;
+}
+
+SeekReport replayTrace(const std::vector<TraceRecord>& records,
+  const std::map<uint32_t, uint32_t>& lbas) {
+
+  SeekReport report = { 0, 0, 0.0 };
+  uint32_t position = 0;
+  bool first = true;
+
+  for (const TraceRecord& record : records) {
+    const uint32_t lba = lbas.at(record.filenameHash);
+
+    // Time to reach the first file is the same for every layout.
+    if (!first && lba != position) {
+      const uint32_t distance = (lba > position) ?
+        lba - position : position - lba;
+
+      report.seeks++;
+      report.distance += distance;
+      report.milliseconds += SEEK_BASE_MS +
+        SEEK_FULL_MS * std::min(1.0, distance / DISC_SECTORS);
+    }
+
+    first = false;
+    position = lba + (record.size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+  }
+
+  return report;
+}
+
+void printReport(const char *name, const SeekReport& report) {
+  printf("%s: %u seeks, %llu sectors travelled, %.0f ms seeking\n", name,
+    report.seeks, (unsigned long long) report.distance, report.milliseconds);
+}
+
+
+} // namespace ''
+
+int main(int argc, char **argv) {
+  if (argc != 3 && argc != 4) {
+    fprintf(stderr, "Usage: %s <trace log> <cd directory> [sort file]\n",
+      argv[0]);
+
+    return 1;
+  }
+
+  std::vector<TraceRecord> records;
+  if (!readTrace(argv[1], &records)) {
+    fprintf(stderr, "Unable to open %s\n", argv[1]);
+    return 1;
+  }
+
+  std::map<uint32_t, HostFile> files;
+  scanFiles(argv[2], "", &files);
+
+  // Drop records of files we can't place.
+  uint32_t unknownRecords = 0;
+  records.erase(std::remove_if(records.begin(), records.end(),
+    [&](const TraceRecord& record) {
+      const bool unknown = files.count(record.filenameHash) == 0;
+      unknownRecords += unknown;
+      return unknown;
+    }), records.end());
+
+  if (unknownRecords > 0) {
+    fprintf(stderr, "%u trace records don't match any file of %s\n",
+      unknownRecords, argv[2]);
+  }
+
+  if (records.empty()) {
+    fprintf(stderr, "Nothing to plan\n");
+    return 1;
+  }
+
+  // Planned order: first access of every traced file.
+  std::vector<uint32_t> order;
+  std::map<uint32_t, uint32_t> currentLBAs;
+  uint32_t firstLBA = records[0].lba;
+
+  for (const TraceRecord& record : records) {
+    if (currentLBAs.count(record.filenameHash) == 0) {
+      currentLBAs[record.filenameHash] = record.lba;
+      order.push_back(record.filenameHash);
+    }
+
+    firstLBA = std::min(firstLBA, record.lba);
+  }
+
+  // Traced files laid out back to back where the traced data started.
+  std::map<uint32_t, uint32_t> plannedLBAs;
+  uint32_t lba = firstLBA;
+  for (uint32_t hash : order) {
+    plannedLBAs[hash] = lba;
+    lba += (files[hash].size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+  }
+
+  printf("%u records, %u files traced out of %u\n",
+    (uint32_t) records.size(), (uint32_t) order.size(),
+    (uint32_t) files.size());
+
+  const SeekReport current = replayTrace(records, currentLBAs);
+  const SeekReport planned = replayTrace(records, plannedLBAs);
+  printReport("current", current);
+  printReport("planned", planned);
+
+  if (current.milliseconds > 0.0) {
+    printf("seek time reduced by %.1f%%\n", 100.0 *
+      (current.milliseconds - planned.milliseconds) / current.milliseconds);
+  }
+
+  if (argc == 4) {
+    FILE *handle = fopen(argv[3], "w");
+    if (handle == nullptr) {
+      fprintf(stderr, "Unable to create %s\n", argv[3]);
+      return 1;
+    }
+
+    for (uint32_t i = 0; i < order.size(); ++i) {
+      fprintf(handle, "%s/%s %u\n", argv[2], files[order[i]].path.c_str(),
+        (uint32_t) (order.size() - i));
+    }
+
+    fclose(handle);
+    printf("%s: %u files sorted\n", argv[3], (uint32_t) order.size());
+  }
+
+  return 0;
+}
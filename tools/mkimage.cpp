@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+/*
+ * Host tool that writes the disc image fscheck builds in memory (see
+ * tools/host/isoimage.h), so mkindex can patch it and fscheck can check
+ * the index without mkisofs.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++14 -O2 -Itools/host -I. tools/mkimage.cpp \
+ *     tools/host/isoimage.cpp -o mkimage
+ *
+ * Usage:
+ *   mkimage <cd directory> <image.iso>
+ */
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "host/isoimage.h"
+
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <cd directory> <image.iso>\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<IsoImageFile> files;
+  if (IsoImage::readDirectory(argv[1], &files) != 0 || files.empty()) {
+    fprintf(stderr, "Can't read %s\n", argv[1]);
+    return 1;
+  }
+
+  const std::vector<uint8_t> image = IsoImage::build(files);
+
+  FILE *handle = fopen(argv[2], "wb");
+  if (handle == nullptr) {
+    fprintf(stderr, "Unable to create %s\n", argv[2]);
+    return 1;
+  }
+
+  const bool written = fwrite(image.data(), 1, image.size(), handle) ==
+    image.size();
+
+  fclose(handle);
+
+  if (!written) {
+    fprintf(stderr, "%s: write failed\n", argv[2]);
+    return 1;
+  }
+
+  printf("%s: %zu files, %zu sectors\n", argv[2], files.size(),
+    image.size() / 2048);
+
+  return 0;
+}
@@ -0,0 +1,461 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+/*
+ * Host tool that precomputes the file index loaded by
+ * CdBlock::loadHeaderTableIndex, so Filesystem::initialize does not have
+ * to scan any directory.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++14 -O2 -I. tools/mkindex.cpp crc32.cpp lzss.cpp -o mkindex
+ *
+ * Pass the same -DHASH_VERSION as the Saturn build.
+ *
+ * Usage:
+ *   mkindex placeholder <cd directory>
+ *     Write an empty FILES.IDX in the cd directory with room for every
+ *     file in it (the index included). Run before building the image.
+ *
+ *   mkindex patch <image.iso> [packed list]
+ *     Scan the built image and write the index over the FILES.IDX extent.
+ *     The files of the packed list (written by lzsspack -l) are marked as
+ *     LZSS containers, once checked to hold a whole one, no other file
+ *     is. An image without a patched index still boots, Filesystem falls
+ *     back to scanning the directories.
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "crc32.h"
+#include "fileindex.h"
+#include "filehash.h"
+#include "lzss.h"
+
+
+namespace {
+
+
+const uint32_t SECTOR_SIZE = 2048;
+
+struct Image {
+  FILE *handle;
+};
+
+bool readSector(Image *image, uint32_t lba, uint8_t *sector) {
+  if (fseek(image->handle, (long) lba * SECTOR_SIZE, SEEK_SET) != 0)
+    return false;
+
+  return fread(sector, 1, SECTOR_SIZE, image->handle) == SECTOR_SIZE;
+}
+
+// Both endian ISO9660 fields, the little endian copy comes first.
+uint32_t readBoth32(const uint8_t *data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) | 
+    ((uint32_t) data[3] << 24);
+}
+
+void writeBig32(uint8_t *data, uint32_t value) {
+  data[0] = value >> 24;
+  data[1] = value >> 16;
+  data[2] = value >> 8;
+  data[3] = value;
+}
+
+/**
+ * Directory record fields we care about.
+ */
+struct Record {
+  uint32_t lba;
+  uint32_t size;
+  bool isDirectory;
+  std::string identifier;
+};
+
+Record parseRecord(const uint8_t *data) {
+  Record record;
+  record.lba = readBoth32(data + 2);
+  record.size = readBoth32(data + 10);
+  record.isDirectory = (data[25] & 0x02) != 0;
+  record.identifier.assign((const char*) data + 33, data[32]);
+
+  return record;
+}
+
+/**
+ * Visit every record of a directory extent, '.' and '..' excluded.
+ */
+template <typename F>
+bool forEachRecord(Image *image, uint32_t lba, uint32_t size, F function) {
+  const uint32_t numSectors = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+
+  uint8_t sector[SECTOR_SIZE];
+  for (uint32_t i = 0; i < numSectors; ++i) {
+    if (!readSector(image, lba + i, sector))
+      return false;
+
+    uint32_t offset = 0;
+    while (offset < SECTOR_SIZE && sector[offset] != 0) {
+      const uint8_t *data = sector + offset;
+      offset += data[0];
+
+      const bool isSelfOrParent = (data[32] == 1 && data[33] <= 1);
+      if (!isSelfOrParent)
+        function(parseRecord(data));
+    }
+  }
+
+  return true;
+}
+
+bool readFileData(Image *image, const FileIndexEntry& entry,
+  std::vector<uint8_t> *data) {
+
+  const uint32_t numSectors = (entry.size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+  data->resize(numSectors * SECTOR_SIZE);
+
+  for (uint32_t i = 0; i < numSectors; ++i) {
+    if (!readSector(image, entry.lba + i, data->data() + i * SECTOR_SIZE))
+      return false;
+  }
+
+  data->resize(entry.size);
+  return true;
+}
+
+/**
+ * Check that a file holds a whole LZSS container: a valid header, and 
+ * blocks adding up to the original size that end with the file.
+ */
+bool isContainer(Image *image, const FileIndexEntry& entry) {
+  std::vector<uint8_t> data;
+  LzssHeader header;
+
+  if (entry.size < LZSS_HEADER_SIZE || !readFileData(image, entry, &data) ||
+    !Lzss::readHeader(data.data(), &header)) {
+
+    return false;
+  }
+
+  uint32_t offset = LZSS_HEADER_SIZE;
+  for (uint32_t i = 0; i < Lzss::getNumBlocks(&header); ++i) {
+    if (data.size() - offset < LZSS_BLOCK_HEADER_SIZE)
+      return false;
+
+    const uint8_t *block = data.data() + offset;
+    const uint32_t payloadSize = Lzss::getPayloadSize(block);
+
+    if ((Lzss::readWord(block) & LZSS_STORED_BLOCK) &&
+      payloadSize != Lzss::getBlockSize(&header, i)) {
+
+      return false;
+    }
+
+    if (data.size() - offset - LZSS_BLOCK_HEADER_SIZE < payloadSize)
+      return false;
+
+    offset += LZSS_BLOCK_HEADER_SIZE + payloadSize;
+  }
+
+  return offset == data.size();
+}
+
+/**
+ * Filename hashes of the disc paths of a packed list, a line each.
+ */
+bool readPackedList(const char *listPath, 
+  std::map<uint32_t, std::string> *packedFiles) {
+
+  FILE *handle = fopen(listPath, "r");
+  if (handle == nullptr)
+    return false;
+
+  char line[1024];
+  while (fgets(line, sizeof(line), handle) != nullptr) {
+    std::string path = line;
+    while (!path.empty() && (path.back() == '\n' || path.back() == '\r'))
+      path.pop_back();
+
+    if (!path.empty()) {
+      (*packedFiles)[CdBlock::getFilenameHash(path.c_str(), path.size())] =
+        path;
+    }
+  }
+
+  fclose(handle);
+  return true;
+}
+
+/**
+ * Same hashing scheme as fillHeaderTableEntry in cdblock.cpp.
+ */
+bool scanDirectory(Image *image, uint32_t lba, uint32_t size, 
+  uint32_t parentHash, uint32_t parentPrime, 
+  std::vector<FileIndexEntry> *entries, std::vector<Record> *rootFiles) {
+
+  std::vector<Record> records;
+  if (!forEachRecord(image, lba, size, 
+    [&records](const Record& record) { records.push_back(record); })) {
+
+    return false;
+  }
+
+  for (const Record& record : records) {
+
+    // -2 takes into account ';1'
+    uint32_t identifierSize = record.identifier.size();
+    if (!record.isDirectory && identifierSize > 2)
+      identifierSize -= 2;
+
+    uint32_t lastPrime = 0;
+    uint32_t hash = CdBlock::generateHash(record.identifier.c_str(), 
+      identifierSize, parentHash, parentPrime, HASH_PRIME, &lastPrime);
+
+    if (record.isDirectory) {
+      hash = CdBlock::generateHash("/", 1, hash, lastPrime, HASH_PRIME, 
+        &lastPrime);
+
+      if (!scanDirectory(image, record.lba, record.size, hash, lastPrime, 
+        entries, nullptr)) {
+
+        return false;
+      }
+
+    } else {
+      entries->push_back({ hash, record.lba, record.size });
+
+      if (rootFiles != nullptr) {
+        Record rootFile = record;
+        rootFile.identifier.resize(identifierSize);
+        rootFiles->push_back(rootFile);
+      }
+    }
+  }
+
+  return true;
+}
+
+uint32_t countFiles(const std::string& path) {
+  DIR *directory = opendir(path.c_str());
+  if (directory == nullptr)
+    return 0;
+
+  uint32_t numFiles = 0;
+  while (struct dirent *entry = readdir(directory)) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+
+    const std::string childPath = path + "/" + entry->d_name;
+
+    struct stat childStat;
+    if (stat(childPath.c_str(), &childStat) != 0)
+      continue;
+
+    if (S_ISDIR(childStat.st_mode))
+      numFiles += countFiles(childPath);
+    else if (strcmp(entry->d_name, FILE_INDEX_FILENAME) != 0)
+      numFiles++;
+  }
+
+  closedir(directory);
+  return numFiles;
+}
+
+int writePlaceholder(const char *cdPath) {
+  // Every file plus the index itself.
+  const uint32_t numEntries = countFiles(cdPath) + 1;
+  const uint32_t indexSize = sizeof(FileIndexHeader) + 
+    numEntries * sizeof(FileIndexEntry);
+
+  const std::string indexPath = std::string(cdPath) + "/" + 
+    FILE_INDEX_FILENAME;
+
+  FILE *handle = fopen(indexPath.c_str(), "wb");
+  if (handle == nullptr) {
+    fprintf(stderr, "Unable to create %s\n", indexPath.c_str());
+    return 1;
+  }
+
+  std::vector<uint8_t> zeroes(indexSize, 0);
+  fwrite(zeroes.data(), 1, zeroes.size(), handle);
+  fclose(handle);
+
+  printf("%s: room for %u entries (%u bytes)\n", indexPath.c_str(), 
+    numEntries, indexSize);
+
+  return 0;
+}
+
+int patchImage(const char *imagePath, const char *listPath) {
+  std::map<uint32_t, std::string> packedFiles;
+  if (listPath != nullptr && !readPackedList(listPath, &packedFiles)) {
+    fprintf(stderr, "Unable to read %s\n", listPath);
+    return 1;
+  }
+
+  Image image;
+  image.handle = fopen(imagePath, "r+b");
+  if (image.handle == nullptr) {
+    fprintf(stderr, "Unable to open %s\n", imagePath);
+    return 1;
+  }
+
+  // Find Primary Volume Descriptor.
+  uint8_t sector[SECTOR_SIZE];
+  uint32_t lba = 16;
+  for (;;) {
+    if (!readSector(&image, lba, sector) || sector[0] == 0xFF) {
+      fprintf(stderr, "%s: no primary volume descriptor\n", imagePath);
+      fclose(image.handle);
+      return 1;
+    }
+
+    if (sector[0] == 1)
+      break;
+
+    lba++;
+  }
+
+  const Record root = parseRecord(sector + 156);
+
+  std::vector<FileIndexEntry> entries;
+  std::vector<Record> rootFiles;
+  if (!scanDirectory(&image, root.lba, root.size, HASH_SEED, HASH_PRIME, 
+    &entries, &rootFiles)) {
+
+    fprintf(stderr, "%s: unable to read directories\n", imagePath);
+    fclose(image.handle);
+    return 1;
+  }
+
+  auto indexFile = std::find_if(rootFiles.begin(), rootFiles.end(), 
+    [](const Record& record) { 
+      return record.identifier == FILE_INDEX_FILENAME; 
+    });
+
+  if (indexFile == rootFiles.end()) {
+    fprintf(stderr, "%s: no %s in the root directory, run placeholder "
+      "first\n", imagePath, FILE_INDEX_FILENAME);
+
+    fclose(image.handle);
+    return 1;
+  }
+
+  std::sort(entries.begin(), entries.end(), 
+    [](const FileIndexEntry& a, const FileIndexEntry& b) {
+      return a.filenameHash < b.filenameHash;
+    });
+
+  for (size_t i = 1; i < entries.size(); ++i) {
+    if (entries[i - 1].filenameHash == entries[i].filenameHash) {
+      fprintf(stderr, "%s: hash collision (%u)\n", imagePath, 
+        entries[i].filenameHash);
+
+      fclose(image.handle);
+      return 1;
+    }
+  }
+
+  const uint32_t indexSize = sizeof(FileIndexHeader) + 
+    entries.size() * sizeof(FileIndexEntry);
+
+  if (indexSize > indexFile->size) {
+    fprintf(stderr, "%s: %s holds %u bytes, %u needed. Run placeholder "
+      "again and rebuild the image\n", imagePath, FILE_INDEX_FILENAME, 
+      indexFile->size, indexSize);
+
+    fclose(image.handle);
+    return 1;
+  }
+
+  // Serialize as the Saturn sees it (big endian).
+  std::vector<uint8_t> index(indexFile->size, 0);
+  uint8_t *entryData = index.data() + sizeof(FileIndexHeader);
+  uint32_t numPackedFiles = 0;
+
+  for (const FileIndexEntry& entry : entries) {
+    uint32_t size = entry.size;
+
+    auto packedFile = packedFiles.find(entry.filenameHash);
+    if (packedFile != packedFiles.end()) {
+      if (!isContainer(&image, entry)) {
+        fprintf(stderr, "%s: %s is not an LZSS container\n", imagePath,
+          packedFile->second.c_str());
+
+        fclose(image.handle);
+        return 1;
+      }
+
+      packedFiles.erase(packedFile);
+      size |= FILE_INDEX_PACKED;
+      numPackedFiles++;
+    }
+
+    writeBig32(entryData + 0, entry.filenameHash);
+    writeBig32(entryData + 4, entry.lba);
+    writeBig32(entryData + 8, size);
+    entryData += sizeof(FileIndexEntry);
+  }
+
+  if (!packedFiles.empty()) {
+    fprintf(stderr, "%s: %s is not on the image\n", imagePath,
+      packedFiles.begin()->second.c_str());
+
+    fclose(image.handle);
+    return 1;
+  }
+
+  const crc32_t checksum = crc32_finalize(crc32_update(crc32_init(), 
+    index.data() + sizeof(FileIndexHeader), 
+    entries.size() * sizeof(FileIndexEntry)));
+
+  writeBig32(index.data() + 0, FILE_INDEX_MAGIC);
+  writeBig32(index.data() + 4, FILE_INDEX_VERSION);
+  writeBig32(index.data() + 8, HASH_VERSION);
+  writeBig32(index.data() + 12, entries.size());
+  writeBig32(index.data() + 16, checksum);
+
+  fseek(image.handle, (long) indexFile->lba * SECTOR_SIZE, SEEK_SET);
+  const bool written = fwrite(index.data(), 1, index.size(), 
+    image.handle) == index.size();
+
+  fclose(image.handle);
+
+  if (!written) {
+    fprintf(stderr, "%s: write failed\n", imagePath);
+    return 1;
+  }
+
+  printf("%s: indexed %u files (%u packed)\n", imagePath, 
+    (uint32_t) entries.size(), numPackedFiles);
+  return 0;
+}
+
+
+} // namespace ''
+
+
+int main(int argc, char **argv) {
+  if (argc == 3 && strcmp(argv[1], "placeholder") == 0)
+    return writePlaceholder(argv[2]);
+
+  if ((argc == 3 || argc == 4) && strcmp(argv[1], "patch") == 0)
+    return patchImage(argv[2], (argc == 4) ? argv[3] : nullptr);
+
+  fprintf(stderr, "Usage: %s placeholder <cd directory>\n"
+                  "       %s patch <image.iso> [packed list]\n", argv[0], 
+                  argv[0]);
+  return 1;
+}
@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+/*
+ * Host tool that checks the sorts of sort.h and the searches of search.h
+ * against std::sort and std::lower_bound, over random, sorted, reverse,
+ * all equal and few distinct inputs of every small length and a few
+ * large ones, then times them against the standard library.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++14 -O2 -I. tools/sortbench.cpp -o sortbench
+ *
+ * Usage:
+ *   sortbench [elements]
+ *     Length of the timed arrays, 100000 by default.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "search.h"
+#include "sort.h"
+
+
+namespace {
+
+
+enum class Input {
+  RANDOM,
+  SORTED,
+  REVERSE,
+  ALL_EQUAL,
+  FEW_DISTINCT
+};
+
+const Input inputs[] = {
+  Input::RANDOM,
+  Input::SORTED,
+  Input::REVERSE,
+  Input::ALL_EQUAL,
+  Input::FEW_DISTINCT
+};
+
+const char *getInputName(Input input) {
+  switch (input) {
+  case Input::RANDOM: return "random";
+  case Input::SORTED: return "sorted";
+  case Input::REVERSE: return "reverse";
+  case Input::ALL_EQUAL: return "all equal";
+  case Input::FEW_DISTINCT: return "few distinct";
+  }
+
+  return "";
+}
+
+std::vector<uint32_t> makeInput(Input input, uint32_t length,
+  std::mt19937 *random) {
+
+  std::vector<uint32_t> values(length);
+  for (uint32_t& value : values)
+    value = (*random)();
+
+  switch (input) {
+  case Input::RANDOM:
+    break;
+
+  case Input::SORTED:
+    std::sort(values.begin(), values.end());
+    break;
+
+  case Input::REVERSE:
+    std::sort(values.begin(), values.end(), std::greater<uint32_t>());
+    break;
+
+  case Input::ALL_EQUAL:
+    std::fill(values.begin(), values.end(), 0x80000000);
+    break;
+
+  case Input::FEW_DISTINCT:
+    for (uint32_t& value : values)
+      value %= 4;
+    break;
+  }
+
+  return values;
+}
+
+uint32_t numFailures = 0;
+
+void fail(Input input, uint32_t length, const char *what) {
+  printf("%s, %u elements: %s\n", getInputName(input), length, what);
+  numFailures++;
+}
+
+/**
+ * Hoare partition must leave both halves non empty, with nothing in the
+ * lower one greater than anything in the upper one.
+ */
+void checkPartition(Input input, const std::vector<uint32_t>& values) {
+  const uint32_t length = values.size();
+  if (length < 2)
+    return;
+
+  std::vector<uint32_t> partitioned = values;
+  const uint32_t split = CdBlock::partition(partitioned.data(), length);
+
+  if (split + 1 >= length) {
+    fail(input, length, "partition left an empty half");
+    return;
+  }
+
+  const uint32_t lowerMax = *std::max_element(partitioned.begin(),
+    partitioned.begin() + split + 1);
+
+  const uint32_t upperMin = *std::min_element(
+    partitioned.begin() + split + 1, partitioned.end());
+
+  if (lowerMax > upperMin)
+    fail(input, length, "partition halves overlap");
+
+  std::sort(partitioned.begin(), partitioned.end());
+  std::vector<uint32_t> sorted = values;
+  std::sort(sorted.begin(), sorted.end());
+
+  if (partitioned != sorted)
+    fail(input, length, "partition lost elements");
+}
+
+void checkSorts(Input input, const std::vector<uint32_t>& values) {
+  const uint32_t length = values.size();
+
+  std::vector<uint32_t> expected = values;
+  std::sort(expected.begin(), expected.end());
+
+  std::vector<uint32_t> sorted = values;
+  CdBlock::introSort(sorted.data(), length);
+  if (sorted != expected)
+    fail(input, length, "introSort differs from std::sort");
+
+  sorted = values;
+  CdBlock::heapSort(sorted.data(), length);
+  if (sorted != expected)
+    fail(input, length, "heapSort differs from std::sort");
+
+  if (length <= 64) {
+    sorted = values;
+    CdBlock::insertionSort(sorted.data(), length);
+    if (sorted != expected)
+      fail(input, length, "insertionSort differs from std::sort");
+  }
+
+  checkPartition(input, values);
+}
+
+/**
+ * Every element, its neighbours and both extremes must give the index
+ * std::lower_bound gives, through lowerBound and the Eytzinger tree.
+ */
+void checkSearches(Input input, const std::vector<uint32_t>& values) {
+  const uint32_t length = values.size();
+
+  std::vector<uint32_t> sorted = values;
+  std::sort(sorted.begin(), sorted.end());
+
+  std::vector<uint32_t> tree(length + 1);
+  std::vector<uint32_t> indices(length + 1);
+  CdBlock::fillEytzinger(sorted.data(), length, tree.data(), indices.data());
+
+  std::vector<uint32_t> queries = { 0, UINT32_MAX };
+  for (uint32_t value : sorted) {
+    queries.push_back(value - 1);
+    queries.push_back(value);
+    queries.push_back(value + 1);
+  }
+
+  for (uint32_t query : queries) {
+    const uint32_t expected = std::lower_bound(sorted.begin(), sorted.end(),
+      query) - sorted.begin();
+
+    if (CdBlock::lowerBound(sorted.data(), length, query) - sorted.data() !=
+      expected) {
+
+      fail(input, length, "lowerBound differs from std::lower_bound");
+      return;
+    }
+
+    if (CdBlock::eytzingerLowerBound(tree.data(), indices.data(), length,
+      query) != expected) {
+
+      fail(input, length, "eytzingerLowerBound differs from "
+        "std::lower_bound");
+
+      return;
+    }
+
+    uint32_t *found = nullptr;
+    CdBlock::binarySearch(sorted.data(), length, query, &found);
+
+    const bool present = expected < length && sorted[expected] == query;
+    if (found != (present ? sorted.data() + expected : nullptr)) {
+      fail(input, length, "binarySearch differs from std::lower_bound");
+      return;
+    }
+  }
+}
+
+template <typename F>
+double timeMilliseconds(F function) {
+  const auto start = std::chrono::steady_clock::now();
+  function();
+
+  const std::chrono::duration<double, std::milli> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  return elapsed.count();
+}
+
+void timeSorts(Input input, uint32_t length, std::mt19937 *random) {
+  const std::vector<uint32_t> values = makeInput(input, length, random);
+
+  std::vector<uint32_t> sorted = values;
+  const double introSortTime = timeMilliseconds([&]() {
+    CdBlock::introSort(sorted.data(), length);
+  });
+
+  sorted = values;
+  const double heapSortTime = timeMilliseconds([&]() {
+    CdBlock::heapSort(sorted.data(), length);
+  });
+
+  sorted = values;
+  const double stdSortTime = timeMilliseconds([&]() {
+    std::sort(sorted.begin(), sorted.end());
+  });
+
+  printf("%-13s %9.2f ms %9.2f ms %9.2f ms\n", getInputName(input),
+    introSortTime, heapSortTime, stdSortTime);
+}
+
+void timeSearches(uint32_t length, std::mt19937 *random) {
+  std::vector<uint32_t> sorted = makeInput(Input::SORTED, length, random);
+  std::vector<uint32_t> tree(length + 1);
+  std::vector<uint32_t> indices(length + 1);
+  CdBlock::fillEytzinger(sorted.data(), length, tree.data(), indices.data());
+
+  // Half of the lookups find their element.
+  std::vector<uint32_t> queries(1000000);
+  for (uint32_t i = 0; i < queries.size(); ++i)
+    queries[i] = (i % 2) ? (*random)() : sorted[(*random)() % length];
+
+  volatile uint32_t sink = 0;
+
+  const double lowerBoundTime = timeMilliseconds([&]() {
+    for (uint32_t query : queries)
+      sink += CdBlock::lowerBound(sorted.data(), length, query) -
+        sorted.data();
+  });
+
+  const double eytzingerTime = timeMilliseconds([&]() {
+    for (uint32_t query : queries)
+      sink += CdBlock::eytzingerLowerBound(tree.data(), indices.data(),
+        length, query);
+  });
+
+  const double stdLowerBoundTime = timeMilliseconds([&]() {
+    for (uint32_t query : queries)
+      sink += std::lower_bound(sorted.begin(), sorted.end(), query) -
+        sorted.begin();
+  });
+
+  (void) sink;
+  printf("%zu lookups: lowerBound %.2f ms, eytzingerLowerBound %.2f ms, "
+    "std::lower_bound %.2f ms\n", queries.size(), lowerBoundTime,
+    eytzingerTime, stdLowerBoundTime);
+}
+
+
+} // namespace ''
+
+int main(int argc, char **argv) {
+  const uint32_t length = (argc > 1) ? strtoul(argv[1], nullptr, 0) : 100000;
+  if (length == 0) {
+    fprintf(stderr, "Usage: %s [elements]\n", argv[0]);
+    return 1;
+  }
+
+  std::mt19937 random(1);
+
+  // Every length around the insertion sort cutoff and the tree levels.
+  std::vector<uint32_t> lengths;
+  for (uint32_t i = 0; i <= 70; ++i)
+    lengths.push_back(i);
+
+  for (uint32_t i : { 127, 128, 129, 1000, 4095, 4097 })
+    lengths.push_back(i);
+
+  for (Input input : inputs) {
+    for (uint32_t checkedLength : lengths) {
+      const std::vector<uint32_t> values = makeInput(input, checkedLength,
+        &random);
+
+      checkSorts(input, values);
+      checkSearches(input, values);
+    }
+  }
+
+  printf("sorts and searches: %s\n", numFailures == 0 ? "ok" : "FAILED");
+
+  printf("%u elements      introSort      heapSort     std::sort\n", length);
+  for (Input input : inputs)
+    timeSorts(input, length, &random);
+
+  timeSearches(length, &random);
+
+  return numFailures != 0;
+}
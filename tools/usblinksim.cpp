@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+/*
+ * Host tool that runs the USB block protocol (usbtransfer.h) over a
+ * simulated cart link flipping bits at a given rate, to measure the
+ * throughput left under errors. The sender runs in a child process and
+ * the receiver in the parent, connected by pipes.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++14 -O2 -I. tools/usblinksim.cpp usbtransfer.cpp crc32.cpp \
+ *     -o usblinksim
+ *
+ * Usage:
+ *   usblinksim <bit error rate> [file size] [transfers]
+ *     Sends transfers files of file size bytes (1MB and 16 by default)
+ *     and checks every byte received. Throughput assumes LINK_BYTES_PER_
+ *     SECOND on the wire and LINK_TURNAROUND_SECONDS for every reply. The
+ *     single CRC protocol is estimated for comparison, as resending the
+ *     whole file until one copy arrives intact.
+ *
+ *   usblinksim -r
+ *     Regression runs, damaging the header of a short last block and a
+ *     reply on purpose, then at fixed error rates. Exits 0 if every file
+ *     arrived intact or failed cleanly, without the link losing sync.
+ */
+
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "usbtransfer.h"
+
+
+namespace {
+
+
+const double LINK_BYTES_PER_SECOND = 1000000.0;
+const double LINK_TURNAROUND_SECONDS = 0.001;
+
+// Stream offsets, in bytes: a transfer starts with the size and its CRC,
+// every block with its sequence number and length, replies are a word.
+const uint64_t SIZE_HEADER_BYTES = 8;
+const uint64_t BLOCK_OVERHEAD_BYTES = 12;
+const uint64_t REPLY_BYTES = 4;
+
+// Give up when the link stays silent, the two sides lost sync.
+const int LINK_TIMEOUT_MS = 5000;
+
+struct Endpoint {
+  int readFd;
+  int writeFd;
+
+  std::vector<uint8_t> pending;
+  std::vector<uint8_t> received;
+  size_t receivedPos;
+
+  // Bits left until the next flipped one.
+  double bitErrorRate;
+  uint64_t bitsToError;
+  std::mt19937_64 random;
+
+  // Bits flipped on top, counted from the start of the stream.
+  std::vector<uint64_t> forcedBits;
+
+  uint64_t bytesSent;
+  uint64_t bytesRead;
+} endpoint;
+
+uint64_t drawBitsToError() {
+  if (endpoint.bitErrorRate <= 0.0)
+    return UINT64_MAX;
+
+  std::geometric_distribution<uint64_t> distance(endpoint.bitErrorRate);
+  return distance(endpoint.random);
+}
+
+void flush() {
+  uint64_t position = endpoint.bytesSent * 8;
+
+  for (uint8_t& byte : endpoint.pending) {
+    for (uint64_t bit : endpoint.forcedBits) {
+      if (bit >= position && bit < position + 8)
+        byte ^= 1 << (bit - position);
+    }
+
+    position += 8;
+
+    while (endpoint.bitsToError < 8) {
+      byte ^= 1 << endpoint.bitsToError;
+      endpoint.bitsToError += 1 + drawBitsToError();
+    }
+
+    endpoint.bitsToError -= 8;
+  }
+
+  size_t offset = 0;
+  while (offset < endpoint.pending.size()) {
+    const ssize_t written = write(endpoint.writeFd,
+      endpoint.pending.data() + offset, endpoint.pending.size() - offset);
+
+    if (written <= 0)
+      exit(1);
+
+    offset += written;
+  }
+
+  endpoint.bytesSent += endpoint.pending.size();
+  endpoint.pending.clear();
+}
+
+uint8_t readByte() {
+  if (endpoint.receivedPos == endpoint.received.size()) {
+
+    // The other side is waiting for what we wrote so far.
+    flush();
+
+    struct pollfd descriptor = { endpoint.readFd, POLLIN, 0 };
+    if (poll(&descriptor, 1, LINK_TIMEOUT_MS) <= 0) {
+      fprintf(stderr, "Link lost sync\n");
+      exit(2);
+    }
+
+    uint8_t chunk[65536];
+    const ssize_t numRead = read(endpoint.readFd, chunk, sizeof(chunk));
+    if (numRead <= 0)
+      exit(1);
+
+    endpoint.received.assign(chunk, chunk + numRead);
+    endpoint.receivedPos = 0;
+  }
+
+  endpoint.bytesRead++;
+  return endpoint.received[endpoint.receivedPos++];
+}
+
+uint32_t readLong() {
+  uint32_t word = 0;
+  for (uint32_t i = 0; i < 4; ++i)
+    word = (word << 8) | readByte();
+
+  return word;
+}
+
+void sendByte(uint8_t byte) {
+  endpoint.pending.push_back(byte);
+}
+
+void sendLong(uint32_t word) {
+  for (int32_t shift = 24; shift >= 0; shift -= 8)
+    sendByte(word >> shift);
+}
+
+const UsbLink simulatedLink = { readByte, readLong, sendByte, sendLong };
+
+std::vector<uint8_t> makeFile(uint32_t size, uint32_t transfer) {
+  std::mt19937 random(transfer);
+  std::vector<uint8_t> data(size);
+
+  for (uint8_t& byte : data)
+    byte = random();
+
+  return data;
+}
+
+void openEndpoint(int readFd, int writeFd, double bitErrorRate,
+  uint64_t seed, const std::vector<uint64_t>& forcedBits) {
+
+  endpoint.readFd = readFd;
+  endpoint.writeFd = writeFd;
+  endpoint.pending.clear();
+  endpoint.received.clear();
+  endpoint.receivedPos = 0;
+  endpoint.bitErrorRate = bitErrorRate;
+  endpoint.random.seed(seed);
+  endpoint.bitsToError = drawBitsToError();
+  endpoint.forcedBits = forcedBits;
+  endpoint.bytesSent = 0;
+  endpoint.bytesRead = 0;
+}
+
+struct Simulation {
+  uint32_t numIntact;
+  uint32_t numCorrupted;
+  double wireBytes;
+  UsbTransferStatistics stats;
+};
+
+/**
+ * Send numTransfers files of fileSize bytes over a link flipping bits at
+ * bitErrorRate, and the given bits of the sender and receiver streams.
+ * Exits if the link loses sync.
+ */
+void simulate(double bitErrorRate, uint32_t fileSize, uint32_t numTransfers,
+  const std::vector<uint64_t>& senderBits,
+  const std::vector<uint64_t>& receiverBits, Simulation *simulation) {
+
+  int toReceiver[2];
+  int toSender[2];
+  if (pipe(toReceiver) != 0 || pipe(toSender) != 0)
+    exit(1);
+
+  fflush(stdout);
+
+  const pid_t sender = fork();
+  if (sender == 0) {
+    openEndpoint(toSender[0], toReceiver[1], bitErrorRate, 1, senderBits);
+
+    for (uint32_t i = 0; i < numTransfers; ++i) {
+      const std::vector<uint8_t> data = makeFile(fileSize, i);
+      UsbTransfer::sendFile(&simulatedLink, data.data(), fileSize);
+    }
+
+    flush();
+    _exit(0);
+  }
+
+  openEndpoint(toReceiver[0], toSender[1], bitErrorRate, 2, receiverBits);
+  UsbTransfer::resetStatistics();
+
+  simulation->numIntact = 0;
+  simulation->numCorrupted = 0;
+  std::vector<uint8_t> buffer(fileSize);
+
+  for (uint32_t i = 0; i < numTransfers; ++i) {
+    uint32_t size = 0;
+    if (UsbTransfer::receiveSize(&simulatedLink, &size) != 0)
+      continue;
+
+    if (size != fileSize) {
+      fprintf(stderr, "Transfer %u: size %u arrived as %u\n", i, fileSize,
+        size);
+
+      kill(sender, SIGKILL);
+      exit(1);
+    }
+
+    if (UsbTransfer::receiveBlocks(&simulatedLink, buffer.data(), size) != 0)
+      continue;
+
+    if (buffer == makeFile(fileSize, i))
+      simulation->numIntact++;
+    else
+      simulation->numCorrupted++;
+  }
+
+  flush();
+  waitpid(sender, nullptr, 0);
+
+  for (int fd : { toReceiver[0], toReceiver[1], toSender[0], toSender[1] })
+    close(fd);
+
+  UsbTransfer::getStatistics(&simulation->stats);
+  simulation->wireBytes = endpoint.bytesRead + endpoint.bytesSent;
+}
+
+/**
+ * @return true If no file arrived corrupted and, with allIntact, none
+ *   failed either.
+ */
+bool checkSimulation(const char *name, const Simulation& simulation,
+  bool allIntact) {
+
+  const bool passed = (simulation.numCorrupted == 0) &&
+    (!allIntact || simulation.stats.failedTransfers == 0);
+
+  printf("%-32s intact %5u, corrupted %u, failed %5u: %s\n", name,
+    simulation.numIntact, simulation.numCorrupted,
+    simulation.stats.failedTransfers, passed ? "ok" : "FAILED");
+
+  return passed;
+}
+
+int runRegressions() {
+  // A short last block after a full one.
+  const uint32_t fileSize = USB_TRANSFER_BLOCK_SIZE + 100;
+  const uint64_t lastBlock = SIZE_HEADER_BYTES + BLOCK_OVERHEAD_BYTES +
+    USB_TRANSFER_BLOCK_SIZE;
+
+  const uint64_t blockReply = REPLY_BYTES;
+  const std::vector<uint64_t> noBits;
+
+  Simulation simulation;
+  bool passed = true;
+
+  // Sequence number 1 arriving as 0, once taken as a repeat of the full
+  // first block and waiting for its size.
+  simulate(0.0, fileSize, 1, { (lastBlock + 3) * 8 }, noBits, &simulation);
+  passed &= checkSimulation("damaged last block sequence", simulation,
+    true);
+
+  simulate(0.0, fileSize, 1, { (lastBlock + 7) * 8 }, noBits, &simulation);
+  passed &= checkSimulation("damaged last block length", simulation, true);
+
+  simulate(0.0, fileSize, 1, { (lastBlock + 3) * 8, (lastBlock + 7) * 8 },
+    noBits, &simulation);
+
+  passed &= checkSimulation("damaged last block header", simulation, true);
+
+  // ACK of the first block unreadable, it's sent again.
+  std::vector<uint64_t> replyBits;
+  for (uint64_t byte = blockReply; byte < blockReply + 3; ++byte) {
+    replyBits.push_back(byte * 8);
+    replyBits.push_back(byte * 8 + 1);
+  }
+
+  simulate(0.0, fileSize, 1, noBits, replyBits, &simulation);
+  passed &= checkSimulation("damaged block reply", simulation, true);
+
+  simulate(1e-5, fileSize, 2000, noBits, noBits, &simulation);
+  passed &= checkSimulation("bit error rate 1e-5", simulation, true);
+
+  // Hardly any block gets through intact, transfers just have to fail.
+  simulate(3e-4, fileSize, 2000, noBits, noBits, &simulation);
+  passed &= checkSimulation("bit error rate 3e-4", simulation, false);
+
+  return passed ? 0 : 1;
+}
+
+
+} // namespace ''
+
+int main(int argc, char **argv) {
+  if (argc == 2 && strcmp(argv[1], "-r") == 0)
+    return runRegressions();
+
+  if (argc < 2 || argc > 4) {
+    fprintf(stderr, "Usage: %s <bit error rate> [file size] [transfers]\n"
+      "       %s -r\n", argv[0], argv[0]);
+
+    return 1;
+  }
+
+  const double bitErrorRate = atof(argv[1]);
+  const uint32_t fileSize = (argc > 2) ? strtoul(argv[2], nullptr, 0) :
+    1024 * 1024;
+
+  const uint32_t numTransfers = (argc > 3) ? strtoul(argv[3], nullptr, 0) :
+    16;
+
+  Simulation simulation;
+  simulate(bitErrorRate, fileSize, numTransfers, {}, {}, &simulation);
+
+  const UsbTransferStatistics& stats = simulation.stats;
+  const double payloadBytes = (double) simulation.numIntact * fileSize;
+  const double wireBytes = simulation.wireBytes;
+  const double seconds = wireBytes / LINK_BYTES_PER_SECOND +
+    (stats.blocksTransferred + stats.blocksRetried) * LINK_TURNAROUND_SECONDS;
+
+  printf("%u transfers of %u bytes at bit error rate %g\n", numTransfers,
+    fileSize, bitErrorRate);
+
+  printf("intact %u, corrupted %u, failed %u\n", simulation.numIntact,
+    simulation.numCorrupted, stats.failedTransfers);
+
+  printf("blocks %u, resent %u, %.0f bytes on the wire\n",
+    stats.blocksTransferred, stats.blocksRetried, wireBytes);
+
+  printf("blocks:     %8.1f KB/s effective\n",
+    (seconds > 0.0) ? payloadBytes / seconds / 1024.0 : 0.0);
+
+  // Whole file and an 8 bit CRC, resent until a copy arrives intact.
+  const double fileBits = 8.0 * (fileSize + 1);
+  const double intactProbability = exp(fileBits * log1p(-bitErrorRate));
+  const double attemptSeconds = (fileSize + 10) / LINK_BYTES_PER_SECOND +
+    LINK_TURNAROUND_SECONDS;
+
+  if (intactProbability > 1e-9) {
+    printf("single CRC: %8.1f KB/s effective (estimated, %.1f attempts)\n",
+      fileSize * intactProbability / attemptSeconds / 1024.0,
+      1.0 / intactProbability);
+
+  } else {
+    printf("single CRC: never completes\n");
+  }
+
+  return simulation.numCorrupted != 0;
+}
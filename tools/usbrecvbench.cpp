@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+/*
+ * Host tool that times the receive loop of the USB block protocol
+ * (usbtransfer.h) against a simulated cart FIFO, with no link errors.
+ * The byte at a time loop followed by a CRC pass over every block is
+ * kept here for comparison with UsbTransfer::receiveBlocks.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++14 -O2 -I. tools/usbrecvbench.cpp usbtransfer.cpp crc32.cpp \
+ *     -o usbrecvbench
+ *
+ * Usage:
+ *   usbrecvbench [file size] [rounds]
+ *     Receives a file of file size bytes (1MB by default) rounds times
+ *     (16 by default) with each loop and prints bytes per second.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "crc32.h"
+#include "usbtransfer.h"
+
+
+namespace {
+
+
+// Simulated cart: every byte read polls the FIFO status first, like
+// usb_cart_byte_read does. usb_cart_long_read is 4 byte reads.
+struct CartFifo {
+  std::vector<uint8_t> data;
+  size_t pos;
+} fifo;
+
+volatile uint8_t fifoStatus = 1;
+
+uint8_t fifoReadByte() {
+  while ((fifoStatus & 1) == 0) {
+  }
+
+  return fifo.data[fifo.pos++];
+}
+
+uint32_t fifoReadLong() {
+  uint32_t word = fifoReadByte() << 24;
+  word |= fifoReadByte() << 16;
+  word |= fifoReadByte() << 8;
+  return word | fifoReadByte();
+}
+
+void fifoSendByte(uint8_t) {
+}
+
+void fifoSendLong(uint32_t) {
+}
+
+// Sender side, records the whole transfer.
+uint8_t captureReadByte() {
+  return USB_TRANSFER_ACK;
+}
+
+uint32_t captureReadLong() {
+  return USB_TRANSFER_ACK * 0x01010101;
+}
+
+void captureSendByte(uint8_t byte) {
+  fifo.data.push_back(byte);
+}
+
+void captureSendLong(uint32_t word) {
+  for (int32_t shift = 24; shift >= 0; shift -= 8)
+    captureSendByte(word >> shift);
+}
+
+const UsbLink fifoLink = {
+  fifoReadByte, fifoReadLong, fifoSendByte, fifoSendLong
+};
+
+const UsbLink captureLink = {
+  captureReadByte, captureReadLong, captureSendByte, captureSendLong
+};
+
+/**
+ * Receive loop before word transfers: every byte on its own, then the
+ * block CRC in a second pass.
+ */
+int receiveBytewise(const UsbLink *link, uint8_t *buffer, uint32_t size) {
+  uint32_t offset = 0;
+  uint32_t sequence = 0;
+
+  while (offset < size) {
+    const uint32_t blockSequence = link->readLong();
+    const uint32_t lengthWord = link->readLong();
+    const uint32_t blockSize = (size - offset < USB_TRANSFER_BLOCK_SIZE) ?
+      size - offset : USB_TRANSFER_BLOCK_SIZE;
+
+    uint8_t *block = buffer + offset;
+    for (uint32_t i = 0; i < blockSize; ++i)
+      block[i] = link->readByte();
+
+    const unsigned char headerBytes[] = {
+      (unsigned char) (blockSequence >> 24),
+      (unsigned char) (blockSequence >> 16),
+      (unsigned char) (blockSequence >> 8), (unsigned char) blockSequence,
+      (unsigned char) (lengthWord >> 24), (unsigned char) (lengthWord >> 16),
+      (unsigned char) (lengthWord >> 8), (unsigned char) lengthWord
+    };
+
+    crc32_t crc = crc32_update(crc32_init(), headerBytes, 8);
+    crc = crc32_update(crc, block, blockSize);
+
+    if (link->readLong() != crc32_finalize(crc) ||
+      blockSequence != sequence || (lengthWord & 0xFFFF) != blockSize) {
+
+      return -1;
+    }
+
+    link->sendLong(USB_TRANSFER_ACK * 0x01010101);
+    offset += blockSize;
+    sequence++;
+  }
+
+  return 0;
+}
+
+typedef int (*ReceiveFunction)(const UsbLink*, uint8_t*, uint32_t);
+
+void timeReceive(const char *name, ReceiveFunction receive,
+  const std::vector<uint8_t>& file, uint32_t rounds) {
+
+  std::vector<uint8_t> buffer(file.size());
+  const auto start = std::chrono::steady_clock::now();
+
+  for (uint32_t i = 0; i < rounds; ++i) {
+    fifo.pos = 0;
+
+    uint32_t size = 0;
+    if (UsbTransfer::receiveSize(&fifoLink, &size) != 0 ||
+      receive(&fifoLink, buffer.data(), size) != 0 || buffer != file) {
+
+      fprintf(stderr, "%s: transfer failed\n", name);
+      exit(1);
+    }
+  }
+
+  const std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  printf("%-10s %8.1f MB/s\n", name,
+    (double) file.size() * rounds / elapsed.count() / (1024 * 1024));
+}
+
+
+} // namespace ''
+
+int main(int argc, char **argv) {
+  const uint32_t fileSize = (argc > 1) ? strtoul(argv[1], nullptr, 0) :
+    1024 * 1024;
+
+  const uint32_t rounds = (argc > 2) ? strtoul(argv[2], nullptr, 0) : 16;
+
+  std::vector<uint8_t> file(fileSize);
+  for (uint32_t i = 0; i < fileSize; ++i)
+    file[i] = (uint8_t) (i * 2654435761u >> 24);
+
+  UsbTransfer::sendFile(&captureLink, file.data(), fileSize);
+
+  timeReceive("bytewise", receiveBytewise, file, rounds);
+  timeReceive("words", UsbTransfer::receiveBlocks, file, rounds);
+
+  return 0;
+}
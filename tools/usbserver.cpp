@@ -0,0 +1,865 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+/*
+ * Reference USB host of FilesystemBackend::USB, serving the files of a cd
+ * directory to the Saturn with the commands of usbtransfer.h. Files are
+ * read again on every request, edits show up without restarting.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++14 -O2 -I. tools/usbserver.cpp usbtransfer.cpp crc.cpp \
+ *     crc32.cpp -o usbserver
+ *
+ * Pass the same -DHASH_VERSION as the Saturn build.
+ *
+ * Usage:
+ *   usbserver <cd directory> <device>
+ *     Serve requests arriving on device (the USB cart, or - for stdin and
+ *     stdout) until it is closed.
+ *
+ *   usbserver -c <cd directory>
+ *     Serve a local client, in a child process connected by a socket pair,
+ *     that loads every file as Filesystem::open does: once asking each size
+ *     first, once with the manifest (Filesystem::syncUsbIndex). Every file
+ *     is checked and the request turnarounds and bytes on the link of both
+ *     are compared.
+ *
+ *   usbserver -e <cd directory>
+ *     Copy the cd directory to a temporary one and apply a set of edits to
+ *     every file in it. After each edit a local client brings its copy up
+ *     to date as File::reload does, and checks it. The bytes on the link
+ *     per edit are compared with loading the whole file again.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "crc.h"
+#include "crc32.h"
+#include "filehash.h"
+#include "usbtransfer.h"
+
+
+namespace {
+
+
+// Link model of the comparison, as in usblinksim.
+const double LINK_BYTES_PER_SECOND = 1000000.0;
+const double LINK_TURNAROUND_SECONDS = 0.001;
+
+struct HostFile {
+  std::string path;
+  uint32_t size;
+};
+
+typedef std::map<uint32_t, HostFile> HostFiles;
+
+struct Endpoint {
+  int readFd;
+  int writeFd;
+
+  std::vector<uint8_t> pending;
+  std::vector<uint8_t> received;
+  size_t receivedPos;
+
+  // Exit code once the other side closes the link.
+  int hangupExitCode;
+
+  // Times this side waited for the other one after sending something.
+  uint64_t turnarounds;
+  uint64_t bytesSent;
+  uint64_t bytesRead;
+} endpoint;
+
+void flush() {
+  size_t offset = 0;
+  while (offset < endpoint.pending.size()) {
+    const ssize_t written = write(endpoint.writeFd,
+      endpoint.pending.data() + offset, endpoint.pending.size() - offset);
+
+    if (written <= 0)
+      exit(endpoint.hangupExitCode);
+
+    offset += written;
+  }
+
+  endpoint.bytesSent += endpoint.pending.size();
+  endpoint.pending.clear();
+}
+
+uint8_t readByte() {
+  if (endpoint.receivedPos == endpoint.received.size()) {
+
+    // The other side is waiting for what we wrote so far.
+    if (!endpoint.pending.empty()) {
+      endpoint.turnarounds++;
+      flush();
+    }
+
+    uint8_t chunk[65536];
+    const ssize_t numRead = read(endpoint.readFd, chunk, sizeof(chunk));
+    if (numRead <= 0)
+      exit(endpoint.hangupExitCode);
+
+    endpoint.received.assign(chunk, chunk + numRead);
+    endpoint.receivedPos = 0;
+  }
+
+  endpoint.bytesRead++;
+  return endpoint.received[endpoint.receivedPos++];
+}
+
+uint32_t readLong() {
+  uint32_t word = 0;
+  for (uint32_t i = 0; i < 4; ++i)
+    word = (word << 8) | readByte();
+
+  return word;
+}
+
+void sendByte(uint8_t byte) {
+  endpoint.pending.push_back(byte);
+}
+
+void sendLong(uint32_t word) {
+  for (int32_t shift = 24; shift >= 0; shift -= 8)
+    sendByte(word >> shift);
+}
+
+const UsbLink hostLink = { readByte, readLong, sendByte, sendLong };
+
+void openEndpoint(int readFd, int writeFd, int hangupExitCode) {
+  endpoint.readFd = readFd;
+  endpoint.writeFd = writeFd;
+  endpoint.pending.clear();
+  endpoint.received.clear();
+  endpoint.receivedPos = 0;
+  endpoint.hangupExitCode = hangupExitCode;
+  endpoint.turnarounds = 0;
+  endpoint.bytesSent = 0;
+  endpoint.bytesRead = 0;
+}
+
+/**
+ * Hash every file under the cd directory the way Filesystem::open
+ * hashes its paths.
+ */
+void scanFiles(const std::string& root, const std::string& relativePath,
+  HostFiles *files) {
+
+  const std::string path = relativePath.empty() ?
+    root : root + "/" + relativePath;
+
+  DIR *directory = opendir(path.c_str());
+  if (directory == nullptr)
+    return;
+
+  std::vector<std::string> names;
+  while (struct dirent *entry = readdir(directory)) {
+    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+      names.push_back(entry->d_name);
+  }
+
+  closedir(directory);
+  std::sort(names.begin(), names.end());
+
+  for (const std::string& name : names) {
+    const std::string childPath = relativePath.empty() ?
+      name : relativePath + "/" + name;
+
+    struct stat childStat;
+    if (stat((root + "/" + childPath).c_str(), &childStat) != 0)
+      continue;
+
+    if (S_ISDIR(childStat.st_mode)) {
+      scanFiles(root, childPath, files);
+      continue;
+    }
+
+    const uint32_t hash = CdBlock::getFilenameHash(childPath.c_str(),
+      childPath.size());
+
+    if (files->count(hash) != 0) {
+      fprintf(stderr, "Hash collision between %s and %s, ignoring the "
+        "second one\n", (*files)[hash].path.c_str(), childPath.c_str());
+      continue;
+    }
+
+    (*files)[hash] = { childPath, (uint32_t) childStat.st_size };
+  }
+}
+
+/**
+ * Read the file of filenameHash from the cd directory.
+ *
+ * @return false If no file has that hash (data is then empty).
+ */
+bool readHostFile(const std::string& root, uint32_t filenameHash,
+  std::vector<uint8_t> *data) {
+
+  data->clear();
+
+  HostFiles files;
+  scanFiles(root, "", &files);
+
+  const HostFiles::const_iterator file = files.find(filenameHash);
+  if (file == files.end())
+    return false;
+
+  FILE *handle = fopen((root + "/" + file->second.path).c_str(), "rb");
+  if (handle == nullptr)
+    return false;
+
+  data->resize(file->second.size);
+  const size_t numRead = fread(data->data(), 1, data->size(), handle);
+  fclose(handle);
+
+  data->resize(numRead);
+  return true;
+}
+
+/**
+ * Manifest of TC_REQUEST_MANIFEST, hashes (ascending, as the map is
+ * sorted) followed by sizes, big endian.
+ */
+std::vector<uint8_t> makeManifest(const HostFiles& files) {
+  std::vector<uint8_t> manifest;
+
+  for (int32_t pass = 0; pass < 2; ++pass) {
+    for (const HostFiles::value_type& file : files) {
+      const uint32_t word = (pass == 0) ? file.first : file.second.size;
+
+      for (int32_t shift = 24; shift >= 0; shift -= 8)
+        manifest.push_back(word >> shift);
+    }
+  }
+
+  return manifest;
+}
+
+uint32_t getNumBlocks(uint32_t size) {
+  return (size + USB_TRANSFER_BLOCK_SIZE - 1) / USB_TRANSFER_BLOCK_SIZE;
+}
+
+uint32_t getBlockSize(uint32_t size, uint32_t block) {
+  const uint32_t offset = block * USB_TRANSFER_BLOCK_SIZE;
+  return (size - offset < USB_TRANSFER_BLOCK_SIZE) ?
+    size - offset : USB_TRANSFER_BLOCK_SIZE;
+}
+
+/**
+ * CRC-32 of every USB_TRANSFER_BLOCK_SIZE block of data, what both sides
+ * of TC_REQUEST_FILE_DELTA compare.
+ */
+std::vector<uint32_t> getBlockChecksums(const std::vector<uint8_t>& data) {
+  const uint32_t size = data.size();
+  std::vector<uint32_t> checksums(getNumBlocks(size));
+
+  for (uint32_t i = 0; i < checksums.size(); ++i) {
+    checksums[i] = crc32_finalize(crc32_update(crc32_init(),
+      data.data() + i * USB_TRANSFER_BLOCK_SIZE, getBlockSize(size, i)));
+  }
+
+  return checksums;
+}
+
+void appendLong(std::vector<uint8_t> *bytes, uint32_t word) {
+  for (int32_t shift = 24; shift >= 0; shift -= 8)
+    bytes->push_back(word >> shift);
+}
+
+void serveFile(const std::vector<uint8_t>& data) {
+  const uint32_t size = data.size();
+  sendLong(size);
+
+  // Nothing follows when the file was not found.
+  if (size == 0)
+    return;
+
+  for (uint8_t byte : data)
+    sendByte(byte);
+
+  sendByte(crc_finalize(crc_update(crc_init(), data.data(), size)));
+
+  // Non zero when the CRC did not match, the Saturn asks again.
+  readByte();
+}
+
+/**
+ * Answer TC_REQUEST_FILE_DELTA, the blocks of the Saturn copy are checked
+ * against the current file.
+ *
+ * @return Bytes of changed blocks sent.
+ */
+uint32_t serveDelta(const std::string& root, std::vector<uint8_t> *data) {
+  const uint32_t filenameHash = readLong();
+  const uint32_t maxSize = readLong();
+  const uint32_t oldSize = readLong();
+
+  std::vector<uint32_t> oldChecksums(getNumBlocks(oldSize));
+  for (uint32_t& checksum : oldChecksums)
+    checksum = readLong();
+
+  if (!readHostFile(root, filenameHash, data) || data->empty()) {
+    UsbTransfer::sendFile(&hostLink, nullptr, 0);
+    return 0;
+  }
+
+  const uint32_t size = data->size();
+  const std::vector<uint32_t> checksums = getBlockChecksums(*data);
+
+  std::vector<uint32_t> changedBlocks;
+  uint32_t changedBytes = 0;
+
+  for (uint32_t i = 0; i < checksums.size(); ++i) {
+    if (i < oldChecksums.size() && 
+      getBlockSize(oldSize, i) == getBlockSize(size, i) &&
+      oldChecksums[i] == checksums[i]) {
+
+      continue;
+    }
+
+    changedBlocks.push_back(i);
+    changedBytes += getBlockSize(size, i);
+  }
+
+  std::vector<uint8_t> delta;
+  appendLong(&delta, size);
+  appendLong(&delta, crc32_finalize(crc32_update(crc32_init(), data->data(),
+    size)));
+
+  appendLong(&delta, changedBlocks.size());
+  for (uint32_t block : changedBlocks)
+    appendLong(&delta, block);
+
+  if (UsbTransfer::sendFile(&hostLink, delta.data(), delta.size()) != 0 ||
+    size > maxSize) {
+
+    return 0;
+  }
+
+  UsbTransfer::sendBlockList(&hostLink, data->data(), size,
+    changedBlocks.data(), changedBlocks.size());
+
+  return changedBytes;
+}
+
+/**
+ * Answer requests until the link is closed.
+ */
+void serve(const std::string& root, bool verbose) {
+  for (;;) {
+    const uint8_t command = readByte();
+    std::vector<uint8_t> data;
+
+    switch (command) {
+    case TC_REQUEST_FILE:
+      readHostFile(root, readLong(), &data);
+      serveFile(data);
+      break;
+
+    case TC_REQUEST_FILE_SIZE:
+      readHostFile(root, readLong(), &data);
+      sendLong(data.size());
+      break;
+
+    case TC_REQUEST_FILE_BLOCKS:
+      readHostFile(root, readLong(), &data);
+      UsbTransfer::sendFile(&hostLink, data.data(), data.size());
+      break;
+
+    case TC_REQUEST_MANIFEST:
+      {
+        HostFiles files;
+        scanFiles(root, "", &files);
+
+        data = makeManifest(files);
+        UsbTransfer::sendFile(&hostLink, data.data(), data.size());
+      }
+      break;
+
+    case TC_REQUEST_FILE_DELTA:
+      {
+        const uint32_t changedBytes = serveDelta(root, &data);
+
+        if (verbose) {
+          fprintf(stderr, "Command %u: %u of %zu bytes changed\n", command,
+            changedBytes, data.size());
+        }
+      }
+      continue;
+
+    default:
+      fprintf(stderr, "Unknown command %u\n", command);
+      continue;
+    }
+
+    if (verbose)
+      fprintf(stderr, "Command %u: %zu bytes\n", command, data.size());
+  }
+}
+
+int openDevice(const char *path) {
+  const int fd = open(path, O_RDWR | O_NOCTTY);
+  if (fd < 0 || !isatty(fd))
+    return fd;
+
+  struct termios attributes;
+  if (tcgetattr(fd, &attributes) == 0) {
+    cfmakeraw(&attributes);
+    tcsetattr(fd, TCSANOW, &attributes);
+  }
+
+  return fd;
+}
+
+// Client side of the local check, mirrors filesystem.cpp.
+uint32_t clientGetFileSize(uint32_t filenameHash) {
+  sendByte(TC_REQUEST_FILE_SIZE);
+  sendLong(filenameHash);
+  return readLong();
+}
+
+uint32_t clientGetFileData(uint32_t filenameHash, std::vector<uint8_t> *data,
+  uint32_t maxSize) {
+
+  sendByte(TC_REQUEST_FILE_BLOCKS);
+  sendLong(filenameHash);
+
+  uint32_t size = 0;
+  if (UsbTransfer::receiveSize(&hostLink, &size, maxSize) != 0 || size == 0)
+    return 0;
+
+  data->resize(size);
+  if (UsbTransfer::receiveBlocks(&hostLink, data->data(), size) != 0)
+    return 0;
+
+  return size;
+}
+
+bool clientGetManifest(std::map<uint32_t, uint32_t> *sizes) {
+  sendByte(TC_REQUEST_MANIFEST);
+
+  uint32_t size = 0;
+  if (UsbTransfer::receiveSize(&hostLink, &size) != 0 || size % 8 != 0)
+    return false;
+
+  std::vector<uint8_t> manifest(size);
+  if (UsbTransfer::receiveBlocks(&hostLink, manifest.data(), size) != 0)
+    return false;
+
+  const uint32_t numEntries = size / 8;
+  for (uint32_t i = 0; i < numEntries; ++i) {
+    uint32_t hash = 0;
+    uint32_t fileSize = 0;
+
+    for (uint32_t j = 0; j < 4; ++j) {
+      hash = (hash << 8) | manifest[i * 4 + j];
+      fileSize = (fileSize << 8) | manifest[(numEntries + i) * 4 + j];
+    }
+
+    (*sizes)[hash] = fileSize;
+  }
+
+  return true;
+}
+
+struct ClientReport {
+  uint32_t numFiles;
+  uint32_t numIntact;
+  uint64_t turnarounds;
+  uint64_t wireBytes;
+};
+
+void printReport(const char *name, const ClientReport& report) {
+  const double seconds = report.wireBytes / LINK_BYTES_PER_SECOND +
+    report.turnarounds * LINK_TURNAROUND_SECONDS;
+
+  printf("%-9s %u/%u files intact, %llu turnarounds, %llu bytes, "
+    "%.1f ms\n", name, report.numIntact, report.numFiles,
+    (unsigned long long) report.turnarounds,
+    (unsigned long long) report.wireBytes, seconds * 1000.0);
+}
+
+/**
+ * Load every file, asking its size first or from the manifest.
+ */
+ClientReport loadEveryFile(const std::string& root, bool useManifest) {
+  HostFiles files;
+  scanFiles(root, "", &files);
+
+  const uint64_t startTurnarounds = endpoint.turnarounds;
+  const uint64_t startBytes = endpoint.bytesSent + endpoint.bytesRead;
+
+  std::map<uint32_t, uint32_t> manifest;
+  if (useManifest && !clientGetManifest(&manifest))
+    fprintf(stderr, "Manifest transfer failed\n");
+
+  ClientReport report = { 0, 0, 0, 0 };
+  for (const HostFiles::value_type& file : files) {
+    report.numFiles++;
+
+    const uint32_t size = useManifest ?
+      manifest[file.first] : clientGetFileSize(file.first);
+
+    if (size == 0)
+      continue;
+
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> expected;
+    readHostFile(root, file.first, &expected);
+
+    if (clientGetFileData(file.first, &data, size) == size &&
+      data == expected) {
+
+      report.numIntact++;
+    }
+  }
+
+  report.turnarounds = endpoint.turnarounds - startTurnarounds;
+  report.wireBytes = endpoint.bytesSent + endpoint.bytesRead - startBytes;
+  return report;
+}
+
+/**
+ * Fork a server of root, this process becomes its client.
+ *
+ * @return Process of the server, -1 on failure.
+ */
+pid_t startLocalServer(const std::string& root) {
+  int sockets[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+    return -1;
+
+  const pid_t server = fork();
+  if (server == 0) {
+    close(sockets[0]);
+    openEndpoint(sockets[1], sockets[1], 0);
+    serve(root, false);
+    exit(0);
+  }
+
+  close(sockets[1]);
+  openEndpoint(sockets[0], sockets[0], 1);
+  return server;
+}
+
+void stopLocalServer(pid_t server) {
+  close(endpoint.readFd);
+  waitpid(server, nullptr, 0);
+}
+
+int checkLocally(const std::string& root) {
+  const pid_t server = startLocalServer(root);
+  if (server < 0)
+    return 1;
+
+  const ClientReport sizeReport = loadEveryFile(root, false);
+  const ClientReport manifestReport = loadEveryFile(root, true);
+
+  stopLocalServer(server);
+
+  printReport("size:", sizeReport);
+  printReport("manifest:", manifestReport);
+
+  const bool ok = sizeReport.numIntact == sizeReport.numFiles &&
+    manifestReport.numIntact == manifestReport.numFiles;
+
+  return ok ? 0 : 1;
+}
+
+/**
+ * Client side of TC_REQUEST_FILE_DELTA, mirrors File::reload.
+ *
+ * @return true If copy now matches the host file.
+ */
+bool clientReloadFile(uint32_t filenameHash, std::vector<uint8_t> *copy) {
+  sendByte(TC_REQUEST_FILE_DELTA);
+  sendLong(filenameHash);
+  sendLong(UINT32_MAX);
+  sendLong(copy->size());
+
+  for (uint32_t checksum : getBlockChecksums(*copy))
+    sendLong(checksum);
+
+  uint32_t deltaSize = 0;
+  if (UsbTransfer::receiveSize(&hostLink, &deltaSize) != 0 || deltaSize == 0)
+    return false;
+
+  std::vector<uint8_t> delta(deltaSize);
+  if (UsbTransfer::receiveBlocks(&hostLink, delta.data(), deltaSize) != 0)
+    return false;
+
+  std::vector<uint32_t> words(deltaSize / 4);
+  for (uint32_t i = 0; i < words.size(); ++i) {
+    for (uint32_t j = 0; j < 4; ++j)
+      words[i] = (words[i] << 8) | delta[i * 4 + j];
+  }
+
+  const uint32_t size = words[0];
+  const uint32_t fileCRC = words[1];
+  const uint32_t numChanged = words[2];
+
+  copy->resize(size);
+  if (UsbTransfer::receiveBlockList(&hostLink, copy->data(), size,
+    words.data() + 3, numChanged) != 0) {
+
+    return false;
+  }
+
+  return crc32_finalize(crc32_update(crc32_init(), copy->data(), size)) ==
+    fileCRC;
+}
+
+bool readPath(const std::string& path, std::vector<uint8_t> *data) {
+  FILE *handle = fopen(path.c_str(), "rb");
+  if (handle == nullptr)
+    return false;
+
+  struct stat fileStat;
+  fstat(fileno(handle), &fileStat);
+
+  data->resize(fileStat.st_size);
+  const size_t numRead = fread(data->data(), 1, data->size(), handle);
+  fclose(handle);
+
+  data->resize(numRead);
+  return true;
+}
+
+bool writePath(const std::string& path, const std::vector<uint8_t>& data) {
+  FILE *handle = fopen(path.c_str(), "wb");
+  if (handle == nullptr)
+    return false;
+
+  const size_t numWritten = fwrite(data.data(), 1, data.size(), handle);
+  fclose(handle);
+
+  return numWritten == data.size();
+}
+
+bool copyFiles(const std::string& root, const std::string& copyRoot,
+  const HostFiles& files) {
+
+  for (const HostFiles::value_type& file : files) {
+    const std::string& path = file.second.path;
+
+    // Create the parent directories first.
+    for (size_t slash = path.find('/'); slash != std::string::npos;
+      slash = path.find('/', slash + 1)) {
+
+      mkdir((copyRoot + "/" + path.substr(0, slash)).c_str(), 0755);
+    }
+
+    std::vector<uint8_t> data;
+    if (!readPath(root + "/" + path, &data) ||
+      !writePath(copyRoot + "/" + path, data)) {
+
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void removeFiles(const std::string& copyRoot, const HostFiles& files) {
+  for (const HostFiles::value_type& file : files)
+    unlink((copyRoot + "/" + file.second.path).c_str());
+
+  // Deepest directories first, rmdir fails on the ones still holding any.
+  for (uint32_t pass = 0; pass < 16; ++pass) {
+    for (const HostFiles::value_type& file : files) {
+      const std::string& path = file.second.path;
+      const size_t slash = path.rfind('/');
+
+      if (slash != std::string::npos)
+        rmdir((copyRoot + "/" + path.substr(0, slash)).c_str());
+    }
+  }
+
+  rmdir(copyRoot.c_str());
+}
+
+typedef std::function<void(std::vector<uint8_t>*, std::mt19937*)> Edit;
+
+struct EditKind {
+  const char *name;
+  Edit apply;
+};
+
+const EditKind editKinds[] = {
+  { "byte", [](std::vector<uint8_t> *data, std::mt19937 *random) {
+      (*data)[(*random)() % data->size()] ^= 0xFF;
+    } },
+
+  { "span 256", [](std::vector<uint8_t> *data, std::mt19937 *random) {
+      const uint32_t offset = (*random)() % data->size();
+      for (uint32_t i = offset; i < offset + 256 && i < data->size(); ++i)
+        (*data)[i] = (*random)();
+    } },
+
+  { "append 1K", [](std::vector<uint8_t> *data, std::mt19937 *random) {
+      for (uint32_t i = 0; i < 1024; ++i)
+        data->push_back((*random)());
+    } },
+
+  { "truncate", [](std::vector<uint8_t> *data, std::mt19937 *) {
+      data->resize(data->size() - data->size() / 10);
+    } },
+
+  { "insert 16", [](std::vector<uint8_t> *data, std::mt19937 *random) {
+      const uint32_t offset = (*random)() % data->size();
+      data->insert(data->begin() + offset, 16, 0xA5);
+    } }
+};
+
+struct EditReport {
+  uint32_t numEdits;
+  uint32_t numIntact;
+  uint64_t deltaBytes;
+  uint64_t fullBytes;
+};
+
+int measureEdits(const std::string& root) {
+  HostFiles files;
+  scanFiles(root, "", &files);
+
+  char copyTemplate[] = "/tmp/usbserverXXXXXX";
+  if (mkdtemp(copyTemplate) == nullptr)
+    return 1;
+
+  const std::string copyRoot = copyTemplate;
+  if (!copyFiles(root, copyRoot, files)) {
+    fprintf(stderr, "Unable to copy %s to %s\n", root.c_str(),
+      copyRoot.c_str());
+
+    removeFiles(copyRoot, files);
+    return 1;
+  }
+
+  const pid_t server = startLocalServer(copyRoot);
+  if (server < 0) {
+    removeFiles(copyRoot, files);
+    return 1;
+  }
+
+  const uint32_t numKinds = sizeof(editKinds) / sizeof(editKinds[0]);
+  std::vector<EditReport> reports(numKinds, { 0, 0, 0, 0 });
+  std::mt19937 random(1);
+
+  for (const HostFiles::value_type& file : files) {
+    const std::string path = copyRoot + "/" + file.second.path;
+
+    std::vector<uint8_t> copy;
+    if (file.second.size == 0 || 
+      clientGetFileData(file.first, &copy, UINT32_MAX) == 0) {
+
+      continue;
+    }
+
+    for (uint32_t i = 0; i < numKinds; ++i) {
+      std::vector<uint8_t> edited;
+      readPath(path, &edited);
+      editKinds[i].apply(&edited, &random);
+
+      // Truncating tiny files may leave nothing to serve.
+      if (edited.empty())
+        continue;
+
+      writePath(path, edited);
+
+      const uint64_t startBytes = endpoint.bytesSent + endpoint.bytesRead;
+      const bool reloaded = clientReloadFile(file.first, &copy);
+      const uint64_t deltaBytes = endpoint.bytesSent + endpoint.bytesRead -
+        startBytes;
+
+      std::vector<uint8_t> fullCopy;
+      const uint64_t fullStartBytes = endpoint.bytesSent + endpoint.bytesRead;
+      clientGetFileData(file.first, &fullCopy, UINT32_MAX);
+
+      EditReport& report = reports[i];
+      report.numEdits++;
+      report.numIntact += (reloaded && copy == edited);
+      report.deltaBytes += deltaBytes;
+      report.fullBytes += endpoint.bytesSent + endpoint.bytesRead -
+        fullStartBytes;
+
+      // Keep going from the host version if the reload failed.
+      copy = fullCopy;
+    }
+  }
+
+  stopLocalServer(server);
+  removeFiles(copyRoot, files);
+
+  bool ok = true;
+  printf("%-10s %6s %8s %14s %14s %7s\n", "edit", "files", "intact",
+    "full bytes", "delta bytes", "ratio");
+
+  for (uint32_t i = 0; i < numKinds; ++i) {
+    const EditReport& report = reports[i];
+    printf("%-10s %6u %8u %14llu %14llu %6.1f%%\n", editKinds[i].name,
+      report.numEdits, report.numIntact,
+      (unsigned long long) report.fullBytes,
+      (unsigned long long) report.deltaBytes,
+      (report.fullBytes > 0) ?
+        100.0 * report.deltaBytes / report.fullBytes : 0.0);
+
+    ok = ok && (report.numIntact == report.numEdits);
+  }
+
+  return ok ? 0 : 1;
+}
+
+
+} // namespace ''
+
+int main(int argc, char **argv) {
+  if (argc == 3 && strcmp(argv[1], "-c") == 0)
+    return checkLocally(argv[2]);
+
+  if (argc == 3 && strcmp(argv[1], "-e") == 0)
+    return measureEdits(argv[2]);
+
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <cd directory> <device>\n"
+      "       %s -c <cd directory>\n"
+      "       %s -e <cd directory>\n", argv[0], argv[0], argv[0]);
+
+    return 1;
+  }
+
+  int readFd = STDIN_FILENO;
+  int writeFd = STDOUT_FILENO;
+
+  if (strcmp(argv[2], "-") != 0) {
+    readFd = writeFd = openDevice(argv[2]);
+    if (readFd < 0) {
+      fprintf(stderr, "Unable to open %s\n", argv[2]);
+      return 1;
+    }
+  }
+
+  openEndpoint(readFd, writeFd, 0);
+  serve(argv[1], true);
+  return 0;
+}
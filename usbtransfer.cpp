@@ -0,0 +1,375 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+#include <assert.h>
+#include <string.h>
+#include "crc32.h"
+#include "usbtransfer.h"
+
+namespace UsbTransfer {
+
+
+namespace {
+
+
+UsbTransferStatistics statistics;
+
+crc32_t updateWord(crc32_t crc, uint32_t word) {
+  const unsigned char bytes[] = {
+    (unsigned char) (word >> 24), (unsigned char) (word >> 16),
+    (unsigned char) (word >> 8), (unsigned char) word
+  };
+
+  return crc32_update(crc, bytes, 4);
+}
+
+/**
+ * Second word of a block, the data length in the low half and its
+ * complement in the high half.
+ */
+inline uint32_t makeLengthWord(uint32_t length) {
+  return length | ((~length & 0xFFFF) << 16);
+}
+
+/**
+ * Length of a block, from its second word.
+ *
+ * @return false If the word was damaged.
+ */
+inline bool getLength(uint32_t lengthWord, uint32_t *length) {
+  *length = lengthWord & 0xFFFF;
+  return ((lengthWord >> 16) ^ *length) == 0xFFFF &&
+    *length <= USB_TRANSFER_BLOCK_SIZE;
+}
+
+void sendReply(const UsbLink *link, uint8_t reply) {
+  link->sendLong(reply * 0x01010101);
+}
+
+/**
+ * Read a reply. Each of its 4 bytes is matched to the reply code at most 1
+ * bit away (codes are 3 bits or more apart), the code matched by most
+ * bytes wins.
+ *
+ * @return 0 If no code won.
+ */
+uint8_t readReply(const UsbLink *link) {
+  const uint8_t codes[] = {
+    USB_TRANSFER_ACK, USB_TRANSFER_NACK, USB_TRANSFER_ABORT
+  };
+
+  uint32_t votes[] = { 0, 0, 0 };
+  const uint32_t reply = link->readLong();
+
+  for (int32_t shift = 24; shift >= 0; shift -= 8) {
+    for (uint32_t i = 0; i < 3; ++i) {
+      if (__builtin_popcount(((reply >> shift) ^ codes[i]) & 0xFF) <= 1)
+        votes[i]++;
+    }
+  }
+
+  for (uint32_t i = 0; i < 3; ++i) {
+    if (votes[i] >= 2 && votes[i] > votes[(i + 1) % 3] &&
+      votes[i] > votes[(i + 2) % 3]) {
+
+      return codes[i];
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Read numBytes of block data into dest, or drop them if dest is nullptr,
+ * and add them to crc chunk by chunk.
+ */
+crc32_t receiveData(const UsbLink *link, uint8_t *dest, uint32_t numBytes,
+  crc32_t crc) {
+
+  uint8_t drainChunk[USB_TRANSFER_CRC_CHUNK];
+
+  while (numBytes > 0) {
+    const uint32_t chunkBytes = (numBytes < USB_TRANSFER_CRC_CHUNK) ?
+      numBytes : USB_TRANSFER_CRC_CHUNK;
+
+    uint8_t *chunk = (dest != nullptr) ? dest : drainChunk;
+
+    uint32_t i = 0;
+    for (; i + 4 <= chunkBytes; i += 4) {
+      const uint32_t word = link->readLong();
+      chunk[i] = word >> 24;
+      chunk[i + 1] = word >> 16;
+      chunk[i + 2] = word >> 8;
+      chunk[i + 3] = word;
+    }
+
+    for (; i < chunkBytes; ++i)
+      chunk[i] = link->readByte();
+
+    crc = crc32_update(crc, chunk, chunkBytes);
+
+    if (dest != nullptr)
+      dest += chunkBytes;
+
+    numBytes -= chunkBytes;
+  }
+
+  return crc;
+}
+
+/**
+ * Send numBytes of block data a word at a time, same order as bytes.
+ */
+void sendData(const UsbLink *link, const uint8_t *data, uint32_t numBytes) {
+  uint32_t i = 0;
+  for (; i + 4 <= numBytes; i += 4) {
+    link->sendLong((data[i] << 24) | (data[i + 1] << 16) |
+      (data[i + 2] << 8) | data[i + 3]);
+  }
+
+  for (; i < numBytes; ++i)
+    link->sendByte(data[i]);
+}
+
+inline uint32_t getBlockSize(uint32_t size, uint32_t offset) {
+  return (size - offset < USB_TRANSFER_BLOCK_SIZE) ?
+    size - offset : USB_TRANSFER_BLOCK_SIZE;
+}
+
+// Offset of the block sent in position sequence, blocks nullptr means
+// every block of the file in order.
+inline uint32_t getBlockOffset(const uint32_t *blocks, uint32_t sequence) {
+  return ((blocks != nullptr) ? blocks[sequence] : sequence) * 
+    USB_TRANSFER_BLOCK_SIZE;
+}
+
+inline uint32_t getNumBlocks(uint32_t size) {
+  return (size + USB_TRANSFER_BLOCK_SIZE - 1) / USB_TRANSFER_BLOCK_SIZE;
+}
+
+int receiveListedBlocks(const UsbLink *link, uint8_t *buffer, uint32_t size,
+  const uint32_t *blocks, uint32_t numBlocks) {
+
+  uint32_t sequence = 0;
+  uint32_t retries = 0;
+
+  while (sequence < numBlocks) {
+    const uint32_t blockSequence = link->readLong();
+    const uint32_t lengthWord = link->readLong();
+    crc32_t crc = updateWord(updateWord(crc32_init(), blockSequence),
+      lengthWord);
+
+    const uint32_t offset = getBlockOffset(blocks, sequence);
+    assert(offset < size);
+
+    const uint32_t blockSize = getBlockSize(size, offset);
+
+    // The sender may be repeating the previous block, whatever the
+    // sequence number says until the CRC matches. A length that fits
+    // neither can't frame the block: as replies hardly ever get lost, the
+    // expected one is then the best guess.
+    const uint32_t previousSize = (sequence > 0) ?
+      getBlockSize(size, getBlockOffset(blocks, sequence - 1)) : blockSize;
+
+    uint32_t length = 0;
+    if (!getLength(lengthWord, &length) ||
+      (length != blockSize && length != previousSize)) {
+
+      length = blockSize;
+    }
+
+    // Stored at the place of the expected block, that only holds its size.
+    const uint32_t storedBytes = (length < blockSize) ? length : blockSize;
+    crc = receiveData(link, (buffer != nullptr) ? buffer + offset : nullptr,
+      storedBytes, crc);
+
+    crc = receiveData(link, nullptr, length - storedBytes, crc);
+
+    statistics.dataBytes += length;
+    const bool intact = (link->readLong() == crc32_finalize(crc));
+
+    if (intact && blockSequence == sequence && length == blockSize) {
+      sendReply(link, USB_TRANSFER_ACK);
+      statistics.blocksTransferred++;
+
+      sequence++;
+      retries = 0;
+      continue;
+    }
+
+    statistics.blocksRetried++;
+    if (++retries > USB_TRANSFER_MAX_RETRIES) {
+      sendReply(link, USB_TRANSFER_ABORT);
+      statistics.failedTransfers++;
+      return -1;
+    }
+
+    // The previous block again, our ACK was lost.
+    const bool repeated = (blockSequence + 1 == sequence);
+    sendReply(link, (intact && repeated) ?
+      USB_TRANSFER_ACK : USB_TRANSFER_NACK);
+  }
+
+  return 0;
+}
+
+int sendListedBlocks(const UsbLink *link, const uint8_t *data, uint32_t size,
+  const uint32_t *blocks, uint32_t numBlocks) {
+
+  uint32_t sequence = 0;
+  uint32_t retries = 0;
+
+  while (sequence < numBlocks) {
+    const uint32_t offset = getBlockOffset(blocks, sequence);
+    assert(offset < size);
+
+    const uint32_t blockSize = getBlockSize(size, offset);
+    const uint8_t *block = data + offset;
+
+    const uint32_t lengthWord = makeLengthWord(blockSize);
+
+    link->sendLong(sequence);
+    link->sendLong(lengthWord);
+    sendData(link, block, blockSize);
+
+    link->sendLong(crc32_finalize(crc32_update(updateWord(
+      updateWord(crc32_init(), sequence), lengthWord), block, blockSize)));
+
+    statistics.dataBytes += blockSize;
+
+    // Anything but an ACK or ABORT is taken as a NACK.
+    const uint8_t reply = readReply(link);
+    if (reply == USB_TRANSFER_ACK) {
+      statistics.blocksTransferred++;
+
+      sequence++;
+      retries = 0;
+      continue;
+    }
+
+    // The receiver may have stored a block whose ACK was lost and counts
+    // one retry less, it gives up first and says so. Past that, its ABORT
+    // was lost.
+    statistics.blocksRetried++;
+    if (reply == USB_TRANSFER_ABORT ||
+      ++retries > USB_TRANSFER_MAX_RETRIES + 1) {
+
+      statistics.failedTransfers++;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+} // namespace ''
+
+int receiveSize(const UsbLink *link, uint32_t *size, uint32_t maxSize) {
+  assert(link != nullptr);
+  assert(size != nullptr);
+
+  for (uint32_t retries = 0; ; ++retries) {
+    *size = link->readLong();
+    const uint32_t crc = link->readLong();
+
+    const bool intact =
+      (crc == crc32_finalize(updateWord(crc32_init(), *size)));
+
+    if (intact && *size <= maxSize) {
+      sendReply(link, USB_TRANSFER_ACK);
+      return 0;
+    }
+
+    if (intact || retries == USB_TRANSFER_MAX_RETRIES)
+      break;
+
+    sendReply(link, USB_TRANSFER_NACK);
+  }
+
+  sendReply(link, USB_TRANSFER_ABORT);
+  statistics.failedTransfers++;
+
+  *size = 0;
+  return -1;
+}
+
+int receiveBlocks(const UsbLink *link, uint8_t *buffer, uint32_t size) {
+  assert(link != nullptr);
+  return receiveListedBlocks(link, buffer, size, nullptr, getNumBlocks(size));
+}
+
+int receiveBlockList(const UsbLink *link, uint8_t *buffer, uint32_t size,
+  const uint32_t *blocks, uint32_t numBlocks) {
+
+  assert(link != nullptr);
+  assert(blocks != nullptr || numBlocks == 0);
+
+  return receiveListedBlocks(link, buffer, size, blocks, numBlocks);
+}
+
+void abortBlocks(const UsbLink *link, uint32_t size) {
+  assert(link != nullptr);
+
+  link->readLong();
+
+  uint32_t length = 0;
+  if (!getLength(link->readLong(), &length))
+    length = getBlockSize(size, 0);
+
+  receiveData(link, nullptr, length, crc32_init());
+  link->readLong();
+
+  sendReply(link, USB_TRANSFER_ABORT);
+  statistics.failedTransfers++;
+}
+
+int sendFile(const UsbLink *link, const uint8_t *data, uint32_t size) {
+  assert(link != nullptr);
+  assert(data != nullptr || size == 0);
+
+  // An unreadable reply is taken as an ACK: if the receiver did give up,
+  // it fails its next request instead of waiting for blocks forever.
+  for (uint32_t retries = 0; ; ++retries) {
+    link->sendLong(size);
+    link->sendLong(crc32_finalize(updateWord(crc32_init(), size)));
+
+    const uint8_t reply = readReply(link);
+    if (reply == USB_TRANSFER_ABORT ||
+      (reply == USB_TRANSFER_NACK && retries == USB_TRANSFER_MAX_RETRIES)) {
+
+      statistics.failedTransfers++;
+      return -1;
+    }
+
+    if (reply != USB_TRANSFER_NACK)
+      break;
+  }
+
+  return sendListedBlocks(link, data, size, nullptr, getNumBlocks(size));
+}
+
+int sendBlockList(const UsbLink *link, const uint8_t *data, uint32_t size,
+  const uint32_t *blocks, uint32_t numBlocks) {
+
+  assert(link != nullptr);
+  assert(blocks != nullptr || numBlocks == 0);
+
+  return sendListedBlocks(link, data, size, blocks, numBlocks);
+}
+
+void getStatistics(UsbTransferStatistics *stats) {
+  assert(stats != nullptr);
+  *stats = statistics;
+}
+
+void resetStatistics() {
+  memset(&statistics, 0, sizeof(UsbTransferStatistics));
+}
+
+
+} // namespace UsbTransfer
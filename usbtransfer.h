@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2020 - Romulo Fernandes Machado Leitao
+ * See LICENSE for details.
+ *
+ * Romulo Fernandes Machado Leitao <abra185@gmail.com>
+ */
+
+#pragma once
+
+// Kept free of yaul, shared with the host tools.
+#include <stdint.h>
+
+/**
+ * Block protocol of USB file transfers, after the request command.
+ *
+ * The sender starts with the file size and the CRC-32 of its 4 bytes. The
+ * receiver answers USB_TRANSFER_ACK, USB_TRANSFER_NACK to have them sent
+ * again when the CRC does not match, or USB_TRANSFER_ABORT when the file
+ * does not fit or the CRC failed USB_TRANSFER_MAX_RETRIES times. Nothing
+ * else follows a size of 0 (file not found).
+ *
+ * The file then follows in blocks of USB_TRANSFER_BLOCK_SIZE bytes (the
+ * last one may be shorter): the block sequence number, the data length
+ * (low half, the high half holds its complement), the data and the CRC-32
+ * of all of them. The receiver answers every block:
+ *   USB_TRANSFER_ACK   Block stored, the sender moves to the next one.
+ *   USB_TRANSFER_NACK  Block damaged, the sender sends it again.
+ *   USB_TRANSFER_ABORT A block failed USB_TRANSFER_MAX_RETRIES times in a
+ *                      row, the transfer is over.
+ * A repeated block (the ACK of the previous one was lost) is acknowledged
+ * again and dropped once its CRC matches. Replies are sent as a word with
+ * the code in every byte, read by majority, so a damaged reply is hardly
+ * ever mistaken for another. Every word is big endian.
+ */
+#define USB_TRANSFER_BLOCK_SIZE 4096
+#define USB_TRANSFER_MAX_RETRIES 8
+
+// Block data is moved a word at a time and added to the CRC every
+// USB_TRANSFER_CRC_CHUNK bytes, while they are still in cache.
+#define USB_TRANSFER_CRC_CHUNK 64
+
+#define USB_TRANSFER_ACK 0x06
+#define USB_TRANSFER_NACK 0x15
+#define USB_TRANSFER_ABORT 0x18
+
+/**
+ * Requests of the Saturn to the USB host, a command byte followed by its
+ * arguments.
+ */
+enum UsbTransferCommand {
+  // Filename hash. Answered by the file size, the whole file and an 8 bit
+  // CRC, superseded by TC_REQUEST_FILE_BLOCKS.
+  TC_REQUEST_FILE = 0,
+
+  // Filename hash. Answered by the file size, 0 if not found.
+  TC_REQUEST_FILE_SIZE,
+
+  // Filename hash. File sent with the block protocol.
+  TC_REQUEST_FILE_BLOCKS,
+
+  // No arguments. Manifest of every file sent with the block protocol:
+  // the filename hashes in ascending order, then the size of each file in
+  // the same order. 8 bytes per file, nothing at all when there are none.
+  TC_REQUEST_MANIFEST,
+
+  // Filename hash, room for the file (bytes), size of the copy held by the
+  // Saturn and the CRC-32 of each USB_TRANSFER_BLOCK_SIZE block of that
+  // copy. Answered, with the block protocol, by the new size, the CRC-32 of
+  // the whole new file, the number of changed blocks and their indices in
+  // ascending order (nothing at all if the file was not found). Unless the
+  // new size exceeds the room given, the changed blocks follow as a block
+  // list (see sendBlockList).
+  TC_REQUEST_FILE_DELTA,
+
+  TC_INVALID = 0xFF
+};
+
+/**
+ * Byte stream between the Saturn and the host (usb_cart_* on the Saturn).
+ * Reads block until data arrives.
+ */
+struct UsbLink {
+  uint8_t (*readByte)();
+  uint32_t (*readLong)();
+  void (*sendByte)(uint8_t);
+  void (*sendLong)(uint32_t);
+};
+
+/**
+ * Counters of the block protocol, for either side.
+ */
+struct UsbTransferStatistics {
+  // Blocks accepted (receiver) or acknowledged (sender).
+  uint32_t blocksTransferred;
+
+  // Blocks sent again after a NACK or a lost ACK.
+  uint32_t blocksRetried;
+
+  // Every byte of file data crossing the link, repeated blocks included.
+  uint32_t dataBytes;
+
+  // Transfers given up after too many retries or a damaged size.
+  uint32_t failedTransfers;
+};
+
+namespace UsbTransfer {
+
+
+/**
+ * Receive the file size announced by the sender.
+ *
+ * @param size Size of the file, 0 if the sender does not have it.
+ * @param maxSize Larger files are refused (the transfer is aborted).
+ *
+ * @return 0 If the size arrived intact (or the file was not found).
+ */
+extern int receiveSize(const UsbLink *link, uint32_t *size, 
+  uint32_t maxSize = UINT32_MAX);
+
+/**
+ * Receive a whole file, after receiveSize.
+ *
+ * @param buffer Destination, must hold size bytes. With nullptr the file
+ *               is still received (and checked) but dropped.
+ * @param size Size returned by receiveSize.
+ *
+ * @return 0 If every block was received.
+ */
+extern int receiveBlocks(const UsbLink *link, uint8_t *buffer,
+  uint32_t size);
+
+/**
+ * Receive some blocks of a file, in the order given, each one stored at
+ * its place in buffer. Nothing (size included) precedes them, both sides
+ * agreed on the list beforehand.
+ *
+ * @param buffer Destination, must hold size bytes.
+ * @param size Size of the whole file.
+ * @param blocks Indices of the USB_TRANSFER_BLOCK_SIZE blocks, ascending.
+ *
+ * @return 0 If every listed block was received.
+ */
+extern int receiveBlockList(const UsbLink *link, uint8_t *buffer, 
+  uint32_t size, const uint32_t *blocks, uint32_t numBlocks);
+
+/**
+ * Refuse blocks the sender already started (after an ACK of the size or
+ * an agreed list), when they can't be stored. The first block is read and
+ * answered USB_TRANSFER_ABORT, nothing else follows.
+ *
+ * @param size Size of the whole file, for the first block length if its
+ *   header was damaged.
+ */
+extern void abortBlocks(const UsbLink *link, uint32_t size);
+
+/**
+ * Sender side of receiveSize and receiveBlocks, used by the host.
+ *
+ * @return 0 If the receiver got the whole file.
+ */
+extern int sendFile(const UsbLink *link, const uint8_t *data, uint32_t size);
+
+/**
+ * Sender side of receiveBlockList, used by the host.
+ *
+ * @return 0 If the receiver got every listed block.
+ */
+extern int sendBlockList(const UsbLink *link, const uint8_t *data, 
+  uint32_t size, const uint32_t *blocks, uint32_t numBlocks);
+
+/**
+ * Copy the protocol counters into stats.
+ */
+extern void getStatistics(UsbTransferStatistics *stats);
+
+/**
+ * Zero the protocol counters.
+ */
+extern void resetStatistics();
+
+
+} // namespace UsbTransfer